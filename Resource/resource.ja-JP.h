@@ -673,6 +673,7 @@
 #define IDS_MSGJPN336                   10336
 #define IDS_MSGJPN337                   10337
 #define IDS_MSGJPN338                   10338
+#define IDS_MSGJPN339                   10339
 #define IDS_MSGJPN2000                  12000
 #define MENU_END                        40001
 #define MENU_EXIT                       40001
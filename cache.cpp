@@ -29,9 +29,236 @@
 
 #include "common.h"
 
+extern int ListCache;
+
 // キャッシュのファイル名を作成する
 fs::path MakeCacheFileName(int Num) {
 	wchar_t filename[16];
 	_swprintf(filename, L"_ffftp.%03d", Num);
 	return tempDirectory() / filename;
 }
+
+
+// ファイル一覧キャッシュの合計サイズの上限
+constexpr uintmax_t LIST_CACHE_SIZE = 32 * 1024 * 1024;
+
+// 永続キャッシュはメインスレッドと転送スレッドの両方から操作される
+static std::mutex listCacheMutex;
+
+// ホストごとのキャッシュの索引 (パス → ファイルサイズ)
+//   最初に使用したときにフォルダ内のファイルを読んで作成し、以降は保存・破棄に合わせて更新する
+static std::map<fs::path, std::map<std::wstring, uintmax_t>> listCacheIndex;
+
+// キャッシュの合計サイズ　最初に保存するときに数え、以降は保存・破棄に合わせて増減する
+static std::optional<uintmax_t> listCacheTotal;
+
+
+// ファイル一覧の永続キャッシュを保存するフォルダ
+static fs::path const& listCacheDirectory() {
+	static const auto directory = [] {
+		fs::path path;
+		if (PWSTR folder; SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr, &folder) == S_OK) {
+			path = fs::path{ folder } / L"FFFTP" / L"ListCache";
+			CoTaskMemFree(folder);
+		}
+		return path;
+	}();
+	return directory;
+}
+
+
+// キャッシュのファイル名に使うハッシュ値 (FNV-1a)
+static auto CacheHash(std::wstring_view str) {
+	auto hash = 14695981039346656037ull;
+	for (auto ch : str) {
+		hash = (hash ^ (ch & 0xFF)) * 1099511628211ull;
+		hash = (hash ^ (ch >> 8)) * 1099511628211ull;
+	}
+	return hash;
+}
+
+
+// 接続中のホスト・ポート・ユーザーごとのキャッシュフォルダ
+static fs::path HostCacheDirectory() {
+	if (empty(listCacheDirectory()))
+		return {};
+	auto key = std::wstring{ AskHostAdrs() } + L'\n' + std::to_wstring(AskHostPort()) + L'\n' + std::wstring{ AskHostUserName() };
+	wchar_t name[17];
+	swprintf(name, std::size(name), L"%016llx", CacheHash(key));
+	return listCacheDirectory() / name;
+}
+
+
+// キャッシュのキーとするパス（末尾の'/'を取り除く）
+static std::wstring NormalizeCachePath(std::wstring path) {
+	while (1 < size(path) && path.back() == L'/')
+		path.pop_back();
+	return path;
+}
+
+
+static fs::path ListCacheFileName(fs::path const& host, std::wstring_view path) {
+	wchar_t name[24];
+	swprintf(name, std::size(name), L"%016llx.lst", CacheHash(path));
+	return host / name;
+}
+
+
+// キャッシュファイルの先頭行に保存したパスを読み込む
+static std::optional<std::wstring> ReadCachedPath(std::ifstream& is) {
+	if (std::string line; std::getline(is, line))
+		return u8(line);
+	return {};
+}
+
+
+// ホストのキャッシュの索引
+static std::map<std::wstring, uintmax_t>& HostCacheIndex(fs::path const& host) {
+	auto [it, inserted] = listCacheIndex.try_emplace(host);
+	if (inserted) {
+		std::error_code ec;
+		for (auto const& entry : fs::directory_iterator{ host, ec }) {
+			std::ifstream is{ entry.path(), std::ios::binary };
+			if (auto cached = ReadCachedPath(is))
+				it->second[*cached] = entry.file_size(ec);
+		}
+	}
+	return it->second;
+}
+
+
+// キャッシュの合計サイズを数え直す
+static uintmax_t CountListCache(std::vector<std::tuple<fs::file_time_type, uintmax_t, fs::path>>* files = nullptr) {
+	uintmax_t total = 0;
+	std::error_code ec;
+	for (auto const& entry : fs::recursive_directory_iterator{ listCacheDirectory(), ec })
+		if (entry.is_regular_file(ec)) {
+			auto const bytes = entry.file_size(ec);
+			total += bytes;
+			if (files)
+				files->emplace_back(entry.last_write_time(ec), bytes, entry.path());
+		}
+	return total;
+}
+
+
+// 合計サイズが上限を超えたら最後に使用した日時の古いものから上限の3/4まで削除する
+//   上限付近で保存するたびに数え直さないよう、余裕を持たせて削除する
+static void TrimListCache() {
+	if (*listCacheTotal <= LIST_CACHE_SIZE)
+		return;
+	std::vector<std::tuple<fs::file_time_type, uintmax_t, fs::path>> files;
+	auto total = CountListCache(&files);
+	std::sort(begin(files), end(files));
+	std::error_code ec;
+	for (auto const& [time, bytes, path] : files) {
+		if (total <= LIST_CACHE_SIZE / 4 * 3)
+			break;
+		if (fs::remove(path, ec)) {
+			total -= bytes;
+			// 削除したファイルのホストの索引は次に使用するときに作り直す
+			listCacheIndex.erase(path.parent_path());
+		}
+	}
+	listCacheTotal = total;
+}
+
+
+// 索引の項目とそのキャッシュファイルを削除する
+static auto RemoveListCache(fs::path const& host, std::map<std::wstring, uintmax_t>& index, std::map<std::wstring, uintmax_t>::iterator it) {
+	std::error_code ec;
+	fs::remove(ListCacheFileName(host, it->first), ec);
+	if (listCacheTotal)
+		*listCacheTotal -= std::min(*listCacheTotal, it->second);
+	return index.erase(it);
+}
+
+
+// 永続キャッシュからファイル一覧を読み込む
+//   一覧と一緒に保存したディレクトリの日時（不明な場合は0）を返す
+bool LoadListCache(std::wstring const& path, std::string& listing, FILETIME& time) {
+	if (ListCache == NO)
+		return false;
+	std::lock_guard lock{ listCacheMutex };
+	auto const host = HostCacheDirectory();
+	if (empty(host))
+		return false;
+	auto const key = NormalizeCachePath(path);
+	auto const filename = ListCacheFileName(host, key);
+	{
+		std::ifstream is{ filename, std::ios::binary };
+		ULONGLONG value;
+		if (auto cached = ReadCachedPath(is); !cached || *cached != key || !(is >> value) || is.get() != '\n')
+			return false;
+		listing.assign(std::istreambuf_iterator<char>{ is }, {});
+		time.dwLowDateTime = static_cast<DWORD>(value);
+		time.dwHighDateTime = static_cast<DWORD>(value >> 32);
+	}
+	// 最近使用したものとして更新日時を変更する
+	std::error_code ec;
+	fs::last_write_time(filename, fs::file_time_type::clock::now(), ec);
+	return true;
+}
+
+
+// 永続キャッシュにファイル一覧を保存する
+void SaveListCache(std::wstring const& path, std::string_view listing, FILETIME const& time) {
+	if (ListCache == NO)
+		return;
+	std::lock_guard lock{ listCacheMutex };
+	auto const host = HostCacheDirectory();
+	if (empty(host) || LIST_CACHE_SIZE < size(listing))
+		return;
+	std::error_code ec;
+	fs::create_directories(host, ec);
+	auto& index = HostCacheIndex(host);
+	if (!listCacheTotal)
+		listCacheTotal = CountListCache();
+	auto const key = NormalizeCachePath(path);
+	uintmax_t bytes;
+	if (std::ofstream os{ ListCacheFileName(host, key), std::ios::binary }) {
+		os << u8(key) << '\n' << (static_cast<ULONGLONG>(time.dwHighDateTime) << 32 | time.dwLowDateTime) << '\n';
+		os.write(data(listing), size(listing));
+		bytes = static_cast<uintmax_t>(os.tellp());
+	} else
+		return;
+	auto& cached = index[key];
+	*listCacheTotal = *listCacheTotal - std::min(*listCacheTotal, cached) + bytes;
+	cached = bytes;
+	TrimListCache();
+}
+
+
+// ホスト上のパスを変更したので、そのパスと親ディレクトリ、配下のディレクトリのキャッシュを破棄する
+//   絶対パスでない場合は対象を特定できないため、接続中のホストのキャッシュをすべて破棄する
+//   索引から対象を探すため、キャッシュファイルは読まない
+void InvalidateListCache(std::vector<std::string> const& paths) {
+	std::lock_guard lock{ listCacheMutex };
+	auto const host = HostCacheDirectory();
+	if (empty(host) || empty(paths))
+		return;
+	auto& index = HostCacheIndex(host);
+	for (auto const& path : paths) {
+		auto const target = NormalizeCachePath(u8(path));
+		if (!target.starts_with(L'/')) {
+			std::error_code ec;
+			fs::remove_all(host, ec);
+			listCacheIndex.erase(host);
+			listCacheTotal.reset();
+			return;
+		}
+		auto const pos = target.rfind(L'/');
+		if (auto it = index.find(pos == 0 ? L"/"s : target.substr(0, pos)); it != end(index))
+			RemoveListCache(host, index, it);
+		if (auto it = index.find(target); it != end(index))
+			RemoveListCache(host, index, it);
+		// 配下のパスは索引の中で連続している
+		auto const prefix = target == L"/"sv ? target : target + L'/';
+		for (auto it = index.lower_bound(prefix); it != end(index) && it->first.starts_with(prefix);)
+			it = RemoveListCache(host, index, it);
+	}
+}
+
+void InvalidateListCache(std::string_view path) {
+	InvalidateListCache(std::vector<std::string>{ std::string{ path } });
+}
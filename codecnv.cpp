@@ -2,21 +2,13 @@
 #include "common.h"
 
 
-// 改行コードをCRLFに変換
-std::string ToCRLF(std::string_view source) {
-	static boost::regex re{ R"(\r\n|[\r\n])" };
-	std::string result;
-	boost::regex_replace(back_inserter(result), begin(source), end(source), re, "\r\n");
-	return result;
-}
-
-
 static auto convert(std::string_view input, DWORD incp, DWORD outcp, void (*update)(std::wstring&)) {
 	static auto mlang = LoadLibraryW(L"mlang.dll");
 	static auto convertINetMultiByteToUnicode = reinterpret_cast<decltype(&ConvertINetMultiByteToUnicode)>(GetProcAddress(mlang, "ConvertINetMultiByteToUnicode"));
 	static auto convertINetUnicodeToMultiByte = reinterpret_cast<decltype(&ConvertINetUnicodeToMultiByte)>(GetProcAddress(mlang, "ConvertINetUnicodeToMultiByte"));
-	static DWORD mb2u = 0, u2mb = 0;
-	static INT scale = 2;
+	// 変換の状態は呼び出しごとに持つ　ファイル一覧の解析では複数のスレッドから同時に呼ばれる
+	DWORD mb2u = 0, u2mb = 0;
+	INT scale = 2;
 	std::wstring wstr;
 	for (;; ++scale) {
 		auto inlen = size_as<INT>(input), wlen = inlen * scale;
@@ -38,16 +30,185 @@ static auto convert(std::string_view input, DWORD incp, DWORD outcp, void (*upda
 }
 
 
+// JISのエスケープシーケンスも8bitの文字も含まない
+static bool IsPlainAscii(std::string_view str) {
+	auto p = data(str), end = data(str) + size(str);
+	for (auto const esc = _mm_set1_epi8('\x1B'); p + 16 <= end; p += 16)
+		if (auto const v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); _mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, esc))) != 0)
+			return false;
+	for (; p != end; ++p)
+		if (*p & 0x80 || *p == '\x1B')
+			return false;
+	return true;
+}
+
+// \x1B(\$[B@]|\([BHIJ]|\$\([DOPQ])
+static bool IsJisEscape(std::string_view str) {
+	auto in = [str](size_t pos, std::string_view set) { return pos < size(str) && set.find(str[pos]) != std::string_view::npos; };
+	if (str.starts_with("\x1B$("sv))
+		return in(3, "DOPQ"sv);
+	if (str.starts_with("\x1B$"sv))
+		return in(2, "B@"sv);
+	if (str.starts_with("\x1B("sv))
+		return in(2, "BHIJ"sv);
+	return false;
+}
+
+// Shift-JIS
+// JIS X 0208  1～8、16～47、48～84  81-84,88-9F,E0-EA
+// NEC特殊文字                       87
+// NEC選定IBM拡張文字                ED-EE
+// IBM拡張文字                       FA-FC
+enum : unsigned char { SJIS_SINGLE = 1, SJIS_LEAD = 2, SJIS_RARE = 4, SJIS_TRAIL = 8 };
+static constexpr auto sjisClass = [] {
+	std::array<unsigned char, 256> table{};
+	for (int ch = 0; ch < 256; ch++) {
+		if (ch <= 0x7F || 0xA1 <= ch && ch <= 0xDF)
+			table[ch] |= SJIS_SINGLE;
+		else if (0x81 <= ch && ch <= 0x84 || 0x87 <= ch && ch <= 0x9F || 0xE0 <= ch && ch <= 0xEA || ch == 0xED || ch == 0xEE || 0xFA <= ch && ch <= 0xFC)
+			table[ch] |= SJIS_LEAD;
+		else if (ch == 0x85 || ch == 0x86 || ch == 0xEB || ch == 0xEC || 0xEF <= ch && ch <= 0xF9)
+			table[ch] |= SJIS_LEAD | SJIS_RARE;
+		if (0x40 <= ch && ch <= 0x7E || 0x80 <= ch && ch <= 0xFC)
+			table[ch] |= SJIS_TRAIL;
+	}
+	return table;
+}();
+
+// EUC-JP
+enum : unsigned char { EUC_SINGLE = 1, EUC_KANA = 2, EUC_SS3 = 4, EUC_LEAD = 8, EUC_RARE = 16, EUC_TRAIL = 32, EUC_KANATRAIL = 64 };
+static constexpr auto eucClass = [] {
+	std::array<unsigned char, 256> table{};
+	for (int ch = 0; ch < 256; ch++) {
+		if (ch <= 0x7F)
+			table[ch] |= EUC_SINGLE;
+		else if (ch == 0x8E)
+			table[ch] |= EUC_KANA;
+		else if (ch == 0x8F)
+			table[ch] |= EUC_SS3;
+		else if (0xA1 <= ch && ch <= 0xA8 || 0xB0 <= ch && ch <= 0xF4)
+			table[ch] |= EUC_LEAD;
+		else if (0xA9 <= ch && ch <= 0xAF || 0xF5 <= ch && ch <= 0xFE)
+			table[ch] |= EUC_LEAD | EUC_RARE;
+		if (0xA1 <= ch && ch <= 0xFE)
+			table[ch] |= EUC_TRAIL;
+		if (0xA1 <= ch && ch <= 0xDF)
+			table[ch] |= EUC_KANATRAIL;
+	}
+	return table;
+}();
+
+// HFS+はNFD正規化を行う。そのためNFCの文字は出現しない。このことを利用して、NFC文字を検出したら非HFS+、NFD文字を検出したらHFS+、どちらでもなければ不明として非HFS+と判定する。
+// これらの表はutil/hfs+.cppで生成した。 Unicode 12.0
+static constexpr std::pair<char32_t, char32_t> nfcTable[] = {
+	{ 0x00C0, 0x00C5 }, { 0x00C7, 0x00CF }, { 0x00D1, 0x00D6 }, { 0x00D9, 0x00DD }, { 0x00E0, 0x00E5 }, { 0x00E7, 0x00EF },
+	{ 0x00F1, 0x00F6 }, { 0x00F9, 0x00FD }, { 0x00FF, 0x010F }, { 0x0112, 0x0125 }, { 0x0128, 0x0130 }, { 0x0134, 0x0137 },
+	{ 0x0139, 0x013E }, { 0x0143, 0x0148 }, { 0x014C, 0x0151 }, { 0x0154, 0x0165 }, { 0x0168, 0x017E }, { 0x01A0, 0x01A1 },
+	{ 0x01AF, 0x01B0 }, { 0x01CD, 0x01DC }, { 0x01DE, 0x01E3 }, { 0x01E6, 0x01F0 }, { 0x01F4, 0x01F5 }, { 0x01F8, 0x021B },
+	{ 0x021E, 0x021F }, { 0x0226, 0x0233 }, { 0x0340, 0x0341 }, { 0x0343, 0x0344 }, { 0x0374, 0x0374 }, { 0x037E, 0x037E },
+	{ 0x0385, 0x038A }, { 0x038C, 0x038C }, { 0x038E, 0x0390 }, { 0x03AA, 0x03B0 }, { 0x03CA, 0x03CE }, { 0x03D3, 0x03D4 },
+	{ 0x0400, 0x0401 }, { 0x0403, 0x0403 }, { 0x0407, 0x0407 }, { 0x040C, 0x040E }, { 0x0419, 0x0419 }, { 0x0439, 0x0439 },
+	{ 0x0450, 0x0451 }, { 0x0453, 0x0453 }, { 0x0457, 0x0457 }, { 0x045C, 0x045E }, { 0x0476, 0x0477 }, { 0x04C1, 0x04C2 },
+	{ 0x04D0, 0x04D3 }, { 0x04D6, 0x04D7 }, { 0x04DA, 0x04DF }, { 0x04E2, 0x04E7 }, { 0x04EA, 0x04F5 }, { 0x04F8, 0x04F9 },
+	{ 0x0622, 0x0626 }, { 0x06C0, 0x06C0 }, { 0x06C2, 0x06C2 }, { 0x06D3, 0x06D3 }, { 0x0929, 0x0929 }, { 0x0931, 0x0931 },
+	{ 0x0934, 0x0934 }, { 0x0958, 0x095F }, { 0x09CB, 0x09CC }, { 0x09DC, 0x09DD }, { 0x09DF, 0x09DF }, { 0x0A33, 0x0A33 },
+	{ 0x0A36, 0x0A36 }, { 0x0A59, 0x0A5B }, { 0x0A5E, 0x0A5E }, { 0x0B48, 0x0B48 }, { 0x0B4B, 0x0B4C }, { 0x0B5C, 0x0B5D },
+	{ 0x0B94, 0x0B94 }, { 0x0BCA, 0x0BCC }, { 0x0C48, 0x0C48 }, { 0x0CC0, 0x0CC0 }, { 0x0CC7, 0x0CC8 }, { 0x0CCA, 0x0CCB },
+	{ 0x0D4A, 0x0D4C }, { 0x0DDA, 0x0DDA }, { 0x0DDC, 0x0DDE }, { 0x0F43, 0x0F43 }, { 0x0F4D, 0x0F4D }, { 0x0F52, 0x0F52 },
+	{ 0x0F57, 0x0F57 }, { 0x0F5C, 0x0F5C }, { 0x0F69, 0x0F69 }, { 0x0F73, 0x0F73 }, { 0x0F75, 0x0F76 }, { 0x0F78, 0x0F78 },
+	{ 0x0F81, 0x0F81 }, { 0x0F93, 0x0F93 }, { 0x0F9D, 0x0F9D }, { 0x0FA2, 0x0FA2 }, { 0x0FA7, 0x0FA7 }, { 0x0FAC, 0x0FAC },
+	{ 0x0FB9, 0x0FB9 }, { 0x1026, 0x1026 }, { 0x1B06, 0x1B06 }, { 0x1B08, 0x1B08 }, { 0x1B0A, 0x1B0A }, { 0x1B0C, 0x1B0C },
+	{ 0x1B0E, 0x1B0E }, { 0x1B12, 0x1B12 }, { 0x1B3B, 0x1B3B }, { 0x1B3D, 0x1B3D }, { 0x1B40, 0x1B41 }, { 0x1B43, 0x1B43 },
+	{ 0x1E00, 0x1E99 }, { 0x1E9B, 0x1E9B }, { 0x1EA0, 0x1EF9 }, { 0x1F00, 0x1F15 }, { 0x1F18, 0x1F1D }, { 0x1F20, 0x1F45 },
+	{ 0x1F48, 0x1F4D }, { 0x1F50, 0x1F57 }, { 0x1F59, 0x1F59 }, { 0x1F5B, 0x1F5B }, { 0x1F5D, 0x1F5D }, { 0x1F5F, 0x1F7D },
+	{ 0x1F80, 0x1FB4 }, { 0x1FB6, 0x1FBC }, { 0x1FBE, 0x1FBE }, { 0x1FC1, 0x1FC4 }, { 0x1FC6, 0x1FD3 }, { 0x1FD6, 0x1FDB },
+	{ 0x1FDD, 0x1FEF }, { 0x1FF2, 0x1FF4 }, { 0x1FF6, 0x1FFD }, { 0x304C, 0x304C }, { 0x304E, 0x304E }, { 0x3050, 0x3050 },
+	{ 0x3052, 0x3052 }, { 0x3054, 0x3054 }, { 0x3056, 0x3056 }, { 0x3058, 0x3058 }, { 0x305A, 0x305A }, { 0x305C, 0x305C },
+	{ 0x305E, 0x305E }, { 0x3060, 0x3060 }, { 0x3062, 0x3062 }, { 0x3065, 0x3065 }, { 0x3067, 0x3067 }, { 0x3069, 0x3069 },
+	{ 0x3070, 0x3071 }, { 0x3073, 0x3074 }, { 0x3076, 0x3077 }, { 0x3079, 0x307A }, { 0x307C, 0x307D }, { 0x3094, 0x3094 },
+	{ 0x309E, 0x309E }, { 0x30AC, 0x30AC }, { 0x30AE, 0x30AE }, { 0x30B0, 0x30B0 }, { 0x30B2, 0x30B2 }, { 0x30B4, 0x30B4 },
+	{ 0x30B6, 0x30B6 }, { 0x30B8, 0x30B8 }, { 0x30BA, 0x30BA }, { 0x30BC, 0x30BC }, { 0x30BE, 0x30BE }, { 0x30C0, 0x30C0 },
+	{ 0x30C2, 0x30C2 }, { 0x30C5, 0x30C5 }, { 0x30C7, 0x30C7 }, { 0x30C9, 0x30C9 }, { 0x30D0, 0x30D1 }, { 0x30D3, 0x30D4 },
+	{ 0x30D6, 0x30D7 }, { 0x30D9, 0x30DA }, { 0x30DC, 0x30DD }, { 0x30F4, 0x30F4 }, { 0x30F7, 0x30FA }, { 0x30FE, 0x30FE },
+	{ 0xFB1D, 0xFB1D }, { 0xFB1F, 0xFB1F }, { 0xFB2A, 0xFB36 }, { 0xFB38, 0xFB3C }, { 0xFB3E, 0xFB3E }, { 0xFB40, 0xFB41 },
+	{ 0xFB43, 0xFB44 }, { 0xFB46, 0xFB4E }, { 0x1109A, 0x1109A }, { 0x1109C, 0x1109C }, { 0x110AB, 0x110AB }, { 0x1112E, 0x1112F },
+	{ 0x1134B, 0x1134C }, { 0x114BB, 0x114BC }, { 0x114BE, 0x114BE }, { 0x115BA, 0x115BB }, { 0x1D15E, 0x1D164 }, { 0x1D1BB, 0x1D1C0 },
+};
+static constexpr std::pair<char32_t, char32_t> nfdTable[] = {
+	{ 0x0300, 0x0304 }, { 0x0306, 0x030C }, { 0x030F, 0x030F }, { 0x0311, 0x0311 }, { 0x0313, 0x0314 }, { 0x031B, 0x031B },
+	{ 0x0323, 0x0328 }, { 0x032D, 0x032E }, { 0x0330, 0x0331 }, { 0x0342, 0x0342 }, { 0x0345, 0x0345 }, { 0x05B4, 0x05B4 },
+	{ 0x05B7, 0x05B9 }, { 0x05BC, 0x05BC }, { 0x05BF, 0x05BF }, { 0x05C1, 0x05C2 }, { 0x0653, 0x0655 }, { 0x093C, 0x093C },
+	{ 0x09BC, 0x09BC }, { 0x09BE, 0x09BE }, { 0x09D7, 0x09D7 }, { 0x0A3C, 0x0A3C }, { 0x0B3C, 0x0B3C }, { 0x0B3E, 0x0B3E },
+	{ 0x0B56, 0x0B57 }, { 0x0BBE, 0x0BBE }, { 0x0BD7, 0x0BD7 }, { 0x0C56, 0x0C56 }, { 0x0CC2, 0x0CC2 }, { 0x0CD5, 0x0CD6 },
+	{ 0x0D3E, 0x0D3E }, { 0x0D57, 0x0D57 }, { 0x0DCA, 0x0DCA }, { 0x0DCF, 0x0DCF }, { 0x0DDF, 0x0DDF }, { 0x0F72, 0x0F72 },
+	{ 0x0F74, 0x0F74 }, { 0x0F80, 0x0F80 }, { 0x0FB5, 0x0FB5 }, { 0x0FB7, 0x0FB7 }, { 0x102E, 0x102E }, { 0x1B35, 0x1B35 },
+	{ 0x3099, 0x309A }, { 0x110BA, 0x110BA }, { 0x11127, 0x11127 }, { 0x1133E, 0x1133E }, { 0x11357, 0x11357 }, { 0x114B0, 0x114B0 },
+	{ 0x114BA, 0x114BA }, { 0x114BD, 0x114BD }, { 0x115AF, 0x115AF }, { 0x1D165, 0x1D165 }, { 0x1D16E, 0x1D172 },
+};
+
+static bool Contains(std::span<const std::pair<char32_t, char32_t>> table, char32_t code) {
+	auto it = std::upper_bound(begin(table), end(table), code, [](char32_t value, auto const& range) { return value < range.first; });
+	return it != begin(table) && code <= std::prev(it)->second;
+}
+
+// Shift-JIS、EUC-JP、UTF-8として正しいかを１回の走査で判定する
+//   それぞれの状態機械は以前の正規表現と同じ文字列を受理し、珍しい文字を含むかどうかも同じく判定する
 void CodeDetector::Test(std::string_view str) {
-	static boost::regex reJISor8BIT{ R"(\x1B(\$[B@]|\([BHIJ]|\$\([DOPQ])|[\x80-\xFF])" },
-		// Shift-JIS
-		// JIS X 0208  1～8、16～47、48～84  81-84,88-9F,E0-EA
-		// NEC特殊文字                       87
-		// NEC選定IBM拡張文字                ED-EE
-		// IBM拡張文字                       FA-FC
-		reSJIS{ R"((?:[\x00-\x7F\xA1-\xDF]|(?:[\x81-\x84\x87-\x9F\xE0-\xEA\xED\xEE\xFA-\xFC]|([\x85\x86\xEB\xEC\xEF-\xF9]))[\x40-\x7E\x80-\xFC])*)" },
-		reEUC{ R"((?:[\x00-\x7F]|\x8E[\xA1-\xDF]|(?:[\xA1-\xA8\xB0-\xF4]|([\xA9-\xAF\xF5-\xFE]|\x8F[\xA1-\xFE]))[\xA1-\xFE])*)" },
-		// UTF-8
+	if (IsPlainAscii(str))
+		return;
+	// 0=文字の先頭、1以上=後続バイト待ち、-1=不正
+	int sjisState = 0, eucState = 0, utf8State = 0;
+	bool sjisRare = false, eucRare = false, utf8Rare = false;
+	bool high = false, hasNfc = false, hasNfd = false;
+	char32_t code = 0;
+	// UTF-8の後続バイト待ちの状態
+	enum { U8_CONT1 = 1, U8_CONT2, U8_E0, U8_ED, U8_EF, U8_F0, U8_F1F2, U8_F3, U8_F4 };
+	for (size_t i = 0; i < size(str); i++) {
+		auto const ch = static_cast<unsigned char>(str[i]);
+		if (!high) {
+			// 8bitの文字より先にJISのエスケープシーケンスが出現した
+			if (ch == 0x1B && IsJisEscape(str.substr(i))) {
+				jis += 2;
+				return;
+			}
+			high = 0x80 <= ch;
+		}
+
+		if (sjisState == 0) {
+			if (auto const c = sjisClass[ch]; c & SJIS_LEAD) {
+				sjisState = 1;
+				sjisRare |= (c & SJIS_RARE) != 0;
+			} else if ((c & SJIS_SINGLE) == 0)
+				sjisState = -1;
+		} else if (sjisState == 1)
+			sjisState = sjisClass[ch] & SJIS_TRAIL ? 0 : -1;
+
+		switch (auto const c = eucClass[ch]; eucState) {
+		case 0:
+			if (c & EUC_SINGLE)
+				break;
+			else if (c & EUC_KANA)
+				eucState = 3;
+			else if (c & EUC_SS3) {
+				eucState = 2;
+				eucRare = true;
+			} else if (c & EUC_LEAD) {
+				eucState = 1;
+				eucRare |= (c & EUC_RARE) != 0;
+			} else
+				eucState = -1;
+			break;
+		case 1:
+			eucState = c & EUC_TRAIL ? 0 : -1;
+			break;
+		case 2:
+			eucState = c & EUC_TRAIL ? 1 : -1;
+			break;
+		case 3:
+			eucState = c & EUC_KANATRAIL ? 0 : -1;
+			break;
+		}
+
 		// U+000000-U+00007F                   0b0000000-                 0b1111111  00-7F
 		// U+000080-U+0007FF              0b00010'000000-            0b11111'111111  C2-DF             80-BF
 		// U+000800-U+000FFF        0b0000'100000'000000-      0b0000'111111'111111  E0    A0-BF       80-BF
@@ -62,28 +223,90 @@ void CodeDetector::Test(std::string_view str) {
 		// U+0C0000-U+0EFFFF  0b011'000000'000000'000000-0b011'101111'111111'111111  F3    80-AF 80-BF 80-BF
 		// U+0F0000-U+0FFFFF  0b011'110000'000000'000000-0b011'111111'111111'111111  F3    B0-BF 80-BF 80-BF (Supplementary Private Use Area-A)
 		// U+100000-U+10FFFF  0b100'000000'000000'000000-0b100'001111'111111'111111  F4    80-8F 80-BF 80-BF (Supplementary Private Use Area-B)
-		reUTF8{ R"((?:[\x00-\x7F]|(?:[\xC2-\xDF]|\xE0[\xA0-\xBF]|\xED[\x80-\x9F]|\xEF[\xA4-\xBF]|(\xED[\xA0-\xBF]|\xEF[\x80-\xA3])|(?:[\xE1-\xEC]|\xF0[\x90-\xBF]|[\xF1\xF2][\x80-\xBF]|\xF3[\x80-\xAF]|(\xEE|\xF3[\xB0-\xBF]|\xF4[\x80-\x8F]))[\x80-\xBF])[\x80-\xBF])*)" },
-		// HFS+はNFD正規化を行う。そのためNFCの文字は出現しない。このことを利用して、NFC文字を検出したら非HFS+、NFD文字を検出したらHFS+、どちらでもなければ不明として非HFS+と判定する。
-		// これらの正規表現はutil/hfs+.cppで生成した。 Unicode 12.0
-		reNFC{ R"(\xc3[\x80-\x85\x87-\x8f\x91-\x96\x99-\x9d\xa0-\xa5\xa7-\xaf\xb1-\xb6\xb9-\xbd\xbf]|\xc4[\x80-\x8f\x92-\xa5\xa8-\xb0\xb4-\xb7\xb9-\xbe]|\xc5[\x83-\x88\x8c-\x91\x94-\xa5\xa8-\xbe]|\xc6[\xa0\xa1\xaf\xb0]|\xc7[\x8d-\x9c\x9e-\xa3\xa6-\xb0\xb4\xb5\xb8-\xbf]|\xc8[\x80-\x9b\x9e\x9f\xa6-\xb3]|\xcd[\x80\x81\x83\x84\xb4\xbe]|\xce[\x85-\x8a\x8c\x8e-\x90\xaa-\xb0]|\xcf[\x8a-\x8e\x93\x94]|\xd0[\x80\x81\x83\x87\x8c-\x8e\x99\xb9]|\xd1[\x90\x91\x93\x97\x9c-\x9e\xb6\xb7]|\xd3[\x81\x82\x90-\x93\x96\x97\x9a-\x9f\xa2-\xa7\xaa-\xb5\xb8\xb9]|\xd8[\xa2-\xa6]|\xdb[\x80\x82\x93]|\xe0(?:\xa4[\xa9\xb1\xb4]|\xa5[\x98-\x9f]|\xa7[\x8b\x8c\x9c\x9d\x9f]|\xa8[\xb3\xb6]|\xa9[\x99-\x9b\x9e]|\xad[\x88\x8b\x8c\x9c\x9d]|\xae\x94|[\xaf\xb5][\x8a-\x8c]|\xb1\x88|\xb3[\x80\x87\x88\x8a\x8b]|\xb7[\x9a\x9c-\x9e]|\xbd[\x83\x8d\x92\x97\x9c\xa9\xb3\xb5\xb6\xb8]|\xbe[\x81\x93\x9d\xa2\xa7\xac\xb9])|\xe1(?:\x80\xa6|\xac[\x86\x88\x8a\x8c\x8e\x92\xbb\xbd]|\xad[\x80\x81\x83]|[\xb8\xb9][\x80-\xbf]|\xba[\x80-\x99\x9b\xa0-\xbf]|\xbb[\x80-\xb9]|\xbc[\x80-\x95\x98-\x9d\xa0-\xbf]|\xbd[\x80-\x85\x88-\x8d\x90-\x97\x99\x9b\x9d\x9f-\xbd]|\xbe[\x80-\xb4\xb6-\xbc\xbe]|\xbf[\x81-\x84\x86-\x93\x96-\x9b\x9d-\xaf\xb2-\xb4\xb6-\xbd])|\xe3(?:\x81[\x8c\x8e\x90\x92\x94\x96\x98\x9a\x9c\x9e\xa0\xa2\xa5\xa7\xa9\xb0\xb1\xb3\xb4\xb6\xb7\xb9\xba\xbc\xbd]|\x82[\x94\x9e\xac\xae\xb0\xb2\xb4\xb6\xb8\xba\xbc\xbe]|\x83[\x80\x82\x85\x87\x89\x90\x91\x93\x94\x96\x97\x99\x9a\x9c\x9d\xb4\xb7-\xba\xbe])|\xef(?:\xac[\x9d\x9f\xaa-\xb6\xb8-\xbc\xbe]|\xad[\x80\x81\x83\x84\x86-\x8e])|\xf0(?:\x91(?:\x82[\x9a\x9c\xab]|\x84[\xae\xaf]|\x8d[\x8b\x8c]|\x92[\xbb\xbc\xbe]|\x96[\xba\xbb])|\x9d(?:\x85[\x9e-\xa4]|\x86[\xbb-\xbf]|\x87\x80)))" },
-		reNFD{ R"(\xcc[\x80-\x84\x86-\x8c\x8f\x91\x93\x94\x9b\xa3-\xa8\xad\xae\xb0\xb1]|\xcd[\x82\x85]|\xd6[\xb4\xb7-\xb9\xbc\xbf]|\xd7[\x81\x82]|\xd9[\x93-\x95]|\xe0(?:[\xa4\xa8]\xbc|[\xa6\xac][\xbc\xbe]|[\xa7\xaf\xb5]\x97|\xad[\x96\x97]|[\xae\xb4]\xbe|\xb1\x96|\xb3[\x82\x95\x96]|\xb7[\x8a\x8f\x9f]|\xbd[\xb2\xb4]|\xbe[\x80\xb5\xb7])|\xe1(?:\x80\xae|\xac\xb5)|\xe3\x82[\x99\x9a]|\xf0(?:\x91(?:\x82\xba|\x84\xa7|\x8c\xbe|\x8d\x97|\x92[\xb0\xba\xbd]|\x96\xaf)|\x9d\x85[\xa5\xae-\xb2]))" };
-	if (boost::match_results<std::string_view::const_iterator> m; boost::regex_search(begin(str), end(str), m, reJISor8BIT)) {
-		if (m[1].matched)
-			jis += 2;
-		else {
-			if (boost::match_results<std::string_view::const_iterator> m; boost::regex_match(begin(str), end(str), m, reSJIS))
-				sjis += m[1].matched ? 1 : 2;
-			if (boost::match_results<std::string_view::const_iterator> m; boost::regex_match(begin(str), end(str), m, reEUC))
-				euc += m[1].matched ? 1 : 2;
-			if (boost::match_results<std::string_view::const_iterator> m; boost::regex_match(begin(str), end(str), m, reUTF8)) {
-				utf8 += m[1].matched || m[2].matched ? 1 : 2;
-				if (!nfc && !nfd) {
-					if (boost::regex_search(begin(str), end(str), reNFC))
-						nfc = true;
-					else if (boost::regex_search(begin(str), end(str), reNFD))
-						nfd = true;
-				}
+		if (0 <= utf8State) {
+			auto const lead = utf8State == 0, cont = 0x80 <= ch && ch <= 0xBF;
+			switch (utf8State) {
+			case 0:
+				if (ch <= 0x7F)
+					break;
+				else if (0xC2 <= ch && ch <= 0xDF)
+					utf8State = U8_CONT1;
+				else if (ch == 0xE0)
+					utf8State = U8_E0;
+				else if (0xE1 <= ch && ch <= 0xEC)
+					utf8State = U8_CONT2;
+				else if (ch == 0xED)
+					utf8State = U8_ED;
+				else if (ch == 0xEE) {
+					utf8State = U8_CONT2;
+					utf8Rare = true;
+				} else if (ch == 0xEF)
+					utf8State = U8_EF;
+				else if (ch == 0xF0)
+					utf8State = U8_F0;
+				else if (ch == 0xF1 || ch == 0xF2)
+					utf8State = U8_F1F2;
+				else if (ch == 0xF3)
+					utf8State = U8_F3;
+				else if (ch == 0xF4)
+					utf8State = U8_F4;
+				else
+					utf8State = -1;
+				break;
+			case U8_CONT1:
+			case U8_CONT2:
+				utf8State = cont ? utf8State - 1 : -1;
+				break;
+			case U8_E0:
+				utf8State = 0xA0 <= ch && ch <= 0xBF ? U8_CONT1 : -1;
+				break;
+			case U8_ED:
+				utf8Rare |= 0xA0 <= ch && ch <= 0xBF;
+				utf8State = cont ? U8_CONT1 : -1;
+				break;
+			case U8_EF:
+				utf8Rare |= 0x80 <= ch && ch <= 0xA3;
+				utf8State = cont ? U8_CONT1 : -1;
+				break;
+			case U8_F0:
+				utf8State = 0x90 <= ch && ch <= 0xBF ? U8_CONT2 : -1;
+				break;
+			case U8_F1F2:
+				utf8State = cont ? U8_CONT2 : -1;
+				break;
+			case U8_F3:
+				utf8Rare |= 0xB0 <= ch && ch <= 0xBF;
+				utf8State = cont ? U8_CONT2 : -1;
+				break;
+			case U8_F4:
+				utf8Rare = true;
+				utf8State = 0x80 <= ch && ch <= 0x8F ? U8_CONT2 : -1;
+				break;
 			}
+			// 文字の先頭から符号位置を組み立て、文字の末尾でNFC/NFDの表を引く
+			if (lead)
+				code = ch & (ch <= 0x7F ? 0x7F : ch <= 0xDF ? 0x1F : ch <= 0xEF ? 0x0F : 0x07);
+			else if (0 <= utf8State)
+				code = code << 6 | ch & 0x3F;
+			if (utf8State == 0 && !nfc && !nfd && !hasNfc && 0xC0 <= code) {
+				hasNfc = Contains(nfcTable, code);
+				hasNfd |= Contains(nfdTable, code);
+			}
+		}
+	}
+	if (!high)
+		return;
+	if (sjisState == 0)
+		sjis += sjisRare ? 1 : 2;
+	if (eucState == 0)
+		euc += eucRare ? 1 : 2;
+	if (utf8State == 0) {
+		utf8 += utf8Rare ? 1 : 2;
+		if (!nfc && !nfd) {
+			if (hasNfc)
+				nfc = true;
+			else if (hasNfd)
+				nfd = true;
 		}
 	}
 }
@@ -35,15 +35,19 @@
 #define UMDF_USING_NTSTATUS
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <bit>
 #include <charconv>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <forward_list>
 #include <fstream>
 #include <future>
 #include <iterator>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <numeric>
 #include <optional>
@@ -51,6 +55,7 @@
 #include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <type_traits>
 #include <variant>
 #include <vector>
@@ -59,6 +64,7 @@
 #include <cassert>
 #include <cwctype>
 #include <crtdbg.h>
+#include <emmintrin.h>
 #include <mbstring.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -68,6 +74,7 @@
 #include <ObjBase.h>			// for COM interface, define `interface` macro.
 #include <bcrypt.h>
 #include <windowsx.h>
+#include <winioctl.h>
 #include <winsock2.h>
 #include <CommCtrl.h>
 #include <commdlg.h>
@@ -87,6 +94,7 @@
 #include "config.h"
 #include "dialog.h"
 #include "helpid.h"
+#include "newline.h"
 #include "Resource/resource.ja-JP.h"
 #pragma comment(lib, "bcrypt.lib")
 #pragma comment(lib, "Comctl32.lib")
@@ -139,7 +147,6 @@ constexpr FileType AllFileTyes[]{ FileType::All, FileType::Executable, FileType:
 /*===== ユーザ定義コマンド =====*/
 
 #define WM_CHANGE_COND	(WM_USER+1)	/* ファイル一覧を変更するコマンド */
-#define WM_SET_PACKET	(WM_USER+2)	/* 現在使用している転送パケットのアドレスを通知 */
 
 #define WM_ASYNC_SOCKET	(WM_USER+5)
 
@@ -156,6 +163,9 @@ constexpr FileType AllFileTyes[]{ FileType::All, FileType::Executable, FileType:
 // ゾーンID設定追加
 #define WM_MARKFILEASDOWNLOADEDFROMINTERNET	(WM_USER+12)
 
+// 永続キャッシュから表示したファイル一覧を再検証する
+#define WM_REVALIDATE_REMOTE	(WM_USER+13)
+
 /*===== ホスト番号 =====*/
 /* ホスト番号は 0～ の値を取る */
 
@@ -198,6 +208,12 @@ constexpr FileType AllFileTyes[]{ FileType::All, FileType::Executable, FileType:
 // 同じ名前のファイルの処理方法追加
 #define EXIST_LARGE		6		/* 大きければ上書き */
 
+/*===== 転送の順序 =====*/
+
+#define SCHEDULE_FIFO		0		/* 転送ファイルリストの順 */
+#define SCHEDULE_LARGEST	1		/* 大きいファイルから */
+#define SCHEDULE_MIXED		2		/* 大きいファイルと小さいファイルを交互に */
+
 /*===== ファイル名の比較モード =====*/
 
 #define COMP_IGNORE		0		/* 大文字/小文字は区別しない */
@@ -344,6 +360,14 @@ constexpr FileType AllFileTyes[]{ FileType::All, FileType::Executable, FileType:
 #define HTYPE_TANDEM	8		/* HP NonStop Server */
 #endif
 
+/*===== ファイル一覧の形式 =====*/
+
+#define LIST_DIALECT_UNKNOWN	-1		/* 未判別 */
+
+/*===== コマンドのパイプライン送信 =====*/
+
+#define PIPELINE_UNKNOWN	-1		/* 未確認 */
+
 /*===== ホストのヒストリ =====*/
 
 #define	HISTORY_MAX		20		/* ファイルのヒストリの最大個数 */
@@ -510,6 +534,8 @@ struct HOSTDATA : Host {
 	int NoDisplayUI = NO;					/* UIを表示しない (YES/NO) */
 	int Feature = 0;						/* 利用可能な機能のフラグ (FEATURE_xxx) */
 	int CurNetType = NTYPE_AUTO;			/* 接続中のネットワークの種類 (NTYPE_xxx) */
+	int CurListDialect = LIST_DIALECT_UNKNOWN;	/* 判別済みのファイル一覧の形式 */
+	int CurPipeline = PIPELINE_UNKNOWN;		/* 応答を待たずにコマンドを続けて送れるかどうか (YES/NO/PIPELINE_UNKNOWN)  転送スレッドからも操作するためstd::atomic_refを通す */
 	HOSTDATA() = default;
 	HOSTDATA(struct HISTORYDATA const& history);
 };
@@ -550,6 +576,10 @@ struct TRANSPACKET {
 	int Abort;						/* 転送中止フラグ (ABORT_xxx) */
 	int NoTransfer;
 	int ThreadCount;
+	class ListParser* List = nullptr;	/* 受信しながら解析するファイル一覧 (NULL=ファイルに保存のみ) */
+	std::shared_ptr<class SegmentMap> Segment;	/* 分割ダウンロードの進捗 (nullptr=分割しない) */
+	LONGLONG SegmentStart = 0;		/* 分割ダウンロードで受信する範囲の開始位置 */
+	LONGLONG SegmentEnd = 0;		/* 分割ダウンロードで受信する範囲の終了位置 */
 };
 
 
@@ -576,6 +606,88 @@ typedef struct filelist {
 } FILELIST;
 
 
+// ファイルリスト
+//   ファイル名とオーナ名はまとめて格納し、項目ごとには固定長の情報だけを持つ
+struct filelistarena;
+struct filelistindex;
+class FileList {
+public:
+	struct Entry {
+		const char* File;		/* ファイル名 */
+		const char* Owner;		/* オーナ名 */
+		LONGLONG Size;			/* ファイルサイズ */
+		FILETIME Time;			/* 時間(UTC) */
+		int Attr;				/* 属性 */
+		char Node;				/* 種類 (NODE_xxx) */
+		char Link;				/* リンクファイルかどうか (YES/NO) */
+		char InfoExist;			/* ファイル一覧に存在した情報のフラグ (FINFO_xxx) */
+	};
+private:
+	std::shared_ptr<filelistarena> arena;	/* ファイル名とオーナ名の格納領域 (コピーしたリストと共有) */
+	std::vector<Entry> entries;
+	std::shared_ptr<filelistindex> index;			/* ファイル名の索引 (コピーしたリストとは共有しない) */
+public:
+	FileList();
+	FileList(FileList const& other);
+	FileList(FileList&&) = default;
+	FileList& operator=(FileList const& other);
+	FileList& operator=(FileList&&) = default;
+	void push_back(FILELIST const& file);
+	bool contains(std::string_view file) const;
+	const Entry* find(std::string_view file, int Caps) const;
+	void clear();
+	auto begin() { return entries.begin(); }
+	auto begin() const { return entries.begin(); }
+	auto end() { return entries.end(); }
+	auto end() const { return entries.end(); }
+	auto rbegin() { return entries.rbegin(); }
+	auto rbegin() const { return entries.rbegin(); }
+	auto rend() { return entries.rend(); }
+	auto rend() const { return entries.rend(); }
+	bool empty() const { return entries.empty(); }
+	size_t size() const { return entries.size(); }
+	Entry& operator[](size_t i) { return entries[i]; }
+	Entry const& operator[](size_t i) const { return entries[i]; }
+	friend auto begin(FileList& list) { return list.begin(); }
+	friend auto begin(FileList const& list) { return list.begin(); }
+	friend auto end(FileList& list) { return list.end(); }
+	friend auto end(FileList const& list) { return list.end(); }
+	friend auto rbegin(FileList& list) { return list.rbegin(); }
+	friend auto rbegin(FileList const& list) { return list.rbegin(); }
+	friend auto rend(FileList& list) { return list.rend(); }
+	friend auto rend(FileList const& list) { return list.rend(); }
+	friend bool empty(FileList const& list) { return list.empty(); }
+	friend size_t size(FileList const& list) { return list.size(); }
+};
+
+
+// ファイル一覧を受信しながら１行ずつ解析する
+//   形式の判別後は一定の行数ごとにまとめて並列に解析する
+class ListParser {
+	struct Chunk {
+		std::vector<std::variant<FILELIST, std::string>> lines;	/* 解析済みの行 */
+		std::vector<size_t> deferred;							/* 順番に解析し直す行 */
+	};
+	std::string rest;										/* 改行が届いていない行 */
+	std::vector<std::variant<FILELIST, std::string>> lines;	/* 解析済みの行 */
+	int dialect;											/* ファイル一覧の形式 */
+	bool detected = false;									/* 形式を判別済み */
+	int samples = 0;										/* 形式の判別に使用した行数 */
+	std::vector<int> votes;									/* 形式ごとの一致した行数 */
+	bool parallel;											/* 並列に解析できる */
+	std::vector<std::string> pending;						/* 並列に解析する前の行 */
+	std::deque<std::future<Chunk>> chunks;					/* 並列に解析中の行 */
+	void Add(std::string line);
+	void Detect();
+	static Chunk ParseChunk(std::vector<std::string> const& source, int dialect);
+	void Merge(Chunk&& chunk);
+public:
+	ListParser();
+	void Write(std::string_view data);
+	std::vector<std::variant<FILELIST, std::string>> Finish();
+};
+
+
 class Sound {
 	const wchar_t* keyName;
 	const wchar_t* name;
@@ -659,10 +771,11 @@ HWND GetLocalHwnd(void);
 HWND GetRemoteHwnd(void);
 void SetListViewType(void);
 void GetRemoteDirForWnd(int Mode, int *CancelCheckWork);
+void RevalidateRemoteDir(int *CancelCheckWork);
 void GetLocalDirForWnd(void);
 void ReSortDispList(int Win, int *CancelCheckWork);
 bool CheckFname(std::wstring str, std::wstring const& regexp);
-void SelectFileInList(HWND hWnd, int Type, std::vector<FILELIST> const& Base);
+void SelectFileInList(HWND hWnd, int Type, FileList const& Base);
 void FindFileInList(HWND hWnd, int Type);
 int GetCurrentItem(int Win);
 int GetItemCount(int Win);
@@ -682,13 +795,14 @@ int GetNodeType(int Win, int Pos);
 void GetNodeOwner(int Win, int Pos, char *Buf, int Max);
 void EraseRemoteDirForWnd(void);
 double GetSelectedTotalSize(int Win);
-int MakeSelectedFileList(int Win, int Expand, int All, std::vector<FILELIST>& Base, int *CancelCheckWork);
-void MakeDroppedFileList(WPARAM wParam, char *Cur, std::vector<FILELIST>& Base);
+int MakeSelectedFileList(int Win, int Expand, int All, FileList& Base, int *CancelCheckWork);
+void MakeDroppedFileList(WPARAM wParam, char *Cur, FileList& Base);
 void MakeDroppedDir(WPARAM wParam, char *Cur);
-void AddRemoteTreeToFileList(int Num, const char *Path, int IncDir, std::vector<FILELIST>& Base);
-const FILELIST* SearchFileList(const char* Fname, std::vector<FILELIST> const& Base, int Caps);
-static inline FILELIST* SearchFileList(const char* Fname, std::vector<FILELIST>& Base, int Caps) {
-	return const_cast<FILELIST*>(SearchFileList(Fname, static_cast<std::vector<FILELIST> const&>(Base), Caps));
+void AddRemoteTreeToFileList(int Num, const char *Path, int IncDir, FileList& Base);
+void AddRemoteTreeToFileList(ListParser& parser, const char *Path, int IncDir, FileList& Base);
+const FileList::Entry* SearchFileList(const char* Fname, FileList const& Base, int Caps);
+static inline FileList::Entry* SearchFileList(const char* Fname, FileList& Base, int Caps) {
+	return const_cast<FileList::Entry*>(SearchFileList(Fname, static_cast<FileList const&>(Base), Caps));
 }
 void SetFilter(int *CancelCheckWork);
 void doDeleteRemoteFile(void);
@@ -805,6 +919,7 @@ void QuickConnectProc(void);
 void DirectConnectProc(char *unc, int Kanji, int Kana, int Fkanji, int TrMode);
 void HistoryConnectProc(int MenuCmd);
 std::wstring_view AskHostAdrs();
+std::wstring_view AskHostUserName();
 int AskHostPort(void);
 int AskHostNameKanji(void);
 int AskHostNameKana(void);
@@ -864,6 +979,10 @@ int AskNoPasvAdrs(void);
 /*===== cache.c =====*/
 
 fs::path MakeCacheFileName(int Num);
+bool LoadListCache(std::wstring const& path, std::string& listing, FILETIME& time);
+void SaveListCache(std::wstring const& path, std::string_view listing, FILETIME const& time);
+void InvalidateListCache(std::string_view path);
+void InvalidateListCache(std::vector<std::string> const& paths);
 
 /*===== ftpproc.c =====*/
 
@@ -918,10 +1037,13 @@ int DoMKD(const char* Path);
 void InitPWDcommand();
 int DoRMD(const char* Path);
 int DoDELE(const char* Path);
+int DoDELE(std::vector<std::string> const& Paths);
 int DoRENAME(const char *Src, const char *Dst);
 int DoCHMOD(const char *Path, const char *Mode);
+int DoCHMOD(std::vector<std::string> const& Paths, const char *Mode);
 int DoSIZE(SOCKET cSkt, const char* Path, LONGLONG *Size, int *CancelCheckWork);
 int DoMDTM(SOCKET cSkt, const char* Path, FILETIME *Time, int *CancelCheckWork);
+void DoSIZEandMDTM(SOCKET cSkt, const char* Path, LONGLONG *Size, FILETIME *Time, int *CancelCheckWork);
 // ホスト側の日時設定
 int DoMFMT(SOCKET cSkt, const char* Path, FILETIME *Time, int *CancelCheckWork);
 int DoQUOTE(SOCKET cSkt, const char* CmdStr, int *CancelCheckWork);
@@ -929,12 +1051,13 @@ SOCKET DoClose(SOCKET Sock);
 // 同時接続対応
 //int DoQUIT(SOCKET ctrl_skt);
 int DoQUIT(SOCKET ctrl_skt, int *CancelCheckWork);
-int DoDirListCmdSkt(const char* AddOpt, const char* Path, int Num, int *CancelCheckWork);
+int DoDirListCmdSkt(const char* AddOpt, const char* Path, int Num, int *CancelCheckWork, ListParser* List = nullptr);
 #if defined(HAVE_TANDEM)
 void SwitchOSSProc(void);
 #endif
 #define CommandProcTrn(CSKT, REPLY, CANCELCHECKWORK, ...) (command(CSKT, REPLY, CANCELCHECKWORK, __VA_ARGS__))
 int command(SOCKET cSkt, char* Reply, int* CancelCheckWork, _In_z_ _Printf_format_string_ const char* fmt, ...);
+std::vector<std::tuple<int, std::string>> CommandPipeline(SOCKET cSkt, std::vector<std::string> const& Cmds, int* CancelCheckWork);
 std::tuple<int, std::string> ReadReplyMessage(SOCKET cSkt, int *CancelCheckWork);
 int ReadNchar(SOCKET cSkt, char *Buf, int Size, int *CancelCheckWork);
 void ReportWSError(const wchar_t* functionName);
@@ -946,6 +1069,8 @@ void CloseTransferThread(void);
 // 同時接続対応
 void AbortAllTransfer();
 int AddTmpTransFileList(TRANSPACKET const& item, std::forward_list<TRANSPACKET>& list);
+void WakeTransferThread();
+void PrewarmTransferThread();
 int RemoveTmpTransFileListItem(std::forward_list<TRANSPACKET>& list, int Num);
 
 void AddTransFileList(TRANSPACKET *Pkt);
@@ -980,6 +1105,19 @@ class CodeDetector {
 	bool nfd = false;
 public:
 	void Test(std::string_view str);
+	// 分割して判定した結果を先頭から順に合わせる
+	//   NFC/NFDは先に判定した方を優先する
+	CodeDetector& operator+=(CodeDetector const& other) {
+		utf8 += other.utf8;
+		sjis += other.sjis;
+		euc += other.euc;
+		jis += other.jis;
+		if (!nfc && !nfd) {
+			nfc = other.nfc;
+			nfd = other.nfd;
+		}
+		return *this;
+	}
 	int result() const {
 		DoPrintf(L"CodeDetector::result(): utf8 %d, sjis %d, euc %d, jis %d, nfc %d, nfd %d", utf8, sjis, euc, jis, int(nfc), int(nfd));
 		auto [_, id] = std::max<std::tuple<int, int>>({
@@ -1003,7 +1141,6 @@ public:
 	std::string Convert(std::string_view input);
 };
 
-std::string ToCRLF(std::string_view source);
 std::string ConvertFrom(std::string_view str, int kanji);
 std::string ConvertTo(std::string_view str, int kanji, int kana);
 
@@ -1133,12 +1270,18 @@ void SetAsyncTableData(SOCKET s, std::variant<sockaddr_storage, std::tuple<std::
 void SetAsyncTableDataMapPort(SOCKET s, int Port);
 int GetAsyncTableData(SOCKET s, std::variant<sockaddr_storage, std::tuple<std::string, int>>& target);
 int GetAsyncTableDataMapPort(SOCKET s, int* Port);
+int GetSessionState(SOCKET s, std::string const& name, std::string const& value);
+void SetSessionState(SOCKET s, std::string const& name, std::string const& value, int code);
+void ClearSessionState(SOCKET s);
 SOCKET do_socket(int af, int type, int protocol);
 int do_connect(SOCKET s, const struct sockaddr *name, int namelen, int *CancelCheckWork);
+SOCKET do_connect_race(std::vector<sockaddr_storage> const& addresses, size_t* Index, int* CancelCheckWork);
 int do_closesocket(SOCKET s);
 int do_listen(SOCKET s,	int backlog);
 SOCKET do_accept(SOCKET s, struct sockaddr *addr, int *addrlen);
 int do_recv(SOCKET s, char *buf, int len, int flags, int *TimeOut, int *CancelCheckWork);
+int ReceiveLine(SOCKET s, std::string& line, int* TimeOutErr, int* CancelCheckWork);
+bool WaitReceived(SOCKET s, std::chrono::milliseconds timeout, int* CancelCheckWork);
 int SendData(SOCKET s, const char* buf, int len, int flags, int* CancelCheckWork);
 // 同時接続対応
 void RemoveReceivedData(SOCKET s);
@@ -9,8 +9,8 @@
 //#define DISABLE_TRANSFER_NETWORK_BUFFERS
 // コントロール用のネットワークバッファを無効にする（フリーズ対策）
 #define DISABLE_CONTROL_NETWORK_BUFFERS
-// ファイル転送の同時接続数
-#define MAX_DATA_CONNECTION 4
+// ファイル転送の同時接続数の上限（転送スレッドは接続先の同時接続数に応じて必要な数だけ作成する）
+#define MAX_DATA_CONNECTION 32
 
 /* HP NonStop Server 用のコードを有効にする */
 #define HAVE_TANDEM
@@ -178,6 +178,7 @@ void ConnectProc(int Type, int Num)
 					GetLocalDirForWnd();
 				}
 				InitTransCurDir();
+				PrewarmTransferThread();
 				DoCWD(u8(CurHost.RemoteInitDir).c_str(), YES, YES, YES);
 
 				LoadBookMark();
@@ -281,6 +282,7 @@ void QuickConnectProc() {
 				Sound::Connected.Play();
 
 				InitTransCurDir();
+				PrewarmTransferThread();
 				DoCWD(u8(CurHost.RemoteInitDir).c_str(), YES, YES, YES);
 
 				GetRemoteDirForWnd(CACHE_NORMAL, &CancelFlg);
@@ -374,6 +376,7 @@ void DirectConnectProc(char *unc, int Kanji, int Kana, int Fkanji, int TrMode)
 			Sound::Connected.Play();
 
 			InitTransCurDir();
+			PrewarmTransferThread();
 			DoCWD(u8(CurHost.RemoteInitDir).c_str(), YES, YES, YES);
 
 			GetRemoteDirForWnd(CACHE_NORMAL, &CancelFlg);
@@ -455,6 +458,7 @@ void HistoryConnectProc(int MenuCmd)
 				GetLocalDirForWnd();
 
 				InitTransCurDir();
+				PrewarmTransferThread();
 				DoCWD(u8(CurHost.RemoteInitDir).c_str(), YES, YES, YES);
 
 				GetRemoteDirForWnd(CACHE_NORMAL, &CancelFlg);
@@ -530,6 +534,12 @@ std::wstring_view AskHostAdrs() {
 }
 
 
+// 接続しているホストのユーザー名を返す
+std::wstring_view AskHostUserName() {
+	return CurHost.UserName;
+}
+
+
 /*----- 接続しているホストのポートを返す --------------------------------------
 *
 *	Parameter
@@ -1062,6 +1072,8 @@ void DisconnectProc(void)
 
 	TrnCtrlSocket = INVALID_SOCKET;
 	CmdCtrlSocket = INVALID_SOCKET;
+	// 転送用の接続を切断させる
+	WakeTransferThread();
 
 	DispWindowTitle();
 	UpdateStatusBar();
@@ -1085,6 +1097,7 @@ void DisconnectSet(void)
 {
 	CmdCtrlSocket = INVALID_SOCKET;
 	TrnCtrlSocket = INVALID_SOCKET;
+	WakeTransferThread();
 
 	EraseRemoteDirForWnd();
 	DispWindowTitle();
@@ -1699,6 +1712,30 @@ static inline auto getaddrinfo(std::wstring const& host, int port, int family, i
 }
 
 
+// 名前解決で得たアドレスを接続を試す順に並べる（RFC 8305 4）
+//   GetAddrInfoWが返した順を保ったまま、最初のアドレスのファミリーともう一方のファミリーを交互にする
+static std::vector<sockaddr_storage> ConnectOrder(addrinfoW const* ai) {
+	std::vector<sockaddr_storage> preferred, other;
+	for (auto p = ai; p; p = p->ai_next) {
+		if (p->ai_family != AF_INET && p->ai_family != AF_INET6)
+			continue;
+		sockaddr_storage address{};
+		memcpy(&address, p->ai_addr, p->ai_addrlen);
+		auto& list = p->ai_family == ai->ai_family ? preferred : other;
+		if (std::ranges::none_of(list, [&](auto const& item) { return memcmp(&item, &address, sizeof address) == 0; }))
+			list.push_back(address);
+	}
+	std::vector<sockaddr_storage> order;
+	for (size_t i = 0; i < std::max(size(preferred), size(other)); i++) {
+		if (i < size(preferred))
+			order.push_back(preferred[i]);
+		if (i < size(other))
+			order.push_back(other[i]);
+	}
+	return order;
+}
+
+
 enum class SocksCommand : uint8_t {
 	Connect = 1,
 	Bind = 2,
@@ -1900,25 +1937,29 @@ static std::optional<sockaddr_storage> SocksRequest(SOCKET s, SocksCommand cmd,
 SOCKET connectsock(std::string_view host, int port, UINT prefixId, int *CancelCheckWork) {
 	std::variant<sockaddr_storage, std::tuple<std::string, int>> target;
 	auto wHost = u8(host);
+	std::vector<sockaddr_storage> addresses;
 	int Fwall = AskHostFireWall() == YES ? FwallType : FWALL_NONE;
 	if (auto ai = getaddrinfo(wHost, port, Fwall == FWALL_SOCKS4 ? AF_INET : AF_UNSPEC)) {
 		// ホスト名がIPアドレスだった
 		SetTaskMsg(IDS_MSGJPN017, prefixId ? GetString(prefixId).c_str() : L"", wHost.c_str(), AddressPortToString(ai->ai_addr, ai->ai_addrlen).c_str());
-		memcpy(&std::get<sockaddr_storage>(target), ai->ai_addr, ai->ai_addrlen);
+		addresses = ConnectOrder(ai.get());
+		target = addresses[0];
 	} else if ((Fwall == FWALL_SOCKS5_NOAUTH || Fwall == FWALL_SOCKS5_USER) && FwallResolve == YES) {
 		// SOCKS5で名前解決する
 		target = std::tuple{ std::string(host), port };
 	} else if (ai = getaddrinfo(wHost, port, Fwall == FWALL_SOCKS4 ? AF_INET : AF_UNSPEC, CancelCheckWork)) {
 		// 名前解決に成功
 		SetTaskMsg(IDS_MSGJPN017, prefixId ? GetString(prefixId).c_str() : L"", wHost.c_str(), AddressPortToString(ai->ai_addr, ai->ai_addrlen).c_str());
-		memcpy(&std::get<sockaddr_storage>(target), ai->ai_addr, ai->ai_addrlen);
+		addresses = ConnectOrder(ai.get());
+		target = addresses[0];
 	} else {
 		// 名前解決に失敗
 		SetTaskMsg(IDS_MSGJPN019, wHost.c_str());
 		return INVALID_SOCKET;
 	}
 
-	sockaddr_storage saConnect;
+	// 接続先のアドレスが複数ある場合は時間をずらして並行に接続し、最初に接続できたものを使う
+	std::vector<sockaddr_storage> saConnect;
 	if (Fwall == FWALL_SOCKS4 || Fwall == FWALL_SOCKS5_NOAUTH || Fwall == FWALL_SOCKS5_USER) {
 		// connectで接続する先はSOCKSサーバ
 		auto ai = getaddrinfo(FwallHost, FwallPort);
@@ -1928,24 +1969,24 @@ SOCKET connectsock(std::string_view host, int port, UINT prefixId, int *CancelCh
 			SetTaskMsg(IDS_MSGJPN021, FwallHost.c_str());
 			return INVALID_SOCKET;
 		}
-		memcpy(&saConnect, ai->ai_addr, ai->ai_addrlen);
+		saConnect = ConnectOrder(ai.get());
 		SetTaskMsg(IDS_MSGJPN022, AddressPortToString(ai->ai_addr, ai->ai_addrlen).c_str());
 	} else {
 		// connectで接続するのは接続先のホスト
-		saConnect = std::get<sockaddr_storage>(target);
+		saConnect = addresses;
 	}
 
-	auto s = do_socket(saConnect.ss_family, SOCK_STREAM, IPPROTO_TCP);
+	size_t index = 0;
+	auto s = do_connect_race(saConnect, &index, CancelCheckWork);
 	if (s == INVALID_SOCKET) {
-		SetTaskMsg(IDS_MSGJPN027);
-		return INVALID_SOCKET;
-	}
-	SetAsyncTableData(s, target);
-	if (do_connect(s, reinterpret_cast<const sockaddr*>(&saConnect), sizeof saConnect, CancelCheckWork) == SOCKET_ERROR) {
 		SetTaskMsg(IDS_MSGJPN026);
-		DoClose(s);
 		return INVALID_SOCKET;
 	}
+	if (0 < index)
+		DoPrintf(L"connect: connected to %s", AddressPortToString(&saConnect[index], saConnect[index].ss_family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6)).c_str());
+	if (Fwall != FWALL_SOCKS4 && Fwall != FWALL_SOCKS5_NOAUTH && Fwall != FWALL_SOCKS5_USER)
+		target = saConnect[index];
+	SetAsyncTableData(s, target);
 	if (Fwall == FWALL_SOCKS4 || Fwall == FWALL_SOCKS5_NOAUTH || Fwall == FWALL_SOCKS5_USER) {
 		auto result = SocksRequest(s, SocksCommand::Connect, target, CancelCheckWork);
 		if (!result) {
@@ -1955,7 +1996,7 @@ SOCKET connectsock(std::string_view host, int port, UINT prefixId, int *CancelCh
 		}
 		CurHost.CurNetType = result->ss_family == AF_INET ? NTYPE_IPV4 : NTYPE_IPV6;
 	} else
-		CurHost.CurNetType = saConnect.ss_family == AF_INET ? NTYPE_IPV4 : NTYPE_IPV6;
+		CurHost.CurNetType = saConnect[index].ss_family == AF_INET ? NTYPE_IPV4 : NTYPE_IPV6;
 	SetTaskMsg(IDS_MSGJPN025);
 	return s;
 }
@@ -48,13 +48,14 @@ static void DispFileList2View(HWND hWnd, std::vector<FILELIST>& files);
 //static void AddListView(HWND hWnd, int Pos, char *Name, int Type, LONGLONG Size, FILETIME *Time, int Attr, char *Owner, int Link, int InfoExist);
 static void AddListView(HWND hWnd, int Pos, char *Name, int Type, LONGLONG Size, FILETIME *Time, int Attr, char *Owner, int Link, int InfoExist, int ImageId);
 static int GetImageIndex(int Win, int Pos);
-static int MakeRemoteTree1(char *Path, char *Cur, std::vector<FILELIST>& Base, int *CancelCheckWork);
-static int MakeRemoteTree2(char *Path, char *Cur, std::vector<FILELIST>& Base, int *CancelCheckWork);
-static void CopyTmpListToFileList(std::vector<FILELIST>& Base, std::vector<FILELIST> const& List);
-static std::optional<std::vector<std::variant<FILELIST, std::string>>> GetListLine(int Num);
+static int MakeRemoteTree1(char *Path, char *Cur, FileList& Base, int *CancelCheckWork);
+static int MakeRemoteTree2(char *Path, char *Cur, FileList& Base, int *CancelCheckWork);
+static void CopyTmpListToFileList(FileList& Base, FileList const& List);
+static bool GetListLine(int Num, ListParser& parser);
+static std::string ReadListFile(int Num);
 static int MakeDirPath(const char *Str, const char *Path, char *Dir);
-static bool MakeLocalTree(const char *Path, std::vector<FILELIST>& Base);
-static void AddFileList(FILELIST const& Pkt, std::vector<FILELIST>& Base);
+static bool MakeLocalTree(const char *Path, FileList& Base);
+static void AddFileList(FILELIST const& Pkt, FileList& Base);
 static int AskFilterStr(const char *Fname, int Type);
 
 /*===== 外部参照 =====*/
@@ -86,6 +87,7 @@ extern int DispFileIcon;
 extern int DispTimeSeconds;
 // ファイルの属性を数字で表示
 extern int DispPermissionsNumber;
+extern int ListCache;
 extern HOSTDATA CurHost;
 
 /*===== ローカルなワーク =====*/
@@ -110,8 +112,8 @@ static int StratusMode;			/* 0=ファイル, 1=ディレクトリ, 2=リンク *
 
 
 // リモートファイルリスト (2007.9.3 yutaka)
-static std::vector<FILELIST> remoteFileListBase;
-static std::vector<FILELIST> remoteFileListBaseNoExpand;
+static FileList remoteFileListBase;
+static FileList remoteFileListBaseNoExpand;
 static fs::path remoteFileDir;
 
 template<class Fn>
@@ -320,9 +322,9 @@ static void doTransferRemoteFile(void)
 		Sleep(10);
 	}
 
-	std::vector<FILELIST> FileListBase;
+	FileList FileListBase;
 	MakeSelectedFileList(WIN_REMOTE, YES, NO, FileListBase, &CancelFlg);
-	std::vector<FILELIST> FileListBaseNoExpand;
+	FileList FileListBaseNoExpand;
 	MakeSelectedFileList(WIN_REMOTE, NO, NO, FileListBaseNoExpand, &CancelFlg);
 
 	// set temporary folder
@@ -613,7 +615,7 @@ static LRESULT FileListCommonWndProc(HWND hWnd, UINT message, WPARAM wParam, LPA
 			{
 			case CF_HDROP:		/* ファイル */
 				{
-					std::vector<FILELIST> FileListBase, FileListBaseNoExpand;
+					FileList FileListBase, FileListBaseNoExpand;
 					fs::path PathDir;
 
 					// 特定の操作を行うと異常終了するバグ修正
@@ -861,42 +863,115 @@ void SetListViewType(void)
 }
 
 
+// 永続キャッシュから表示し、まだ再検証していないファイル一覧
+//   再検証するまで_ffftp.000には書き込まず、表示し直すときはこちらを使う
+struct CachedRemoteView {
+	std::wstring dir;
+	std::string listing;
+	FILETIME time;
+};
+static std::optional<CachedRemoteView> CachedView;
+
+// ホスト側のファイル一覧ウインドウに解析した一覧を表示
+static void DispRemoteList(ListParser& parser) {
+	std::vector<FILELIST> files;
+	for (auto& line : parser.Finish())
+		std::visit([&files](auto&& arg) {
+			if constexpr (std::is_same_v<std::decay_t<decltype(arg)>, FILELIST>)
+				if (arg.Node != NODE_NONE && AskFilterStr(arg.File, arg.Node) == YES && (DotFile == YES || arg.File[0] != '.'))
+					files.emplace_back(arg);
+		}, line);
+	DispFileList2View(GetRemoteHwnd(), files);
+
+	// 先頭のアイテムを選択
+	ListView_SetItemState(GetRemoteHwnd(), 0, LVIS_FOCUSED, LVIS_FOCUSED);
+}
+
 // ホスト側のファイル一覧ウインドウにファイル名をセット
+//   CACHE_NORMALでは永続キャッシュがあればそれを表示し、表示を終えてからRevalidateRemoteDir()で再検証する
 void GetRemoteDirForWnd(int Mode, int *CancelCheckWork) {
 	if (AskConnecting() == YES) {
 		DisableUserOpe();
 		SetRemoteDirHist(AskRemoteCurDir());
-		if (Mode == CACHE_LASTREAD || DoDirListCmdSkt("", "", 0, CancelCheckWork) == FTP_COMPLETE) {
-			if (auto lines = GetListLine(0)) {
-				std::vector<FILELIST> files;
-				for (auto& line : *lines)
-					std::visit([&files](auto&& arg) {
-						if constexpr (std::is_same_v<std::decay_t<decltype(arg)>, FILELIST>)
-							if (arg.Node != NODE_NONE && AskFilterStr(arg.File, arg.Node) == YES && (DotFile == YES || arg.File[0] != '.'))
-								files.emplace_back(arg);
-					}, line);
-				DispFileList2View(GetRemoteHwnd(), files);
-
-				// 先頭のアイテムを選択
-				ListView_SetItemState(GetRemoteHwnd(), 0, LVIS_FOCUSED, LVIS_FOCUSED);
-			} else {
-				SetTaskMsg(IDS_MSGJPN048);
-				SendMessageW(GetRemoteHwnd(), LVM_DELETEALLITEMS, 0, 0);
-			}
+		auto const dir = AskRemoteCurDir();
+		std::string cached;
+		FILETIME cachedTime;
+		if (Mode == CACHE_LASTREAD && CachedView && CachedView->dir == dir) {
+			ListParser parser;
+			parser.Write(CachedView->listing);
+			DispRemoteList(parser);
+		} else if (Mode == CACHE_NORMAL && LoadListCache(dir, cached, cachedTime)) {
+			// 一覧を参照する処理が前のディレクトリの一覧を使わないよう、再検証するまではキャッシュの内容を_ffftp.000とする
+			if (std::ofstream os{ MakeCacheFileName(0), std::ios::binary })
+				os.write(data(cached), size(cached));
+			ListParser parser;
+			parser.Write(cached);
+			DispRemoteList(parser);
+			CachedView = { dir, std::move(cached), cachedTime };
+			PostMessageW(GetMainHwnd(), WM_REVALIDATE_REMOTE, 0, 0);
 		} else {
+			if (Mode != CACHE_LASTREAD)
+				CachedView.reset();
+			// 一覧より先にディレクトリの日時を取得し、取得中に変更された場合は次回の再検証で検出する
+			//   キャッシュを使わない場合は日時も不要なため問い合わせない
+			FILETIME time{};
+			if (Mode != CACHE_LASTREAD && ListCache == YES)
+				DoMDTM(AskCmdCtrlSkt(), u8(dir).c_str(), &time, CancelCheckWork);
+			ListParser parser;
+			if (Mode == CACHE_LASTREAD || DoDirListCmdSkt("", "", 0, CancelCheckWork, &parser) == FTP_COMPLETE) {
+				if (Mode != CACHE_LASTREAD || GetListLine(0, parser)) {
+					DispRemoteList(parser);
+					if (Mode != CACHE_LASTREAD)
+						SaveListCache(dir, ReadListFile(0), time);
+				} else {
+					SetTaskMsg(IDS_MSGJPN048);
+					SendMessageW(GetRemoteHwnd(), LVM_DELETEALLITEMS, 0, 0);
+				}
+			} else {
 #if defined(HAVE_OPENVMS)
-			/* OpenVMSの場合空ディレクトリ移動の時に出るので、メッセージだけ出さない
-			 * ようにする(VIEWはクリアして良い) */
-			if (AskHostType() != HTYPE_VMS)
+				/* OpenVMSの場合空ディレクトリ移動の時に出るので、メッセージだけ出さない
+				 * ようにする(VIEWはクリアして良い) */
+				if (AskHostType() != HTYPE_VMS)
 #endif
-				SetTaskMsg(IDS_MSGJPN049);
-			SendMessageW(GetRemoteHwnd(), LVM_DELETEALLITEMS, 0, 0);
+					SetTaskMsg(IDS_MSGJPN049);
+				SendMessageW(GetRemoteHwnd(), LVM_DELETEALLITEMS, 0, 0);
+			}
 		}
 		EnableUserOpe();
 	}
 }
 
 
+// 永続キャッシュから表示したファイル一覧をホストに問い合わせて再検証する
+//   ディレクトリの日時が変わっていなければ一覧は取得せず、キャッシュの内容を_ffftp.000とする
+//   再検証できなければキャッシュを表示していることを通知する
+void RevalidateRemoteDir(int *CancelCheckWork) {
+	if (!CachedView || AskConnecting() != YES || CachedView->dir != AskRemoteCurDir())
+		return;
+	if (AskUserOpeDisabled()) {
+		SetTaskMsg(IDS_MSGJPN339);
+		return;
+	}
+	DisableUserOpe();
+	FILETIME time{};
+	auto const unchanged = DoMDTM(AskCmdCtrlSkt(), u8(CachedView->dir).c_str(), &time, CancelCheckWork) == FTP_COMPLETE && (time.dwLowDateTime != 0 || time.dwHighDateTime != 0) && CompareFileTime(&time, &CachedView->time) == 0;
+	if (unchanged) {
+		if (std::ofstream os{ MakeCacheFileName(0), std::ios::binary })
+			os.write(data(CachedView->listing), size(CachedView->listing));
+		CachedView.reset();
+	} else if (ListParser latest; DoDirListCmdSkt("", "", 0, CancelCheckWork, &latest) == FTP_COMPLETE) {
+		// 一覧に差分がある場合のみ表示し直す
+		auto listing = ReadListFile(0);
+		if (listing != CachedView->listing)
+			DispRemoteList(latest);
+		SaveListCache(CachedView->dir, listing, time);
+		CachedView.reset();
+	} else
+		SetTaskMsg(IDS_MSGJPN339);
+	EnableUserOpe();
+}
+
+
 // ローカル側のファイル一覧ウインドウにファイル名をセット
 void RefreshIconImageList(std::vector<FILELIST>& files)
 {
@@ -1129,7 +1204,7 @@ bool CheckFname(std::wstring str, std::wstring const& regexp) {
 
 
 // ファイル一覧ウインドウのファイルを選択する
-void SelectFileInList(HWND hWnd, int Type, std::vector<FILELIST> const& Base) {
+void SelectFileInList(HWND hWnd, int Type, FileList const& Base) {
 	static bool IgnoreNew = false;
 	static bool IgnoreOld = false;
 	static bool IgnoreExist = false;
@@ -1638,7 +1713,7 @@ double GetSelectedTotalSize(int Win)
 *		なし
 *----------------------------------------------------------------------------*/
 
-int MakeSelectedFileList(int Win, int Expand, int All, std::vector<FILELIST>& Base, int *CancelCheckWork) {
+int MakeSelectedFileList(int Win, int Expand, int All, FileList& Base, int *CancelCheckWork) {
 	int Sts;
 	int Pos;
 	char Name[FMAX_PATH+1];
@@ -1760,7 +1835,7 @@ static inline fs::path DragFile(HDROP hdrop, UINT index) {
 }
 
 // Drag&Dropされたファイルをリストに登録する
-void MakeDroppedFileList(WPARAM wParam, char* Cur, std::vector<FILELIST>& Base) {
+void MakeDroppedFileList(WPARAM wParam, char* Cur, FileList& Base) {
 	int count = DragQueryFileW((HDROP)wParam, 0xFFFFFFFF, NULL, 0);
 
 	auto const baseDirectory = DragFile((HDROP)wParam, 0).parent_path();
@@ -1839,7 +1914,7 @@ std::string ReformVMSDirName(std::string&& dirName) {
 *		NLST -alLR を使う
 *----------------------------------------------------------------------------*/
 
-static int MakeRemoteTree1(char *Path, char *Cur, std::vector<FILELIST>& Base, int *CancelCheckWork) {
+static int MakeRemoteTree1(char *Path, char *Cur, FileList& Base, int *CancelCheckWork) {
 	int Ret;
 	int Sts;
 
@@ -1848,12 +1923,13 @@ static int MakeRemoteTree1(char *Path, char *Cur, std::vector<FILELIST>& Base, i
 	if(DoCWD(Path, NO, NO, NO) == FTP_COMPLETE)
 	{
 		/* サブフォルダも含めたリストを取得 */
-		Sts = DoDirListCmdSkt("R", "", 999, CancelCheckWork);	/* NLST -alLR*/
+		ListParser parser;
+		Sts = DoDirListCmdSkt("R", "", -1, CancelCheckWork, &parser);	/* NLST -alLR*/
 		DoCWD(Cur, NO, NO, NO);
 
 		if(Sts == FTP_COMPLETE)
 		{
-			AddRemoteTreeToFileList(999, Path, RDIR_NLST, Base);
+			AddRemoteTreeToFileList(parser, Path, RDIR_NLST, Base);
 			Ret = FFFTP_SUCCESS;
 		}
 	}
@@ -1875,7 +1951,7 @@ static int MakeRemoteTree1(char *Path, char *Cur, std::vector<FILELIST>& Base, i
 *		各フォルダに移動してリストを取得
 *----------------------------------------------------------------------------*/
 
-static int MakeRemoteTree2(char *Path, char *Cur, std::vector<FILELIST>& Base, int *CancelCheckWork) {
+static int MakeRemoteTree2(char *Path, char *Cur, FileList& Base, int *CancelCheckWork) {
 	int Ret;
 	int Sts;
 
@@ -1896,13 +1972,14 @@ static int MakeRemoteTree2(char *Path, char *Cur, std::vector<FILELIST>& Base, i
 
 	if(Sts == FTP_COMPLETE)
 	{
-		Sts = DoDirListCmdSkt("", "", 999, CancelCheckWork);		/* NLST -alL*/
+		ListParser parser;
+		Sts = DoDirListCmdSkt("", "", -1, CancelCheckWork, &parser);		/* NLST -alL*/
 		DoCWD(Cur, NO, NO, NO);
 
 		if(Sts == FTP_COMPLETE)
 		{
-			std::vector<FILELIST> CurList;
-			AddRemoteTreeToFileList(999, Path, RDIR_CWD, CurList);
+			FileList CurList;
+			AddRemoteTreeToFileList(parser, Path, RDIR_CWD, CurList);
 			CopyTmpListToFileList(Base, CurList);
 
 			// ファイル一覧バグ修正
@@ -1943,34 +2020,38 @@ static int MakeRemoteTree2(char *Path, char *Cur, std::vector<FILELIST>& Base, i
 *		ディレクトリの情報はコピーしない
 *----------------------------------------------------------------------------*/
 
-static void CopyTmpListToFileList(std::vector<FILELIST>& Base, std::vector<FILELIST> const& List) {
+static void CopyTmpListToFileList(FileList& Base, FileList const& List) {
 	for (auto& f : List)
 		if (f.Node == NODE_FILE)
-			AddFileList(f, Base);
+			AddFileList({ f.File, f.Node, f.Link, f.Size, f.Attr, f.Time, f.Owner, f.InfoExist }, Base);
 }
 
 
 // ホスト側のファイル情報をファイルリストに登録
-void AddRemoteTreeToFileList(int Num, const char *Path, int IncDir, std::vector<FILELIST>& Base) {
+void AddRemoteTreeToFileList(int Num, const char *Path, int IncDir, FileList& Base) {
+	if (ListParser parser; GetListLine(Num, parser))
+		AddRemoteTreeToFileList(parser, Path, IncDir, Base);
+}
+
+void AddRemoteTreeToFileList(ListParser& parser, const char *Path, int IncDir, FileList& Base) {
 	char Dir[FMAX_PATH+1];
 	strcpy(Dir, Path);
-	if (auto lines = GetListLine(Num))
-		for (auto& line : *lines)
-			std::visit([&Path, IncDir, &Base, &Dir](auto&& arg) {
-				if constexpr (std::is_same_v<std::decay_t<decltype(arg)>, FILELIST>) {
-					if (AskFilterStr(arg.File, arg.Node) == YES && (arg.Node == NODE_FILE || IncDir == RDIR_CWD && arg.Node == NODE_DIR)) {
-						FILELIST Pkt{ Dir, arg.Node, arg.Link, arg.Size, arg.Attr, arg.Time, ""sv, arg.InfoExist };
-						if (0 < strlen(Pkt.File))
-							SetSlashTail(Pkt.File);
-						strcat(Pkt.File, arg.File);
-						AddFileList(Pkt, Base);
-					}
-				} else {
-					static_assert(std::is_same_v<std::decay_t<decltype(arg)>, std::string>);
-					if (MakeDirPath(data(arg), Path, Dir) == FFFTP_SUCCESS && IncDir == RDIR_NLST)
-						AddFileList({ Dir, NODE_DIR }, Base);
+	for (auto& line : parser.Finish())
+		std::visit([&Path, IncDir, &Base, &Dir](auto&& arg) {
+			if constexpr (std::is_same_v<std::decay_t<decltype(arg)>, FILELIST>) {
+				if (AskFilterStr(arg.File, arg.Node) == YES && (arg.Node == NODE_FILE || IncDir == RDIR_CWD && arg.Node == NODE_DIR)) {
+					FILELIST Pkt{ Dir, arg.Node, arg.Link, arg.Size, arg.Attr, arg.Time, ""sv, arg.InfoExist };
+					if (0 < strlen(Pkt.File))
+						SetSlashTail(Pkt.File);
+					strcat(Pkt.File, arg.File);
+					AddFileList(Pkt, Base);
 				}
-			}, line);
+			} else {
+				static_assert(std::is_same_v<std::decay_t<decltype(arg)>, std::string>);
+				if (MakeDirPath(data(arg), Path, Dir) == FFFTP_SUCCESS && IncDir == RDIR_NLST)
+					AddFileList({ Dir, NODE_DIR }, Base);
+			}
+		}, line);
 }
 
 namespace re {
@@ -2017,27 +2098,62 @@ static inline WORD parseyear(boost::ssub_match const& sm) {
 	return year < 70 ? 2000 + year : year < 1601 ? 1900 + year : year;
 }
 
-static inline WORD parsemonth(boost::ssub_match const& sm) {
-	if (sm.length() != 3)
-		return parse<WORD>(sm);
-	auto it = sm.begin();
-	char name[] = { (char)toupper(*it++), (char)tolower(*it++), (char)tolower(*it++) };
+static inline WORD parsemonth(std::string_view sv) {
+	if (size(sv) != 3)
+		return parse<WORD>(sv);
+	char name[] = { (char)toupper(sv[0]), (char)tolower(sv[1]), (char)tolower(sv[2]) };
 	auto i = "JanFebMarAprMayJunJulAugSepOctNovDec"sv.find({ name, 3 });
 	return (WORD)i / 3 + 1;
 }
 
-static int parseattr(boost::ssub_match const& m) {
+static inline WORD parsemonth(boost::ssub_match const& sm) {
+	return parsemonth(sv(sm));
+}
+
+static int parseattr(std::string_view sv) {
 	int attr = 0;
-	auto it = m.begin();
+	auto it = begin(sv);
 	for (auto mask : { 0x400, 0x200, 0x100, 0x40, 0x20, 0x10, 0x4, 0x2, 0x1 }) {
 		if (*it++ != '-')
 			attr |= mask;
-		if (it == m.end())
+		if (it == end(sv))
 			break;
 	}
 	return attr;
 }
 
+static inline int parseattr(boost::ssub_match const& sm) {
+	return parseattr(sv(sm));
+}
+
+// サブマッチをfilelistscannerの結果と同じ形式にする
+template<size_t N>
+static inline auto captures(boost::smatch const& m) {
+	std::array<std::string_view, N> result;
+	for (size_t i = 0; i < N; i++)
+		if (m[i].matched)
+			result[i] = sv(m[i]);
+	return result;
+}
+
+// factsを先頭から順にfact名と値に分解する
+//   ([^;=]+)=(([^;=]+)(?:=[^;]*)?) を繰り返し検索するのと同じ
+template<class Func>
+static void ForEachFact(std::string_view facts, Func&& func) {
+	for (size_t i = 0; i < size(facts);) {
+		auto eq = facts.find_first_of(";="sv, i);
+		if (eq == std::string_view::npos)
+			break;
+		if (eq == i || facts[eq] == ';' || eq + 1 == size(facts) || facts[eq + 1] == ';' || facts[eq + 1] == '=') {
+			i = eq + 1;
+			continue;
+		}
+		auto end = std::min(facts.find(';', eq + 1), size(facts));
+		func(facts.substr(i, eq - i), facts.substr(eq + 1, end - eq - 1));
+		i = end;
+	}
+}
+
 
 static inline FILETIME tofiletime(SYSTEMTIME const& systemTime, bool fix = false) {
 	FILETIME fileTime;
@@ -2051,24 +2167,21 @@ static inline FILETIME tofiletime(SYSTEMTIME const& systemTime, bool fix = false
 	return fileTime;
 }
 
-static std::optional<FILELIST> ParseMlsd(boost::smatch const& m) {
+static std::optional<FILELIST> ParseMlsd(std::array<std::string_view, 3> const& m) {
 	char type = NODE_NONE;
 	int64_t size = 0;
 	int attr = 0;
 	FILETIME fileTime{};
 	std::string_view owner;
 	char infoExist = 0;
-	static const boost::regex re{ R"(([^;=]+)=(([^;=]+)(?:=[^;]*)?))" };
-	for (boost::sregex_iterator it{ m[1].begin(), m[1].end(), re }, end; it != end; ++it) {
-		auto factname = lc((*it)[1]);
-		auto value = sv((*it)[2]);
-		if (factname == "type"sv) {
-			if (auto lcvalue = lc(value); lcvalue == "dir"sv)
+	ForEachFact(m[1], [&](std::string_view factname, std::string_view value) {
+		if (ieq(factname, "type"sv)) {
+			if (ieq(value, "dir"sv))
 				type = NODE_DIR;
-			else if (lcvalue == "file"sv)
+			else if (ieq(value, "file"sv))
 				type = NODE_FILE;
 			// TODO: OS.unix=symlink、OS.unix=slinkの判定を行っているがバグっていて成功しない
-		} else if (factname == "modify"sv) {
+		} else if (ieq(factname, "modify"sv)) {
 			infoExist |= FINFO_DATE | FINFO_TIME;
 			SYSTEMTIME systemTime{};
 			std::from_chars(value.data() + 0, value.data() + 4, systemTime.wYear);
@@ -2078,26 +2191,26 @@ static std::optional<FILELIST> ParseMlsd(boost::smatch const& m) {
 			std::from_chars(value.data() + 10, value.data() + 12, systemTime.wMinute);
 			std::from_chars(value.data() + 12, value.data() + 14, systemTime.wSecond);
 			SystemTimeToFileTime(&systemTime, &fileTime);
-		} else if (factname == "size"sv) {
+		} else if (ieq(factname, "size"sv)) {
 			infoExist |= FINFO_SIZE;
 			size = parse<int64_t>(value);
-		} else if (factname == "unix.mode"sv) {
+		} else if (ieq(factname, "unix.mode"sv)) {
 			infoExist |= FINFO_ATTR;
 			std::from_chars(value.data(), value.data() + value.size(), attr, 16);
-		} else if (factname == "unix.owner"sv)
+		} else if (ieq(factname, "unix.owner"sv))
 			owner = value;
-	}
-	return { { sv(m[2]), type, NO, size, attr, fileTime, owner, infoExist } };
+	});
+	return { { m[2], type, NO, size, attr, fileTime, owner, infoExist } };
 }
 
-static std::optional<FILELIST> ParseUnix(boost::smatch const& m) {
+static std::optional<FILELIST> ParseUnix(std::array<std::string_view, 14> const& m) {
 	SYSTEMTIME systemTime{};
 	auto fixtimezone = false;
 	char infoExist = FINFO_SIZE | FINFO_ATTR | FINFO_DATE;
-	if (m[5].matched) {
+	if (!empty(m[5])) {
 		systemTime.wMonth = parsemonth(m[5]);
 		systemTime.wDay = parse<WORD>(m[6]);
-		if (m[7].matched) {
+		if (!empty(m[7])) {
 			systemTime.wYear = parse<WORD>(m[7]);
 		} else {
 			infoExist |= FINFO_TIME;
@@ -2116,8 +2229,8 @@ static std::optional<FILELIST> ParseUnix(boost::smatch const& m) {
 		systemTime.wMonth = parsemonth(m[11]);
 		systemTime.wDay = parse<WORD>(m[12]);
 	}
-	auto ch = *m[1].begin();
-	return { { sv(m[13]), ch == 'd' || ch == 'l' ? NODE_DIR : NODE_FILE, ch == 'l' ? YES : NO, parse<int64_t>(m[4]), parseattr(m[2]), tofiletime(systemTime, fixtimezone), sv(m[3]), infoExist } };
+	auto ch = m[1][0];
+	return { { m[13], ch == 'd' || ch == 'l' ? NODE_DIR : NODE_FILE, ch == 'l' ? YES : NO, parse<int64_t>(m[4]), parseattr(m[2]), tofiletime(systemTime, fixtimezone), m[3], infoExist } };
 }
 
 static std::optional<FILELIST> ParseLinux(boost::smatch const& m) {
@@ -2279,7 +2392,112 @@ static std::optional<FILELIST> ParseTandem(boost::smatch const& m) {
 	return { { sv(m[1]), NODE_FILE, NO, parse<int64_t>(m[3]), parse<int>(m[2]), tofiletime(systemTime, true), sv(m[10]), FINFO_SIZE | FINFO_ATTR | FINFO_DATE | FINFO_TIME } };
 }
 
-static std::optional<FILELIST> Parse(std::string const& line) {
+// 正規表現を使わずに解析する
+static bool ScanMlsd(std::string_view line, std::optional<FILELIST>& result) {
+	if (auto m = filelistscanner::mlsd(line)) {
+		result = ParseMlsd(*m);
+		return true;
+	}
+	return false;
+}
+
+static bool ScanUnix(std::string_view line, std::optional<FILELIST>& result) {
+	if (auto m = filelistscanner::unix(line)) {
+		result = ParseUnix(*m);
+		return true;
+	}
+	return false;
+}
+
+// ファイル一覧の形式と解析関数の対応
+// 並び順は形式を判別できなかったときに試す順番を兼ねる
+//   scanがあれば正規表現の代わりに使用する　reは結果が一致することを確認するための基準として残す
+static const struct {
+	boost::regex const* re;
+	std::optional<FILELIST> (*parse)(boost::smatch const&);
+	bool (*scan)(std::string_view, std::optional<FILELIST>&) = nullptr;
+} dialects[] = {
+	{ &re::mlsd,      [](boost::smatch const& m) { return ParseMlsd(captures<3>(m)); }, ScanMlsd },
+	{ &re::unix,      [](boost::smatch const& m) { return ParseUnix(captures<14>(m)); }, ScanUnix },
+	{ &re::linux,     ParseLinux     },
+	{ &re::dos,       ParseDos       },
+	{ &re::melcom80,  ParseMelcom80  },
+	{ &re::agilent,   ParseAgilent   },
+	{ &re::as400,     ParseAs400     },
+	{ &re::m1800,     ParseM1800     },
+	{ &re::gp6000,    ParseGp6000    },
+	{ &re::chameleon, ParseChameleon },
+	{ &re::os2,       ParseOs2       },
+	{ &re::os7,       ParseOs7       },
+	{ &re::os9,       ParseOs9       },
+	{ &re::allied,    ParseAllied    },
+	{ &re::ibm,       ParseIbm       },
+	{ &re::shibasoku, ParseShibasoku },
+	{ &re::stratus,   ParseStratus   },
+	{ &re::vms,       ParseVms       },
+	{ &re::irmx,      ParseIrmx      },
+	{ &re::tandem,    ParseTandem    },
+};
+
+// 形式の判別に使用する行数
+constexpr int LIST_DIALECT_SAMPLES = 8;
+
+// 並列に解析する単位の行数
+constexpr size_t LIST_CHUNK_LINES = 4096;
+
+// 形式ごとの、同じ行に一致しうるより優先する形式
+//   "^ *"で始まる形式は、空白の直後の１文字に部分一致するかで先頭の文字を調べる　それ以外の形式は行の途中から一致しうる
+static uint64_t EarlierDialects(int dialect) {
+	static auto const overlaps = filelistdialect::overlaps(size_as<int>(dialects), [](int i, char ch) {
+		auto const& re = *dialects[i].re;
+		return !re.str().starts_with("^ *"sv) || boost::regex_search(&ch, &ch + 1, re, boost::match_partial | boost::match_continuous);
+	});
+	return 0 <= dialect ? overlaps[dialect] : 0;
+}
+
+// TestDialect()で一致した結果　ParseDialect()で同じ検索を繰り返さないよう保持する
+//   foundは検索に使い回す作業領域で、一致した場合にmと交換する
+struct DialectMatch {
+	boost::smatch m, found;
+	bool scanned = false;
+	std::optional<FILELIST> result;
+};
+
+// dialectの形式に一致するか　一致した場合は結果をmatchに保持する
+static bool TestDialect(int dialect, std::string const& line, DialectMatch& match) {
+	auto const& d = dialects[dialect];
+	if (std::optional<FILELIST> result; d.scan && filelistscanner::supported(line)) {
+		if (!d.scan(line, result))
+			return false;
+		match.scanned = true;
+		match.result = std::move(result);
+		return true;
+	}
+	if (boost::regex_search(line, match.found, *d.re)) {
+		match.m.swap(match.found);
+		match.scanned = false;
+		return true;
+	}
+	return false;
+}
+
+// TestDialect()で一致したdialectの形式で解析
+static void ParseDialect(int dialect, DialectMatch& match, std::optional<FILELIST>& result) {
+	if (match.scanned) {
+		result = std::move(match.result);
+		return;
+	}
+#if defined(HAVE_TANDEM)
+	if (dialects[dialect].re == &re::tandem)
+		SetOSS(NO);
+#endif
+	result = dialects[dialect].parse(match.m);
+}
+
+// ファイル一覧の１行を解析
+//   dialectの形式から試すが、より優先する形式にも一致する行はそちらで解析する
+//   matchedには一致した形式を返す
+static std::optional<FILELIST> Parse(std::string const& line, int dialect, int* matched = nullptr) {
 	boost::smatch m;
 	switch (AskHostType()) {
 	case HTYPE_ACOS:
@@ -2300,99 +2518,232 @@ static std::optional<FILELIST> Parse(std::string const& line) {
 	if (AskRealHostType() == HTYPE_TANDEM)
 		SetOSS(YES);
 #endif
-	if (boost::regex_search(line, m, re::mlsd))
-		return ParseMlsd(m);
-	if (boost::regex_search(line, m, re::unix))
-		return ParseUnix(m);
-	if (boost::regex_search(line, m, re::linux))
-		return ParseLinux(m);
-	if (boost::regex_search(line, m, re::dos))
-		return ParseDos(m);
-	if (boost::regex_search(line, m, re::melcom80))
-		return ParseMelcom80(m);
-	if (boost::regex_search(line, m, re::agilent))
-		return ParseAgilent(m);
-	if (boost::regex_search(line, m, re::as400))
-		return ParseAs400(m);
-	if (boost::regex_search(line, m, re::m1800))
-		return ParseM1800(m);
-	if (boost::regex_search(line, m, re::gp6000))
-		return ParseGp6000(m);
-	if (boost::regex_search(line, m, re::chameleon))
-		return ParseChameleon(m);
-	if (boost::regex_search(line, m, re::os2))
-		return ParseOs2(m);
-	if (boost::regex_search(line, m, re::os7))
-		return ParseOs7(m);
-	if (boost::regex_search(line, m, re::os9))
-		return ParseOs9(m);
-	if (boost::regex_search(line, m, re::allied))
-		return ParseAllied(m);
-	if (boost::regex_search(line, m, re::ibm))
-		return ParseIbm(m);
-	if (boost::regex_search(line, m, re::shibasoku))
-		return ParseShibasoku(m);
-	if (boost::regex_search(line, m, re::stratus))
-		return ParseStratus(m);
-	if (boost::regex_search(line, m, re::vms))
-		return ParseVms(m);
-	if (boost::regex_search(line, m, re::irmx))
-		return ParseIrmx(m);
-	if (boost::regex_search(line, m, re::tandem)) {
+	DialectMatch match;
+	auto const selected = filelistdialect::select(size_as<int>(dialects), dialect, [&line, &match](int i) { return TestDialect(i, line, match); }, EarlierDialects(dialect));
+	if (selected < 0)
+		return {};
+	if (matched)
+		*matched = selected;
+	std::optional<FILELIST> result;
+	ParseDialect(selected, match, result);
+	return result;
+}
+
+// 他の行の解析結果に影響しない形式か
+//   STRATUSは直前の行のファイル種別を引き継ぎ、TANDEMはOSSモードを切り替える
+static bool IsIndependentDialect(int dialect) {
+	return dialects[dialect].re != &re::stratus && dialects[dialect].re != &re::tandem;
+}
+
+// 他の行と並列に１行を解析する
+//   Parse()と同じ順に形式を試し、他の行に影響する形式に一致する場合はfalseを返す
+static bool ParseIndependent(std::string const& line, int dialect, std::optional<FILELIST>& result) {
+	assert(IsIndependentDialect(dialect));
+	DialectMatch match;
+	auto const selected = filelistdialect::select(size_as<int>(dialects), dialect, [&line, &match](int i) { return TestDialect(i, line, match); }, EarlierDialects(dialect));
+	if (selected < 0)
+		return true;
+	if (!IsIndependentDialect(selected))
+		return false;
+	ParseDialect(selected, match, result);
+	return true;
+}
+
+// 並列に解析するスレッド数の上限
+static size_t ListWorkers() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// 行を分割して並列に処理し、分割した順に結果を返す
+//   スレッド数はListWorkers()までとし、各スレッドが未処理の範囲を順に取り出す
+//   呼び出し元のスレッドも処理に加わるため、行数が少ない場合はスレッドを作らない
+template<class Lines, class Func>
+static auto ForEachChunk(Lines& lines, Func const& func) {
+	using Result = decltype(func(begin(lines), end(lines)));
+	auto const count = (size(lines) + LIST_CHUNK_LINES - 1) / LIST_CHUNK_LINES;
+	std::vector<std::conditional_t<std::is_void_v<Result>, char, Result>> results(count);
+	std::atomic<size_t> next = 0;
+	auto worker = [&] {
+		for (size_t i; (i = next++) < count;) {
+			auto const first = begin(lines) + i * LIST_CHUNK_LINES, last = first + std::min<size_t>(LIST_CHUNK_LINES, size(lines) - i * LIST_CHUNK_LINES);
+			if constexpr (std::is_void_v<Result>)
+				func(first, last);
+			else
+				results[i] = func(first, last);
+		}
+	};
+	std::vector<std::future<void>> workers;
+	for (size_t i = 1; i < std::min(ListWorkers(), count); i++)
+		workers.push_back(std::async(std::launch::async, worker));
+	worker();
+	for (auto& w : workers)
+		w.get();
+	return results;
+}
+
+ListParser::ListParser() : dialect{ CurHost.CurListDialect }, votes(std::size(dialects)) {
 #if defined(HAVE_TANDEM)
-		SetOSS(NO);
+	// TANDEMでは行ごとにOSSモードを切り替えるため順番に解析する
+	parallel = AskRealHostType() != HTYPE_TANDEM;
+#else
+	parallel = true;
 #endif
-		return ParseTandem(m);
-	}
-	return {};
 }
 
-// ファイル一覧情報の１行を取得
-static std::optional<std::vector<std::variant<FILELIST, std::string>>> GetListLine(int Num) {
-	std::ifstream is{ MakeCacheFileName(Num), std::ios::binary };
-	if (!is)
-		return {};
-	std::vector<std::variant<FILELIST, std::string>> lines;
-	for (std::string line; getline(is, line);) {
-		if (DebugConsole == YES) {
-			static const boost::regex re{ R"([^\x20-\x7E]|%)" };
-			DoPrintf("%s", replace<char>(line, re, [](auto& m) {
-				char percent[4];
-				sprintf(percent, "%%%02X", static_cast<unsigned char>(*m[0].begin()));
-				return std::string(percent);
-			}).c_str());
+// 受信したデータを行に分割して解析する
+void ListParser::Write(std::string_view data) {
+	for (size_t pos; (pos = data.find('\n')) != std::string_view::npos; data.remove_prefix(pos + 1)) {
+		rest.append(data, 0, pos);
+		Add(std::move(rest));
+		rest.clear();
+	}
+	rest += data;
+}
+
+// １行を解析
+//   先頭の数行は全形式を試して形式を判別し、以降は判別した形式を優先する
+void ListParser::Add(std::string line) {
+	if (DebugConsole == YES) {
+		static const boost::regex re{ R"([^\x20-\x7E]|%)" };
+		DoPrintf("%s", replace<char>(line, re, [](auto& m) {
+			char percent[4];
+			sprintf(percent, "%%%02X", static_cast<unsigned char>(*m[0].begin()));
+			return std::string(percent);
+		}).c_str());
+	}
+	line.erase(std::remove(begin(line), end(line), '\r'), end(line));
+	std::replace(begin(line), end(line), '\b', ' ');
+	if (detected && parallel && IsIndependentDialect(dialect)) {
+		pending.push_back(std::move(line));
+		if (size(pending) == LIST_CHUNK_LINES) {
+			// 解析中のまとまりがスレッド数の上限に達したら、先頭のまとまりを待って追加してから次を始める
+			if (size(chunks) == ListWorkers()) {
+				Merge(chunks.front().get());
+				chunks.pop_front();
+			}
+			chunks.push_back(std::async(std::launch::async, ParseChunk, std::move(pending), dialect));
+			pending.clear();
 		}
-		line.erase(std::remove(begin(line), end(line), '\r'), end(line));
-		std::replace(begin(line), end(line), '\b', ' ');
-		if (auto result = Parse(line))
-			lines.push_back(*result);
+		return;
+	}
+	std::optional<FILELIST> result;
+	if (detected)
+		result = Parse(line, dialect);
+	else {
+		int matched = LIST_DIALECT_UNKNOWN;
+		result = Parse(line, dialect, &matched);
+		if (matched != LIST_DIALECT_UNKNOWN) {
+			// 前回の形式が先頭の行に一致すればそのまま使う
+			if (samples == 0 && matched == dialect)
+				detected = true;
+			else {
+				dialect = LIST_DIALECT_UNKNOWN;
+				votes[matched]++;
+				if (++samples == LIST_DIALECT_SAMPLES)
+					Detect();
+			}
+		}
+	}
+	if (result)
+		lines.push_back(*result);
+	else
+		lines.push_back(std::move(line));
+}
+
+// 最も多くの行に一致した形式を採用する
+void ListParser::Detect() {
+	dialect = static_cast<int>(std::max_element(begin(votes), end(votes)) - begin(votes));
+	detected = true;
+}
+
+// まとめた行を解析する
+//   他の行に影響する形式に一致した行はそのまま残し、Merge()で順番に解析する
+ListParser::Chunk ListParser::ParseChunk(std::vector<std::string> const& source, int dialect) {
+	Chunk chunk;
+	chunk.lines.reserve(size(source));
+	for (auto& line : source)
+		if (std::optional<FILELIST> result; !ParseIndependent(line, dialect, result)) {
+			chunk.deferred.push_back(size(chunk.lines));
+			chunk.lines.emplace_back(line);
+		} else if (result)
+			chunk.lines.emplace_back(*result);
 		else
-			lines.push_back(line);
+			chunk.lines.emplace_back(line);
+	return chunk;
+}
+
+// 解析済みの行を元の順に追加する
+void ListParser::Merge(Chunk&& chunk) {
+	for (auto i : chunk.deferred)
+		if (auto result = Parse(std::get<std::string>(chunk.lines[i]), dialect))
+			chunk.lines[i] = *result;
+	lines.insert(end(lines), std::make_move_iterator(begin(chunk.lines)), std::make_move_iterator(end(chunk.lines)));
+}
+
+// 残りの行を解析し、ファイル名の漢字コードを変換する
+std::vector<std::variant<FILELIST, std::string>> ListParser::Finish() {
+	if (!empty(rest)) {
+		Add(std::move(rest));
+		rest.clear();
+	}
+	if (!detected && 0 < samples)
+		Detect();
+	if (detected)
+		CurHost.CurListDialect = dialect;
+	for (auto& chunk : chunks)
+		Merge(chunk.get());
+	chunks.clear();
+	if (!empty(pending)) {
+		Merge(ParseChunk(pending, dialect));
+		pending.clear();
 	}
 	if (CurHost.NameKanjiCode == KANJI_AUTO) {
 		CodeDetector cd;
-		for (auto& line : lines)
-			std::visit([&cd](auto&& arg) {
-				if constexpr (std::is_same_v<std::decay_t<decltype(arg)>, FILELIST>)
-					if (arg.Node != NODE_NONE && 0 < strlen(arg.File))
-						cd.Test(arg.File);
-			}, line);
+		for (auto& partial : ForEachChunk(lines, [](auto first, auto last) {
+			CodeDetector cd;
+			for (; first != last; ++first)
+				std::visit([&cd](auto&& arg) {
+					if constexpr (std::is_same_v<std::decay_t<decltype(arg)>, FILELIST>)
+						if (arg.Node != NODE_NONE && 0 < strlen(arg.File))
+							cd.Test(arg.File);
+				}, *first);
+			return cd;
+		}))
+			cd += partial;
 		CurHost.CurNameKanjiCode = cd.result();
 	} else
 		CurHost.CurNameKanjiCode = CurHost.NameKanjiCode;
-	for (auto& line : lines)
-		std::visit([](auto&& arg) {
-			if constexpr (std::is_same_v<std::decay_t<decltype(arg)>, FILELIST>)
-				if (arg.Node != NODE_NONE && 0 < strlen(arg.File)) {
-					auto file = ConvertFrom(arg.File, CurHost.CurNameKanjiCode);
-					if (auto last = file.back(); last == '/' || last == '\\')
-						file.resize(file.size() - 1);
-					if (empty(file) || file == "."sv || file == ".."sv)
-						arg.Node = NODE_NONE;
-					strcpy(arg.File, file.c_str());
-				}
-		}, line);
-	return lines;
+	ForEachChunk(lines, [kanji = CurHost.CurNameKanjiCode](auto first, auto last) {
+		for (; first != last; ++first)
+			std::visit([kanji](auto&& arg) {
+				if constexpr (std::is_same_v<std::decay_t<decltype(arg)>, FILELIST>)
+					if (arg.Node != NODE_NONE && 0 < strlen(arg.File)) {
+						auto file = ConvertFrom(arg.File, kanji);
+						if (auto back = file.back(); back == '/' || back == '\\')
+							file.resize(file.size() - 1);
+						if (empty(file) || file == "."sv || file == ".."sv)
+							arg.Node = NODE_NONE;
+						strcpy(arg.File, file.c_str());
+					}
+			}, *first);
+	});
+	return std::move(lines);
+}
+
+// キャッシュファイルの内容をそのまま読み込む
+static std::string ReadListFile(int Num) {
+	std::ifstream is{ MakeCacheFileName(Num), std::ios::binary };
+	return { std::istreambuf_iterator<char>{ is }, {} };
+}
+
+// キャッシュファイルのファイル一覧を解析
+static bool GetListLine(int Num, ListParser& parser) {
+	std::ifstream is{ MakeCacheFileName(Num), std::ios::binary };
+	if (!is)
+		return false;
+	for (char buffer[8192]; is.read(buffer, std::size(buffer)), 0 < is.gcount();)
+		parser.Write({ buffer, static_cast<size_t>(is.gcount()) });
+	return true;
 }
 
 
@@ -2443,7 +2794,7 @@ static int MakeDirPath(const char *Str, const char *Path, char *Dir)
 
 
 // ローカル側のサブディレクトリ以下のファイルをリストに登録する
-static bool MakeLocalTree(const char* Path, std::vector<FILELIST>& Base) {
+static bool MakeLocalTree(const char* Path, FileList& Base) {
 	auto const path = fs::u8path(Path);
 	std::vector<WIN32_FIND_DATAW> items;
 	if (!FindFile(path / L"*", [&items](auto const& item) { items.push_back(item); return true; }))
@@ -2489,14 +2840,14 @@ static bool MakeLocalTree(const char* Path, std::vector<FILELIST>& Base) {
 *		なし
 *----------------------------------------------------------------------------*/
 
-static void AddFileList(FILELIST const& Pkt, std::vector<FILELIST>& Base) {
+static void AddFileList(FILELIST const& Pkt, FileList& Base) {
 	DoPrintf("FileList : NODE=%d : %s", Pkt.Node, Pkt.File);
 	/* リストの重複を取り除く */
-	if (std::any_of(begin(Base), end(Base), [name = Pkt.File](auto const& f) { return strcmp(name, f.File) == 0; })) {
+	if (Base.contains(Pkt.File)) {
 		DoPrintf(L" --> Duplicate!!");
 		return;
 	}
-	Base.emplace_back(Pkt);
+	Base.push_back(Pkt);
 }
 
 
@@ -2512,23 +2863,56 @@ static void AddFileList(FILELIST const& Pkt, std::vector<FILELIST>& Base) {
 *			NULL=見つからない
 *----------------------------------------------------------------------------*/
 
-const FILELIST* SearchFileList(const char* Fname, std::vector<FILELIST> const& Base, int Caps) {
-	for (auto p = data(Base), end = data(Base) + size(Base); p != end; ++p)
-		if (Caps == COMP_STRICT) {
-			if (strcmp(Fname, p->File) == 0)
-				return p;
-		} else {
-			if (_stricmp(Fname, p->File) == 0) {
-				if (Caps == COMP_IGNORE)
-					return p;
-				char Tmp[FMAX_PATH + 1];
-				strcpy(Tmp, p->File);
-				_strlwr(Tmp);
-				if (strcmp(Tmp, p->File) == 0)
-					return p;
-			}
-		}
-	return nullptr;
+const FileList::Entry* SearchFileList(const char* Fname, FileList const& Base, int Caps) {
+	return Base.find(Fname, Caps);
+}
+
+
+FileList::FileList() : arena{ std::make_shared<filelistarena>() }, index{ std::make_shared<filelistindex>() } {}
+
+FileList::FileList(FileList const& other) : arena{ other.arena }, entries{ other.entries }, index{ std::make_shared<filelistindex>(*other.index) } {}
+
+FileList& FileList::operator=(FileList const& other) {
+	if (this != &other) {
+		arena = other.arena;
+		entries = other.entries;
+		index = std::make_shared<filelistindex>(*other.index);
+	}
+	return *this;
+}
+
+// ファイル情報を追加する
+//   ファイル名は領域に格納し、オーナ名は同じものを共有する
+void FileList::push_back(FILELIST const& file) {
+	auto const name = arena->store(file.File);
+	index->add(name, size(entries));
+	entries.push_back({ name, arena->intern(file.Owner), file.Size, file.Time, file.Attr, file.Node, file.Link, file.InfoExist });
+}
+
+bool FileList::contains(std::string_view file) const {
+	return index->contains(file);
+}
+
+// ファイル名で検索する
+//   COMP_STRICT     : 完全に一致するもの
+//   COMP_IGNORE     : 大文字/小文字を区別せずに一致するもの
+//   COMP_LOWERMATCH : 大文字/小文字を区別せずに一致し、かつ全て小文字のもの（＝小文字にした名前と完全に一致するもの）
+//   いずれも一致するものが複数ある場合は最初に登録したものを返す
+const FileList::Entry* FileList::find(std::string_view file, int Caps) const {
+	auto pos = filelistindex::npos;
+	if (Caps == COMP_STRICT)
+		pos = index->find(file);
+	else if (Caps == COMP_IGNORE)
+		pos = index->findfolded(file, size(entries), [this](size_t i) { return std::string_view{ entries[i].File }; });
+	else
+		pos = index->find(filelistindex::lower(file));
+	return pos == filelistindex::npos ? nullptr : &entries[pos];
+}
+
+void FileList::clear() {
+	entries.clear();
+	index->clear();
+	arena = std::make_shared<filelistarena>();
 }
 
 
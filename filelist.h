@@ -1,9 +1,19 @@
 // Copyright(C) 2020,2021 Kurata Sayuri. All rights reserved.
 #pragma once
+#include <array>
+#include <bitset>
+#include <memory>
+#include <optional>
+#include <string>
 #include <string_view>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 inline namespace {
 	using namespace std::literals;
@@ -117,4 +127,315 @@ inline namespace {
 			R"(^ *([^ ]+) +(?:O +)?([0-9]+) +([0-9]+) +(0?[1-9]|[12][0-9]|3[01])-(Jan|Feb|Mar|Apr|May|Jun|Jul|Aug|Sep|Oct|Nov|Dec)-((?:|1[6-9]?|[2-9][0-9])[0-9]{2}) +([01][0-9]|2[0-3]):([0-5][0-9]):([0-5][0-9]) +(.+?) +[^ ]+$)"sv, false
 		};
 	};
+
+	// K\gpmlsdAunixƓ͂s
+	// ʂ͐K\̃Tu}b`ƓԍɊi[AvȂO[v͋Ƃ
+	struct filelistscanner {
+		// sȂǂ̍s؂蕶܂ލs͐K\ŉ͂邱
+		static constexpr bool supported(std::string_view line) noexcept {
+			return line.find_first_of("\n\r\f"sv) == std::string_view::npos;
+		}
+
+		static std::optional<std::array<std::string_view, 3>> mlsd(std::string_view line) noexcept {
+			auto const size = line.size();
+			// [^ ;=]+=[^ ;]+ ̏I[
+			auto fact = [&](size_t i) {
+				auto j = i;
+				while (j < size && line[j] != ' ' && line[j] != ';' && line[j] != '=')
+					j++;
+				if (j == i || j == size || line[j] != '=')
+					return std::string_view::npos;
+				auto k = ++j;
+				while (k < size && line[k] != ' ' && line[k] != ';')
+					k++;
+				return k == j ? std::string_view::npos : k;
+			};
+			for (size_t start = 0; start < size; start = line.find(';', start + 1)) {
+				// factšJԂ͍ŒvȂ̂ōŌɋ؂𖞂fact̗p
+				size_t factsEnd = std::string_view::npos, nameBegin = 0;
+				for (auto i = start == 0 && line[0] != ';' ? 0 : start + 1;;) {
+					auto end = fact(i);
+					if (end == std::string_view::npos)
+						break;
+					// (?:;? |;(?=[^ ]+$))(.+)$
+					if (end + 2 < size && line[end] == ';' && line[end + 1] == ' ')
+						factsEnd = end, nameBegin = end + 2;
+					else if (end + 1 < size && line[end] == ' ')
+						factsEnd = end, nameBegin = end + 1;
+					else if (end + 1 < size && line[end] == ';' && line.find(' ', end + 1) == std::string_view::npos)
+						factsEnd = end, nameBegin = end + 1;
+					if (end == size || line[end] != ';')
+						break;
+					i = end + 1;
+				}
+				if (factsEnd != std::string_view::npos)
+					return std::array{ line.substr(start), line.substr(start, factsEnd - start), line.substr(nameBegin) };
+			}
+			return {};
+		}
+
+		static std::optional<std::array<std::string_view, 14>> unix(std::string_view line) noexcept {
+			auto const size = line.size();
+			auto ch = [&](size_t i) -> int { return i < size ? static_cast<unsigned char>(line[i]) : -1; };
+			auto digit = [](int c) { return '0' <= c && c <= '9'; };
+			auto spaces = [&](size_t i) { while (ch(i) == ' ') i++; return i; };
+			auto digits = [&](size_t i) { while (digit(ch(i))) i++; return i; };
+			auto others = [&](size_t i) { for (int c; (c = ch(i)) != -1 && c != ' ' && !digit(c);) i++; return i; };
+			// eľ𐳋K\̎snext֓n
+			auto year = [&](size_t i) {
+				return ((ch(i) == '1' && '6' <= ch(i + 1) && ch(i + 1) <= '9') || ('2' <= ch(i) && ch(i) <= '9' && digit(ch(i + 1)))) && digit(ch(i + 2)) && digit(ch(i + 3));
+			};
+			auto month = [&](size_t i, auto&& next) {
+				// ͉pȂ̂ŐŎn܂ꍇ͔rȂ@| 0x20ŉpɑ
+				if (i + 3 <= size && !digit(ch(i))) {
+					auto const c0 = ch(i) | 0x20, c1 = ch(i + 1) | 0x20, c2 = ch(i + 2) | 0x20;
+					for (auto name : { "jan"sv, "feb"sv, "mar"sv, "apr"sv, "may"sv, "jun"sv, "jul"sv, "aug"sv, "sep"sv, "oct"sv, "nov"sv, "dec"sv })
+						if (c0 == name[0] && c1 == name[1] && c2 == name[2])
+							return next(3);
+				}
+				return (ch(i) == '0' && '1' <= ch(i + 1) && ch(i + 1) <= '9' && next(2))
+					|| ('1' <= ch(i) && ch(i) <= '9' && next(1))
+					|| (ch(i) == '1' && '0' <= ch(i + 1) && ch(i + 1) <= '2' && next(2));
+			};
+			auto day = [&](size_t i, auto&& next) {
+				return (ch(i) == '0' && '1' <= ch(i + 1) && ch(i + 1) <= '9' && next(2))
+					|| ('1' <= ch(i) && ch(i) <= '9' && next(1))
+					|| ((ch(i) == '1' || ch(i) == '2') && digit(ch(i + 1)) && next(2))
+					|| (ch(i) == '3' && (ch(i + 1) == '0' || ch(i + 1) == '1') && next(2));
+			};
+			auto hour = [&](size_t i, auto&& next) {
+				return ((ch(i) == '0' || ch(i) == '1') && digit(ch(i + 1)) && next(2))
+					|| (digit(ch(i)) && next(1))
+					|| (ch(i) == '2' && '0' <= ch(i + 1) && ch(i + 1) <= '3' && next(2));
+			};
+			auto minute = [&](size_t i, auto&& next) {
+				return ('0' <= ch(i) && ch(i) <= '5' && digit(ch(i + 1)) && next(2))
+					|| (digit(ch(i)) && next(1));
+			};
+			std::array<std::string_view, 14> m;
+			// t@C
+			auto name = [&](size_t i) {
+				auto j = spaces(i);
+				if (j == i || size <= j)
+					return false;
+				m[13] = line.substr(j);
+				return true;
+			};
+			// (AA(N|A)|NAA(?!N)(?!A))At@C
+			auto date = [&](size_t i) {
+				if (month(i, [&](size_t ml) {
+					auto j = spaces(others(i + ml));
+					return day(j, [&](size_t dl) {
+						auto k0 = others(j + dl), k = spaces(k0);
+						if (k == k0)
+							return false;
+						if (year(k) && name(others(k + 4))) {
+							m[5] = line.substr(i, ml), m[6] = line.substr(j, dl), m[7] = line.substr(k, 4);
+							return true;
+						}
+						return hour(k, [&](size_t hl) {
+							auto l = others(k + hl);
+							if (l == k + hl)
+								return false;
+							return minute(l, [&](size_t nl) {
+								if (!name(others(l + nl)))
+									return false;
+								m[5] = line.substr(i, ml), m[6] = line.substr(j, dl), m[8] = line.substr(k, hl), m[9] = line.substr(l, nl);
+								return true;
+							});
+						});
+					});
+				}))
+					return true;
+				if (!year(i))
+					return false;
+				auto j0 = others(i + 4), j = spaces(j0);
+				return j != j0 && month(j, [&](size_t ml) {
+					auto k0 = others(j + ml), k = spaces(k0);
+					return k != k0 && day(k, [&](size_t dl) {
+						auto end = others(k + dl), l = spaces(end);
+						if (l != end) {
+							if (year(l) && ch(others(l + 4)) == ' ')
+								return false;
+							if (hour(l, [&](size_t hl) {
+								auto n = others(l + hl);
+								return n != l + hl && minute(n, [&](size_t nl) { return ch(others(n + nl)) == ' '; });
+							}))
+								return false;
+						}
+						if (!name(end))
+							return false;
+						m[10] = line.substr(i, 4), m[11] = line.substr(j, ml), m[12] = line.substr(k, dl);
+						return true;
+					});
+				});
+			};
+			auto i = spaces(0);
+			if (auto c = ch(i); c != '-' && c != '+' && c != 'd' && c != 'D' && c != 'f' && c != 'F' && c != 'l' && c != 'L')
+				return {};
+			for (size_t j = 1; j <= 9; j++)
+				if (auto c = ch(i + j); c == -1 || c == ' ')
+					return {};
+			m[1] = line.substr(i, 1), m[2] = line.substr(i + 1, 9);
+			auto p = i + 10;
+			if (ch(p) == '.' || ch(p) == '+')
+				p++;
+			// N A󔒂ƐAȂ ̏Ɏ
+			size_t links[3];
+			int count = 0;
+			if (digit(ch(p)))
+				links[count++] = digits(p);
+			if (auto q = spaces(p); q != p && digit(ch(q)))
+				links[count++] = digits(q);
+			links[count++] = p;
+			for (int l = 0; l < count; l++) {
+				auto ownerBegin = spaces(links[l]), ownerEnd = ownerBegin;
+				if (ownerBegin == links[l])
+					continue;
+				while (ch(ownerEnd) != -1 && ch(ownerEnd) != ' ')
+					ownerEnd++;
+				auto rest = spaces(ownerEnd);
+				if (ownerEnd == ownerBegin || rest == ownerEnd)
+					continue;
+				// TCY͍ŒZv̂ߍ珇Ɏ
+				for (auto sizeBegin = rest; sizeBegin < size; sizeBegin++) {
+					if (!digit(ch(sizeBegin)) || (rest < sizeBegin && digit(ch(sizeBegin - 1))))
+						continue;
+					auto sizeEnd = digits(sizeBegin), dateBegin = spaces(sizeEnd);
+					if (dateBegin != sizeEnd && date(dateBegin)) {
+						m[0] = line.substr(0);
+						m[3] = line.substr(ownerBegin, ownerEnd - ownerBegin);
+						m[4] = line.substr(sizeBegin, sizeEnd - sizeBegin);
+						return m;
+					}
+				}
+			}
+			return {};
+		}
+	};
 }
+
+
+// t@CXg̕i[̈
+//   ubNPʂŊmۂċl߂Ċi[邽߁Ai[̃AhX͕ςȂ
+struct filelistarena {
+	static constexpr size_t blocksize = 64 * 1024;
+	std::vector<std::unique_ptr<char[]>> blocks;
+	std::unordered_set<std::string_view> interned;
+	char* current = nullptr;		// gp̃ubN̋󂫗̈
+	size_t rest = 0;				// gp̃ubN̎coCg
+	size_t allocated = 0;			// mۂoCg
+	char* allocate(size_t size) {
+		allocated += size;
+		return blocks.emplace_back(new char[size]).get();
+	}
+	const char* store(std::string_view str) {
+		auto const length = str.size() + 1;
+		char* p;
+		if (blocksize / 4 < length)
+			// ͐p̃ubNɊi[Agp̃ubN͎g
+			p = allocate(length);
+		else {
+			if (rest < length) {
+				current = allocate(blocksize);
+				rest = blocksize;
+			}
+			p = current;
+			current += length;
+			rest -= length;
+		}
+		memcpy(p, str.data(), str.size());
+		p[str.size()] = '\0';
+		return p;
+	}
+	// ͂Pi[
+	const char* intern(std::string_view str) {
+		if (auto it = interned.find(str); it != interned.end())
+			return it->data();
+		auto p = store(str);
+		interned.emplace(p, str.size());
+		return p;
+	}
+};
+
+
+// t@CXǧp̍
+//   啶/ʂȂ͍ŏɌƂɍ쐬Aȍ~͒ǉꂽo^
+struct filelistindex {
+	static constexpr size_t npos = size_t(-1);
+	std::unordered_map<std::string_view, size_t> exact;		// t@C  ŏ̈ʒu
+	std::unordered_map<std::string, size_t> folded;			// ɂt@C  ŏ̈ʒu
+	size_t foldedcount = 0;									// foldedɓo^ς݂̍ڐ
+	// _strlwrA_stricmpƓASCII͈̔͂ɂ
+	static std::string lower(std::string_view str) {
+		std::string result{ str };
+		for (auto& ch : result)
+			if ('A' <= ch && ch <= 'Z')
+				ch += 'a' - 'A';
+		return result;
+	}
+	void add(std::string_view name, size_t pos) {
+		exact.try_emplace(name, pos);
+	}
+	bool contains(std::string_view name) const {
+		return exact.contains(name);
+	}
+	size_t find(std::string_view name) const {
+		auto it = exact.find(name);
+		return it == exact.end() ? npos : it->second;
+	}
+	template<class Names>
+	size_t findfolded(std::string_view name, size_t count, Names&& names) {
+		for (; foldedcount < count; foldedcount++)
+			folded.try_emplace(lower(names(foldedcount)), foldedcount);
+		auto it = folded.find(lower(name));
+		return it == folded.end() ? npos : it->second;
+	}
+	void clear() {
+		exact.clear();
+		folded.clear();
+		foldedcount = 0;
+	}
+};
+
+
+// t@Cꗗ̌`̑I
+//   `͗D揇ɕׁǍ`Ɉvs͍łD悷`Ƃ
+struct filelistdialect {
+	// sɈv`Ԃ@vȂ-1
+	//   detected͔ʍς݂̌`@vĂD悷`ɈvȂƂm߂
+	//   earlierdetectedD悷`̂sɈv́ioverlaps()̌ʁjŁAȊO͎Ȃ
+	//   test͈v邩𒲂ׁAvʈȊO̕pȂƁ@Ԃ`͍ŌɈvtesť`ƂȂ
+	template<class Test>
+	static int select(int count, int detected, Test&& test, uint64_t earlier = ~uint64_t{}) {
+		if (0 <= detected && test(detected)) {
+			for (int i = 0; i < detected; i++)
+				if ((earlier >> i & 1) && test(i))
+					return i;
+			return detected;
+		}
+		for (int i = 0; i < count; i++)
+			if (i != detected && test(i))
+				return i;
+		return -1;
+	}
+
+	// `ƂɁAsɈvD悷`̏W߂
+	//   leading(i, ch)͌`iɈvs̐擪̋󔒈ȊO̕chł肤邩@ȂꍇtrueԂ
+	//   擪̋󔒈ȊO̕ǂɂvȂQ̌`͏dȂȂ
+	template<class Leading>
+	static std::vector<uint64_t> overlaps(int count, Leading&& leading) {
+		assert(count <= 64);
+		std::vector<std::bitset<256>> first(count);
+		for (int i = 0; i < count; i++)
+			for (int ch = 0; ch < 256; ch++)
+				if (ch != ' ' && leading(i, (char)ch))
+					first[i].set(ch);
+		std::vector<uint64_t> result(count);
+		for (int i = 0; i < count; i++)
+			for (int j = 0; j < i; j++)
+				if ((first[i] & first[j]).any())
+					result[i] |= uint64_t{ 1 } << j;
+		return result;
+	}
+};
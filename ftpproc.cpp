@@ -32,19 +32,19 @@
 
 /*===== プロトタイプ =====*/
 
-static int CheckRemoteFile(TRANSPACKET *Pkt, std::vector<FILELIST> const& ListList);
-static void DispMirrorFiles(std::vector<FILELIST> const& Local, std::vector<FILELIST> const& Remote);
-static void MirrorDeleteAllLocalDir(std::vector<FILELIST> const& Local, TRANSPACKET& item, std::forward_list<TRANSPACKET>& list);
+static int CheckRemoteFile(TRANSPACKET *Pkt, FileList const& ListList);
+static void DispMirrorFiles(FileList const& Local, FileList const& Remote);
+static void MirrorDeleteAllLocalDir(FileList const& Local, TRANSPACKET& item, std::forward_list<TRANSPACKET>& list);
 static int CheckLocalFile(TRANSPACKET *Pkt);
 static void RemoveAfterSemicolon(char *Path);
-static void MirrorDeleteAllDir(std::vector<FILELIST> const& Remote, TRANSPACKET& item, std::forward_list<TRANSPACKET>& list);
+static void MirrorDeleteAllDir(FileList const& Remote, TRANSPACKET& item, std::forward_list<TRANSPACKET>& list);
 static int MirrorNotify(bool upload);
 static void CountMirrorFiles(HWND hDlg, std::forward_list<TRANSPACKET> const& list);
 static int AskMirrorNoTrn(char *Fname, int Mode);
 static int AskUploadFileAttr(char *Fname);
 static bool UpDownAsDialog(int win);
-static void DeleteAllDir(std::vector<FILELIST> const& Dt, int Win, int *Sw, int *Flg, char *CurDir);
-static void DelNotifyAndDo(FILELIST const& Dt, int Win, int *Sw, int *Flg, char *CurDir);
+static void DeleteAllDir(FileList const& Dt, int Win, int *Sw, int *Flg, char *CurDir);
+static void DelNotifyAndDo(FileList::Entry const& Dt, int Win, int *Sw, int *Flg, char *CurDir);
 static void SetAttrToDialog(HWND hWnd, int Attr);
 static int GetAttrFromDialog(HWND hDlg);
 static std::wstring RenameUnuseableName(std::wstring&& filename);
@@ -77,6 +77,7 @@ static char TmpString[FMAX_PATH+80];		/* テンポラリ */
 int UpExistMode = EXIST_OVW;		/* アップロードで同じ名前のファイルがある時の扱い方 EXIST_xxx */
 int ExistMode = EXIST_OVW;		/* 同じ名前のファイルがある時の扱い方 EXIST_xxx */
 static int ExistNotify;		/* 確認ダイアログを出すかどうか YES/NO */
+static std::vector<std::string> DeleteQueue;		/* まとめて削除するリモートのファイル */
 
 
 /*----- ファイル一覧で指定されたファイルをダウンロードする --------------------
@@ -144,7 +145,7 @@ void DownloadProc(int ChName, int ForceFile, int All)
 
 		ExistNotify = YES;
 
-		std::vector<FILELIST> FileListBase;
+		FileList FileListBase;
 		ListSts = MakeSelectedFileList(WIN_REMOTE, ForceFile == YES ? NO : YES, All, FileListBase, &CancelFlg);
 
 		if(AskNoFullPathMode() == YES)
@@ -472,9 +473,9 @@ void MirrorDownloadProc(int Notify)
 		{
 			/*===== ファイルリスト取得 =====*/
 
-			std::vector<FILELIST> LocalListBase;
+			FileList LocalListBase;
 			ListSts = MakeSelectedFileList(WIN_LOCAL, YES, YES, LocalListBase, &CancelFlg);
-			std::vector<FILELIST> RemoteListBase;
+			FileList RemoteListBase;
 			if(ListSts == FFFTP_SUCCESS)
 				ListSts = MakeSelectedFileList(WIN_REMOTE, YES, YES, RemoteListBase, &CancelFlg);
 
@@ -638,7 +639,7 @@ void MirrorDownloadProc(int Notify)
 *		なし
 *----------------------------------------------------------------------------*/
 
-static void DispMirrorFiles(std::vector<FILELIST> const& Local, std::vector<FILELIST> const& Remote)
+static void DispMirrorFiles(FileList const& Local, FileList const& Remote)
 {
 	char Date[80];
 	SYSTEMTIME sTime;
@@ -670,7 +671,7 @@ static void DispMirrorFiles(std::vector<FILELIST> const& Local, std::vector<FILE
 
 
 // ミラーリング時のローカル側のフォルダ削除
-static void MirrorDeleteAllLocalDir(std::vector<FILELIST> const& Local, TRANSPACKET& item, std::forward_list<TRANSPACKET>& list) {
+static void MirrorDeleteAllLocalDir(FileList const& Local, TRANSPACKET& item, std::forward_list<TRANSPACKET>& list) {
 	for (auto it = rbegin(Local); it != rend(Local); ++it)
 		if (it->Node == NODE_DIR && it->Attr == YES) {
 			strcpy(item.LocalFile, (AskLocalCurDir() / fs::u8path(it->File)).u8string().c_str());
@@ -919,12 +920,12 @@ void UploadListProc(int ChName, int All)
 		DisableUserOpe();
 
 		// ローカル側で選ばれているファイルをFileListBaseに登録
-		std::vector<FILELIST> FileListBase;
+		FileList FileListBase;
 		ListSts = MakeSelectedFileList(WIN_LOCAL, YES, All, FileListBase, &CancelFlg);
 
 		// 現在ホスト側のファイル一覧に表示されているものをRemoteListに登録
 		// 同名ファイルチェック用
-		std::vector<FILELIST> RemoteList;
+		FileList RemoteList;
 		AddRemoteTreeToFileList(0, "", RDIR_NONE, RemoteList);
 
 		FirstAdd = YES;
@@ -1003,8 +1004,8 @@ void UploadListProc(int ChName, int All)
 				strcpy(Tmp, u8(AskRemoteCurDir()).c_str());
 				if(DoCWD(Pkt.RemoteFile, NO, NO, NO) == FTP_COMPLETE)
 				{
-					if(DoDirListCmdSkt("", "", 998, &CancelFlg) == FTP_COMPLETE)
-						AddRemoteTreeToFileList(998, "", RDIR_NONE, RemoteList);
+					if(ListParser parser; DoDirListCmdSkt("", "", -1, &CancelFlg, &parser) == FTP_COMPLETE)
+						AddRemoteTreeToFileList(parser, "", RDIR_NONE, RemoteList);
 					DoCWD(Tmp, NO, NO, NO);
 				}
 				else
@@ -1112,12 +1113,12 @@ void UploadDragProc(WPARAM wParam)
 		DisableUserOpe();
 
 		// ローカル側で選ばれているファイルをFileListBaseに登録
-		std::vector<FILELIST> FileListBase;
+		FileList FileListBase;
 		MakeDroppedFileList(wParam, Cur, FileListBase);
 
 		// 現在ホスト側のファイル一覧に表示されているものをRemoteListに登録
 		// 同名ファイルチェック用
-		std::vector<FILELIST> RemoteList;
+		FileList RemoteList;
 		AddRemoteTreeToFileList(0, "", RDIR_NONE, RemoteList);
 
 		FirstAdd = YES;
@@ -1164,8 +1165,8 @@ void UploadDragProc(WPARAM wParam)
 				strcpy(Tmp, u8(AskRemoteCurDir()).c_str());
 				if(DoCWD(Pkt.RemoteFile, NO, NO, NO) == FTP_COMPLETE)
 				{
-					if(DoDirListCmdSkt("", "", 998, &CancelFlg) == FTP_COMPLETE)
-						AddRemoteTreeToFileList(998, "", RDIR_NONE, RemoteList);
+					if(ListParser parser; DoDirListCmdSkt("", "", -1, &CancelFlg, &parser) == FTP_COMPLETE)
+						AddRemoteTreeToFileList(parser, "", RDIR_NONE, RemoteList);
 					DoCWD(Tmp, NO, NO, NO);
 				}
 				else
@@ -1287,9 +1288,9 @@ void MirrorUploadProc(int Notify)
 		{
 			/*===== ファイルリスト取得 =====*/
 
-			std::vector<FILELIST> LocalListBase;
+			FileList LocalListBase;
 			ListSts = MakeSelectedFileList(WIN_LOCAL, YES, YES, LocalListBase, &CancelFlg);
-			std::vector<FILELIST> RemoteListBase;
+			FileList RemoteListBase;
 			if(ListSts == FFFTP_SUCCESS)
 				ListSts = MakeSelectedFileList(WIN_REMOTE, YES, YES, RemoteListBase, &CancelFlg);
 
@@ -1475,7 +1476,7 @@ void MirrorUploadProc(int Notify)
 
 
 // ミラーリング時のホスト側のフォルダ削除
-static void MirrorDeleteAllDir(std::vector<FILELIST> const& Remote, TRANSPACKET& item, std::forward_list<TRANSPACKET>& list) {
+static void MirrorDeleteAllDir(FileList const& Remote, TRANSPACKET& item, std::forward_list<TRANSPACKET>& list) {
 	for (auto it = rbegin(Remote); it != rend(Remote); ++it)
 		if (it->Node == NODE_DIR && it->Attr == YES) {
 			strcpy(item.RemoteFile, u8(AskRemoteCurDir()).c_str());
@@ -1567,7 +1568,7 @@ static int AskUploadFileAttr(char* Fname) {
 *		Pkt.ExistSize, UpExistMode、ExistNotify が変更される
 *----------------------------------------------------------------------------*/
 
-static int CheckRemoteFile(TRANSPACKET *Pkt, std::vector<FILELIST> const& ListList) {
+static int CheckRemoteFile(TRANSPACKET *Pkt, FileList const& ListList) {
 	struct UpExistDialog {
 		using result_t = bool;
 		using UpExistButton = RadioButton<UP_EXIST_OVW, UP_EXIST_NEW, UP_EXIST_RESUME, UP_EXIST_UNIQUE, UP_EXIST_IGNORE, UP_EXIST_LARGE>;
@@ -1712,7 +1713,7 @@ void DeleteProc(void)
 		// デッドロック対策
 		DisableUserOpe();
 		strcpy(CurDir, u8(AskRemoteCurDir()).c_str());
-		std::vector<FILELIST> FileListBase;
+		FileList FileListBase;
 		if(Win == WIN_LOCAL)
 			MakeSelectedFileList(Win, NO, NO, FileListBase, &CancelFlg);
 		else
@@ -1727,6 +1728,12 @@ void DeleteProc(void)
 					break;
 			}
 		}
+		// フォルダの中のファイルを削除してからフォルダを削除する
+		if(!empty(DeleteQueue))
+		{
+			DoDELE(DeleteQueue);
+			DeleteQueue.clear();
+		}
 
 		if(Sts != NO_ALL)
 			DeleteAllDir(FileListBase, Win, &Sts, &DelFlg, CurDir);
@@ -1766,7 +1773,7 @@ void DeleteProc(void)
 *		なし
 *----------------------------------------------------------------------------*/
 
-static void DeleteAllDir(std::vector<FILELIST> const& Dt, int Win, int *Sw, int *Flg, char *CurDir) {
+static void DeleteAllDir(FileList const& Dt, int Win, int *Sw, int *Flg, char *CurDir) {
 	for (auto it = rbegin(Dt); it != rend(Dt); ++it)
 		if (it->Node == NODE_DIR) {
 			DelNotifyAndDo(*it, Win, Sw, Flg, CurDir);
@@ -1789,7 +1796,7 @@ static void DeleteAllDir(std::vector<FILELIST> const& Dt, int Win, int *Sw, int
 *		なし
 *----------------------------------------------------------------------------*/
 
-static void DelNotifyAndDo(FILELIST const& Dt, int Win, int *Sw, int *Flg, char *CurDir) {
+static void DelNotifyAndDo(FileList::Entry const& Dt, int Win, int *Sw, int *Flg, char *CurDir) {
 	struct DeleteDialog {
 		using result_t = int;
 		int win;
@@ -1859,7 +1866,10 @@ static void DelNotifyAndDo(FILELIST const& Dt, int Win, int *Sw, int *Flg, char
 
 			if(*Sw != NO_ALL)
 			{
-				if(Dt.Node == NODE_FILE)
+				// 全て削除する場合、フルパスのファイルは後でまとめて削除する
+				if(Dt.Node == NODE_FILE && *Sw == YES_ALL && AskNoFullPathMode() == NO)
+					DeleteQueue.push_back(Path);
+				else if(Dt.Node == NODE_FILE)
 					DoDELE(Path);
 				else
 					DoRMD(Path);
@@ -1929,7 +1939,7 @@ void RenameProc(void)
 	{
 		DisableUserOpe();
 
-		std::vector<FILELIST> FileListBase;
+		FileList FileListBase;
 		MakeSelectedFileList(Win, NO, NO, FileListBase, &CancelFlg);
 
 		RenFlg = NO;
@@ -2045,7 +2055,7 @@ void MoveRemoteFileProc(int drop_index)
 	{
 		DisableUserOpe();
 
-		std::vector<FILELIST> FileListBase;
+		FileList FileListBase;
 		MakeSelectedFileList(Win, NO, NO, FileListBase, &CancelFlg);
 
 		RenFlg = NO;
@@ -2281,14 +2291,12 @@ fs::path MakeDistinguishableFileName(fs::path&& path) {
 
 void ChmodProc(void)
 {
-	int ChmodFlg = NO;
-
 	if(GetFocus() == GetRemoteHwnd())
 	{
 		if(CheckClosedAndReconnect() == FFFTP_SUCCESS)
 		{
 			DisableUserOpe();
-			std::vector<FILELIST> FileListBase;
+			FileList FileListBase;
 			MakeSelectedFileList(WIN_REMOTE, NO, NO, FileListBase, &CancelFlg);
 			if(!empty(FileListBase))
 			{
@@ -2296,14 +2304,15 @@ void ChmodProc(void)
 				swprintf(attr, std::size(attr), L"%03X", FileListBase[0].Attr);
 				if(auto newattr = ChmodDialog(attr))
 				{
-					ChmodFlg = NO;
+					std::vector<std::string> Paths;
 					for (auto const& f : FileListBase)
-						if (f.Node == NODE_FILE || f.Node == NODE_DIR) {
-							DoCHMOD(f.File, u8(*newattr).c_str());
-							ChmodFlg = YES;
-						}
-					if(ChmodFlg == YES)
+						if (f.Node == NODE_FILE || f.Node == NODE_DIR)
+							Paths.push_back(f.File);
+					if(!empty(Paths))
+					{
+						DoCHMOD(Paths, u8(*newattr).c_str());
 						GetRemoteDirForWnd(CACHE_REFRESH, &CancelFlg);
+					}
 				}
 			}
 			EnableUserOpe();
@@ -2312,7 +2321,7 @@ void ChmodProc(void)
 	else if(GetFocus() == GetLocalHwnd())
 	{
 		DisableUserOpe();
-		std::vector<FILELIST> FileListBase;
+		FileList FileListBase;
 		MakeSelectedFileList(WIN_LOCAL, NO, NO, FileListBase, &CancelFlg);
 		if (!empty(FileListBase)) {
 			// ファイルのプロパティを表示する
@@ -2473,7 +2482,7 @@ void SomeCmdProc(void)
 		if(CheckClosedAndReconnect() == FFFTP_SUCCESS)
 		{
 			DisableUserOpe();
-			std::vector<FILELIST> FileListBase;
+			FileList FileListBase;
 			MakeSelectedFileList(WIN_REMOTE, NO, NO, FileListBase, &CancelFlg);
 			auto cmd = empty(FileListBase) ? L""s : u8(FileListBase[0].File);
 			if (InputDialog(somecmd_dlg, GetMainHwnd(), 0, cmd, 81, nullptr, IDH_HELP_TOPIC_0000023))
@@ -2531,7 +2540,7 @@ void CalcFileSizeProc() {
 	CancelFlg = NO;
 	if (auto All = Dialog(GetFtpInst(), filesize_notify_dlg, GetMainHwnd(), SizeNotify{ Win }); All != NO_ALL)
 		if (Win == WIN_LOCAL || CheckClosedAndReconnect() == FFFTP_SUCCESS) {
-			std::vector<FILELIST> ListBase;
+			FileList ListBase;
 			MakeSelectedFileList(Win, YES, All, ListBase, &CancelFlg);
 			double total = 0;
 			for (auto const& f : ListBase)
@@ -2552,7 +2561,7 @@ void DispCWDerror(HWND hWnd) {
 void CopyURLtoClipBoard() {
 	if (GetFocus() != GetRemoteHwnd())
 		return;
-	std::vector<FILELIST> FileListBase;
+	FileList FileListBase;
 	MakeSelectedFileList(WIN_REMOTE, NO, NO, FileListBase, &CancelFlg);
 	if (empty(FileListBase))
 		return;
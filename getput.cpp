@@ -51,6 +51,13 @@
 #undef SET_BUFFER_SIZE
 #endif
 
+#define WRITE_BUFFERS	16		/* ダウンロードの書き込み待ちバッファの数 */
+#define WRITE_RING_LIMIT	(64 * 1024 * 1024)	/* 全転送スレッドの書き込み待ちバッファの合計の上限 */
+#define MAX_SOCKBUF_SIZE	(16 * 1024 * 1024)	/* 自動調整時のソケットのバッファの上限 */
+#define MAX_APPBUF_SIZE		(1024 * 1024)		/* 自動調整時の送受信１回あたりのバッファの上限 */
+#define SEGMENT_MIN_SIZE	(8 * 1024 * 1024)	/* 分割ダウンロードの１範囲の最小サイズ */
+#define SCHEDULE_WINDOW		256		/* 転送の順序を入れ替える範囲のファイル数 */
+
 #define TIMER_DISPLAY		1		/* 表示更新用タイマのID */
 #define DISPLAY_TIMING		500		/* 表示更新時間 0.5秒 */
 
@@ -62,6 +69,8 @@
 static void DispTransPacket(TRANSPACKET const& item);
 static void EraseTransFileList();
 static unsigned __stdcall TransferThread(void *Dummy);
+static void ScheduleTransPacket();
+static void SplitDownload(std::forward_list<TRANSPACKET>::iterator Pos);
 static int MakeNonFullPath(TRANSPACKET& item, char *CurDir);
 static int DownloadNonPassive(TRANSPACKET *Pkt, int *CancelCheckWork);
 static int DownloadPassive(TRANSPACKET *Pkt, int *CancelCheckWork);
@@ -73,50 +82,48 @@ static int DoUpload(SOCKET cSkt, TRANSPACKET& item);
 static int UploadNonPassive(TRANSPACKET *Pkt);
 static int UploadPassive(TRANSPACKET *Pkt);
 static int UploadFile(TRANSPACKET *Pkt, SOCKET dSkt);
-static int TermCodeConvAndSend(SOCKET Skt, char *Data, int Size, int Ascii, int *CancelCheckWork);
 static void DispUploadFinishMsg(TRANSPACKET *Pkt, int iRetCode);
 static int SetUploadResume(TRANSPACKET *Pkt, int ProcMode, LONGLONG Size, int *Mode);
 static LRESULT CALLBACK TransDlgProc(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM lParam);
-static void DispTransferStatus(HWND hWnd, int End, TRANSPACKET *Pkt);
+static void DispTransferStatus(HWND hWnd);
+static void CloseTransDlg(int ThreadCount);
+static int GrowTransferThread(int Count);
 static void DispTransFileInfo(TRANSPACKET const& item, UINT titleId, int SkipButton, int Info);
 static int GetAdrsAndPort(SOCKET Skt, char *Str, char *Adrs, int *Port, int Max);
 static int IsSpecialDevice(const char* Fname);
 static int MirrorDelNotify(int Cur, int Notify, TRANSPACKET const& item);
+static void FlushChangedRemotePaths();
 
 /*===== ローカルなワーク =====*/
 
-// 同時接続対応
-//static HANDLE hTransferThread;
-static HANDLE hTransferThread[MAX_DATA_CONNECTION];
 static int fTransferThreadExit = FALSE;
 
-static HANDLE hRunMutex;				/* 転送スレッド実行ミューテックス */
 static HANDLE hListAccMutex;			/* 転送ファイルアクセス用ミューテックス */
+static HANDLE hEmptyEvent;				/* 転送ファイルリストが空になったことを知らせるイベント */
 
 static int TransFiles = 0;				/* 転送待ちファイル数 */
 static std::forward_list<TRANSPACKET> TransPacketBase;	/* 転送ファイルリスト */
 static auto NextTransPacketBase = end(TransPacketBase);
+static auto PrevTransPacketBase = TransPacketBase.before_begin();	/* NextTransPacketBaseの直前 */
+static auto LastTransPacketBase = TransPacketBase.before_begin();	/* 転送ファイルリストの末尾 */
 
-// 同時接続対応
-//static int Canceled;		/* 中止フラグ YES/NO */
-static int Canceled[MAX_DATA_CONNECTION];		/* 中止フラグ YES/NO */
 static int ClearAll;		/* 全て中止フラグ YES/NO */
 
+// 転送中に変更したホスト上のパス　転送ファイルリストが空になったときにまとめてキャッシュを破棄する
+//   hListAccMutexで保護する
+static std::vector<std::string> ChangedRemotePaths;
+
 static int ForceAbort;		/* 転送中止フラグ */
 							/* このフラグはスレッドを終了させるときに使う */
 
-// 同時接続対応
-//static LONGLONG AllTransSizeNow;	/* 今回の転送で転送したサイズ */
-//static time_t TimeStart;	/* 転送開始時間 */
-static LONGLONG AllTransSizeNow[MAX_DATA_CONNECTION];	/* 今回の転送で転送したサイズ */
-static time_t TimeStart[MAX_DATA_CONNECTION];	/* 転送開始時間 */
+// 転送中ダイアログはすべての転送スレッドで共有し、転送中のファイルをまとめて表示する
+static HWND hWndTrans = NULL;
+static int TransDlgThread = -1;		/* 転送中ダイアログを作成した転送スレッド */
+static int TransDlgShown = -1;		/* 転送中ダイアログにファイル名を表示している転送スレッド */
 
 static int KeepDlg = NO;	/* 転送中ダイアログを消さないかどうか (YES/NO) */
 static int MoveToForeground = NO;		/* ウインドウを前面に移動するかどうか (YES/NO) */
 
-// 同時接続対応
-//static char CurDir[FMAX_PATH+1] = { "" };
-static char CurDir[MAX_DATA_CONNECTION][FMAX_PATH+1];
 static thread_local std::wstring ErrMsg;
 
 // 同時接続対応
@@ -134,6 +141,12 @@ static int TransferErrorDisplay = 0;
 /* 設定値 */
 extern int SaveTimeStamp;
 extern int RmEOF;
+extern int UploadReadAhead;
+extern int AutoTuneBuffer;
+extern int SegmentThreshold;
+extern int TransferSchedule;
+extern int PrewarmConnections;
+extern int TransferIdleTime;
 // extern int TimeOut;
 extern int FwallType;
 extern int MirUpDelNotify;
@@ -148,12 +161,124 @@ extern time_t LastDataConnectionTime;
 extern int MarkAsInternet;
 
 
+// 転送に使うバッファの大きさの自動調整
+//   制御コネクションの往復時間と前回の転送速度から、ソケットのバッファが転送速度を制限していれば拡大し、
+//   往復時間あたりの転送量に比べて十分に大きければ縮小する
+class BufferTuning {
+	std::mutex mutex;
+	int sockbuf = SOCKBUF_SIZE;
+	double rtt = 0;			// 往復時間（秒）
+	double throughput = 0;	// 前回の転送速度（バイト/秒）
+public:
+	// 制御コネクションのコマンドの往復時間を記録する
+	void Measure(std::chrono::steady_clock::duration elapsed) {
+		std::lock_guard lock{ mutex };
+		auto const seconds = std::chrono::duration<double>(elapsed).count();
+		rtt = rtt == 0 ? seconds : rtt * 0.75 + seconds * 0.25;
+	}
+	// 今回の転送に使うソケットのバッファと送受信１回あたりのバッファの大きさを返す
+	std::tuple<int, int> Sizes() {
+		std::lock_guard lock{ mutex };
+		if (AutoTuneBuffer == NO)
+			return { SOCKBUF_SIZE, BUFSIZE };
+		auto const appbuf = (int)std::clamp(std::bit_floor((unsigned)sockbuf / 4), (unsigned)BUFSIZE, (unsigned)MAX_APPBUF_SIZE);
+		DoPrintf(L"buffer: rtt=%.1fms throughput=%.0fKB/s socket=%dKB application=%dKB", rtt * 1000, throughput / 1024, sockbuf / 1024, appbuf / 1024);
+		return { sockbuf, appbuf };
+	}
+	// 転送結果から次回のソケットのバッファの大きさを決める  往復時間に比べて短い転送は計測に使わない
+	void Update(LONGLONG bytes, std::chrono::steady_clock::duration elapsed) {
+		std::lock_guard lock{ mutex };
+		auto const seconds = std::chrono::duration<double>(elapsed).count();
+		if (AutoTuneBuffer == NO || rtt <= 0 || seconds < rtt * 4 || bytes < 4LL * sockbuf)
+			return;
+		throughput = bytes / seconds;
+		// ソケットのバッファの大きさで制限される転送速度
+		auto const limit = sockbuf / rtt;
+		if (limit * 0.7 <= throughput)
+			sockbuf = std::min(sockbuf * 2, MAX_SOCKBUF_SIZE);
+		else if (throughput < limit * 0.25)
+			sockbuf = std::max(sockbuf / 2, SOCKBUF_SIZE);
+	}
+};
+
+
+// 転送スレッドごとの状態
+//   転送スレッドは接続先の同時接続数に応じて必要になった時点で追加し、終了するまで再利用する
+struct TransferWorker {
+	HANDLE hThread = NULL;
+	HANDLE hWakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);	/* 転送スレッドを起こすイベント */
+	int Canceled = NO;				/* 中止フラグ YES/NO */
+	TRANSPACKET* Packet = nullptr;	/* 処理中の転送ファイル情報 */
+	int Transferring = NO;			/* データを転送中かどうか YES/NO */
+	LONGLONG AllTransSizeNow = 0;	/* 今回の転送で転送したサイズ */
+	time_t TimeStart = 0;			/* 転送開始時間 */
+	char CurDir[FMAX_PATH+1] = "";
+	BufferTuning Tuning;
+	int Prewarm = NO;				/* 転送ファイルがなくても接続しておくかどうか YES/NO */
+	~TransferWorker() {
+		CloseHandle(hWakeEvent);
+	}
+};
+
+// 転送スレッドは作成後に移動しないよう個別に確保し、他のスレッドからは番号で参照する
+static std::unique_ptr<TransferWorker> Workers[MAX_DATA_CONNECTION];
+static std::atomic<int> WorkerCount = 0;
+static std::atomic<size_t> WriteRingSize = 0;	/* 確保中の書き込み待ちバッファの合計 */
+
+
 static void SetErrorMsg(std::wstring&& msg) {
 	if (empty(ErrMsg))
 		ErrMsg = msg;
 }
 
 
+// メッセージを処理しながらhandleがシグナル状態になるのを待つ
+//   WM_QUITを受け取った場合はWAIT_OBJECT_0 + 1を返す
+static DWORD WaitWithMessage(HANDLE handle, DWORD timeout) {
+	for (;;)
+		if (auto const result = MsgWaitForMultipleObjectsEx(1, &handle, timeout, QS_ALLINPUT, MWMO_INPUTAVAILABLE); result != WAIT_OBJECT_0 + 1 || BackgrndMessageProc() == YES)
+			return result;
+}
+
+
+// メッセージを処理しながらhandleがシグナル状態になるまで待つ
+static void WaitWithMessage(HANDLE handle) {
+	if (WaitWithMessage(handle, INFINITE) == WAIT_OBJECT_0 + 1)
+		// WM_QUITは処理しても残り続けるため、以降はメッセージの到着を待機の条件にできない
+		while (WaitForSingleObject(handle, 10) == WAIT_TIMEOUT)
+			BackgrndMessageProc();
+}
+
+
+// 転送ファイルリストのミューテックスを取得する
+static void LockTransFileList() {
+	WaitWithMessage(hListAccMutex);
+}
+
+
+// 待機している転送スレッドを起こす
+void WakeTransferThread() {
+	for (int i = 0; i < WorkerCount; i++)
+		SetEvent(Workers[i]->hWakeEvent);
+}
+
+
+// 接続した直後に転送スレッドをPrewarmConnections個まで先にログインさせておく
+//   最初の転送で接続とログインを待たずに済む  使われなければTransferIdleTime秒後にログアウトする
+void PrewarmTransferThread() {
+	auto const Count = std::min(PrewarmConnections, AskMaxThreadCount());
+	if (Count <= 0)
+		return;
+	LockTransFileList();
+	GrowTransferThread(Count);
+	for (int i = 0; i < std::min(Count, WorkerCount.load()); i++)
+		if (AskReuseCmdSkt() == NO || i > 0)
+			Workers[i]->Prewarm = YES;
+	ReleaseMutex(hListAccMutex);
+	WakeTransferThread();
+}
+
+
 /*----- ファイル転送スレッドを起動する ----------------------------------------
 *
 *	Parameter
@@ -169,7 +294,7 @@ int MakeTransferThread(void)
 	int i;
 
 	hListAccMutex = CreateMutexW( NULL, FALSE, NULL );
-	hRunMutex = CreateMutexW( NULL, TRUE, NULL );
+	hEmptyEvent = CreateEventW(NULL, TRUE, TRUE, NULL);
 
 	ClearAll = NO;
 	ForceAbort = NO;
@@ -179,14 +304,31 @@ int MakeTransferThread(void)
 //	hTransferThread = (HANDLE)_beginthreadex(NULL, 0, TransferThread, 0, 0, &dwID);
 //	if (hTransferThread == NULL)
 //		return(FFFTP_FAIL); /* XXX */
-	for(i = 0; i < MAX_DATA_CONNECTION; i++)
+	// 残りの転送スレッドは転送ファイルリストに追加する時に接続先の同時接続数まで増やす
+	return GrowTransferThread(1);
+}
+
+
+// 転送スレッドをCount個まで増やす
+//   転送ファイルリストのミューテックスを取得しているか、転送スレッドが動作する前に呼び出す
+static int GrowTransferThread(int Count)
+{
+	unsigned int dwID;
+
+	Count = std::min(Count, MAX_DATA_CONNECTION);
+	for(int i = WorkerCount; i < Count; i++)
 	{
-		hTransferThread[i] = (HANDLE)_beginthreadex(NULL, 0, TransferThread, IntToPtr(i), 0, &dwID);
-		if(hTransferThread[i] == NULL)
+		Workers[i] = std::make_unique<TransferWorker>();
+		Workers[i]->hThread = (HANDLE)_beginthreadex(NULL, 0, TransferThread, IntToPtr(i), 0, &dwID);
+		if(Workers[i]->hThread == NULL)
+		{
+			Workers[i].reset();
 			return FFFTP_FAIL;
+		}
+		WorkerCount = i + 1;
+		DoPrintf("Transfer thread %d started", i);
 	}
-
-	return(FFFTP_SUCCESS);
+	return FFFTP_SUCCESS;
 }
 
 
@@ -204,13 +346,14 @@ void CloseTransferThread(void)
 	int i;
 	// 同時接続対応
 //	Canceled = YES;
-	for(i = 0; i < MAX_DATA_CONNECTION; i++)
-		Canceled[i] = YES;
+	for(i = 0; i < WorkerCount; i++)
+		Workers[i]->Canceled = YES;
 	ClearAll = YES;
 	// 同時接続対応
 //	ForceAbort = YES;
 
 	fTransferThreadExit = TRUE;
+	WakeTransferThread();
 	// 同時接続対応
 //	while(WaitForSingleObject(hTransferThread, 10) == WAIT_TIMEOUT)
 //	{
@@ -218,20 +361,32 @@ void CloseTransferThread(void)
 //		Canceled = YES;
 //	}
 //	CloseHandle(hTransferThread);
-	for(i = 0; i < MAX_DATA_CONNECTION; i++)
+	for(i = 0; i < WorkerCount; i++)
 	{
-		while(WaitForSingleObject(hTransferThread[i], 10) == WAIT_TIMEOUT)
-		{
-			BackgrndMessageProc();
-			Canceled[i] = YES;
-		}
-		CloseHandle(hTransferThread[i]);
+		WaitWithMessage(Workers[i]->hThread);
+		CloseHandle(Workers[i]->hThread);
 	}
-
-	ReleaseMutex( hRunMutex );
+	for(i = WorkerCount; i > 0; i--)
+	{
+		WorkerCount = i - 1;
+		Workers[i - 1].reset();
+	}
+	FlushChangedRemotePaths();
 
 	CloseHandle( hListAccMutex );
-	CloseHandle( hRunMutex );
+	CloseHandle( hEmptyEvent );
+}
+
+
+// 転送中に変更したパスのファイル一覧キャッシュをまとめて破棄する
+//   同じパスへの操作は１つにまとめる
+static void FlushChangedRemotePaths() {
+	if (empty(ChangedRemotePaths))
+		return;
+	std::sort(begin(ChangedRemotePaths), end(ChangedRemotePaths));
+	ChangedRemotePaths.erase(std::unique(begin(ChangedRemotePaths), end(ChangedRemotePaths)), end(ChangedRemotePaths));
+	InvalidateListCache(ChangedRemotePaths);
+	ChangedRemotePaths.clear();
 }
 
 
@@ -239,14 +394,15 @@ void CloseTransferThread(void)
 void AbortAllTransfer()
 {
 	int i;
+	for(i = 0; i < WorkerCount; i++)
+		Workers[i]->Canceled = YES;
+	ClearAll = YES;
+	WakeTransferThread();
+	// 転送スレッドが転送ファイルリストを空にするまで待つ
 	while(!empty(TransPacketBase))
 	{
-		for(i = 0; i < MAX_DATA_CONNECTION; i++)
-			Canceled[i] = YES;
-		ClearAll = YES;
-		if(BackgrndMessageProc() == YES)
+		if(WaitWithMessage(hEmptyEvent, INFINITE) != WAIT_OBJECT_0)
 			break;
-		Sleep(10);
 	}
 	ClearAll = NO;
 }
@@ -285,30 +441,31 @@ void AddTransFileList(TRANSPACKET *Pkt)
 	DispTransPacket(*Pkt);
 
 	// 同時接続対応
-//	WaitForSingleObject(hListAccMutex, INFINITE);
-	while(WaitForSingleObject(hListAccMutex, 0) == WAIT_TIMEOUT)
+	WaitForMainThread = YES;
+	LockTransFileList();
+
+	// 末尾を保持しておき、転送ファイルリストをたどらずに追加する
+	auto const Prev = LastTransPacketBase;
+	LastTransPacketBase = TransPacketBase.insert_after(LastTransPacketBase, *Pkt);
+	if((strncmp(Pkt->Cmd, "RETR", 4) == 0) ||
+	   (strncmp(Pkt->Cmd, "STOR", 4) == 0))
 	{
-		WaitForMainThread = YES;
-		BackgrndMessageProc();
-		Sleep(1);
+		TransFiles++;
+		// タスクバー進捗表示
+		TransferSizeLeft += Pkt->Size;
+		TransferSizeTotal += Pkt->Size;
+		PostMessageW(GetMainHwnd(), WM_CHANGE_COND, 0, 0);
 	}
-
-	if (AddTmpTransFileList(*Pkt, TransPacketBase) == FFFTP_SUCCESS) {
-		if((strncmp(Pkt->Cmd, "RETR", 4) == 0) ||
-		   (strncmp(Pkt->Cmd, "STOR", 4) == 0))
-		{
-			TransFiles++;
-			// タスクバー進捗表示
-			TransferSizeLeft += Pkt->Size;
-			TransferSizeTotal += Pkt->Size;
-			PostMessageW(GetMainHwnd(), WM_CHANGE_COND, 0, 0);
-		}
+	if (NextTransPacketBase == end(TransPacketBase)) {
+		PrevTransPacketBase = Prev;
+		NextTransPacketBase = LastTransPacketBase;
 	}
-	if (NextTransPacketBase == end(TransPacketBase))
-		NextTransPacketBase = before_end(TransPacketBase);
+	GrowTransferThread(AskMaxThreadCount());
+	ResetEvent(hEmptyEvent);
 	ReleaseMutex(hListAccMutex);
 	// 同時接続対応
 	WaitForMainThread = NO;
+	WakeTransferThread();
 
 	return;
 }
@@ -325,20 +482,24 @@ void AddNullTransFileList()
 
 // 転送ファイル情報を転送ファイルリストに追加する
 void AppendTransFileList(std::forward_list<TRANSPACKET>&& list) {
-	while(WaitForSingleObject(hListAccMutex, 0) == WAIT_TIMEOUT)
+	WaitForMainThread = YES;
+	LockTransFileList();
+
+	if (empty(list))
 	{
-		WaitForMainThread = YES;
-		BackgrndMessageProc();
-		Sleep(1);
+		ReleaseMutex(hListAccMutex);
+		WaitForMainThread = NO;
+		return;
 	}
-
-	auto Pkt = before_end(TransPacketBase);
+	auto Pkt = LastTransPacketBase;
 	TransPacketBase.splice_after(Pkt, list);
 	++Pkt;
-	if (NextTransPacketBase == end(TransPacketBase))
+	if (NextTransPacketBase == end(TransPacketBase)) {
+		PrevTransPacketBase = LastTransPacketBase;
 		NextTransPacketBase = Pkt;
+	}
 
-	while(Pkt != end(TransPacketBase))
+	for (; Pkt != end(TransPacketBase); LastTransPacketBase = Pkt++)
 	{
 		DispTransPacket(*Pkt);
 
@@ -351,12 +512,14 @@ void AppendTransFileList(std::forward_list<TRANSPACKET>&& list) {
 			TransferSizeTotal += Pkt->Size;
 			PostMessageW(GetMainHwnd(), WM_CHANGE_COND, 0, 0);
 		}
-		++Pkt;
 	}
 
+	GrowTransferThread(AskMaxThreadCount());
+	ResetEvent(hEmptyEvent);
 	ReleaseMutex(hListAccMutex);
 	// 同時接続対応
 	WaitForMainThread = NO;
+	WakeTransferThread();
 	return;
 }
 
@@ -364,7 +527,7 @@ void AppendTransFileList(std::forward_list<TRANSPACKET>&& list) {
 // 転送ファイル情報を表示する
 static void DispTransPacket(TRANSPACKET const& item) {
 	if (strncmp(item.Cmd, "RETR", 4) == 0 || strncmp(item.Cmd, "STOR", 4) == 0)
-		DoPrintf("TransList Cmd=%s : %s : %s", item.Cmd, item.RemoteFile, item.LocalFile);
+		DoPrintf("TransList Cmd=%s : %s : %s : %lld", item.Cmd, item.RemoteFile, item.LocalFile, item.Size);
 	else if (strncmp(item.Cmd, "R-", 2) == 0)
 		DoPrintf("TransList Cmd=%s : %s", item.Cmd, item.RemoteFile);
 	else if (strncmp(item.Cmd, "L-", 2) == 0)
@@ -377,24 +540,25 @@ static void DispTransPacket(TRANSPACKET const& item) {
 
 
 // 転送ファイルリストをクリアする
+//   転送スレッドが処理中の項目は処理を終えたスレッドが外すため、まだ取り出されていない項目のみ消す
 static void EraseTransFileList() {
+	WaitForMainThread = YES;
+	LockTransFileList();
 	auto NotDel = end(TransPacketBase);
-	while (WaitForSingleObject(hListAccMutex, 0) == WAIT_TIMEOUT) {
-		WaitForMainThread = YES;
-		BackgrndMessageProc();
-		Sleep(1);
-	}
-	for (auto New = begin(TransPacketBase); New != end(TransPacketBase); ++New) {
+	auto BeforeNotDel = PrevTransPacketBase;
+	for (auto Prev = PrevTransPacketBase, New = NextTransPacketBase; New != end(TransPacketBase); Prev = New++) {
 		/* 最後の"BACKCUR"は必要なので消さない */
 		if (strcmp(New->Cmd, "BACKCUR") == 0) {
 			if (NotDel != end(TransPacketBase))
 				strcpy(NotDel->Cmd, "");
 			NotDel = New;
+			BeforeNotDel = Prev;
 		} else
 			strcpy(New->Cmd, "");
 	}
 	// FIXME: TransPacketBaseをここで変更すべきではないはず
 	// TransPacketBase.erase_after(TransPacketBase.before_begin(), NotDel);
+	PrevTransPacketBase = BeforeNotDel;
 	NextTransPacketBase = NotDel;
 	TransFiles = 0;
 	TransferSizeLeft = 0;
@@ -402,6 +566,7 @@ static void EraseTransFileList() {
 	PostMessageW(GetMainHwnd(), WM_CHANGE_COND, 0, 0);
 	ReleaseMutex(hListAccMutex);
 	WaitForMainThread = NO;
+	WakeTransferThread();
 }
 
 
@@ -481,12 +646,254 @@ void InitTransCurDir(void)
 	// 同時接続対応
 //	strcpy(CurDir, "");
 	int i;
-	for(i = 0; i < MAX_DATA_CONNECTION; i++)
-		strcpy(CurDir[i], "");
+	for(i = 0; i < WorkerCount; i++)
+		strcpy(Workers[i]->CurDir, "");
 	return;
 }
 
 
+// 次に転送するファイルを選び、NextTransPacketBaseの位置に移す
+//   複数の接続で転送する場合、大きいファイルが最後に残って他の接続が空くことのないよう大きいファイルから転送する
+//   ディレクトリの作成などのファイル転送以外の処理は順序を変えず、その間に並んだファイル転送の中でのみ入れ替える
+//   他のスレッドが保持している項目のポインタが無効にならないよう、内容は入れ替えずにリストのつなぎ替えで移す
+//   hListAccMutexを取得した状態で呼ぶこと
+static void ScheduleTransPacket() {
+	static auto alternate = false;
+	auto const transfer = [](TRANSPACKET const& item) {
+		return strncmp(item.Cmd, "RETR", 4) == 0 || strncmp(item.Cmd, "STOR", 4) == 0 || strncmp(item.Cmd, "STOU", 4) == 0;
+	};
+	if (TransferSchedule == SCHEDULE_FIFO || AskMaxThreadCount() < 2 || !transfer(*NextTransPacketBase))
+		return;
+	auto const largest = TransferSchedule != SCHEDULE_MIXED || !(alternate = !alternate);
+	auto selected = NextTransPacketBase;
+	auto before = PrevTransPacketBase;
+	auto prev = NextTransPacketBase;
+	auto it = std::next(NextTransPacketBase);
+	for (int count = 1; count < SCHEDULE_WINDOW && it != end(TransPacketBase) && transfer(*it); ++count, prev = it++)
+		if (largest ? selected->Size < it->Size : it->Size < selected->Size) {
+			selected = it;
+			before = prev;
+		}
+	if (selected != NextTransPacketBase) {
+		if (selected == LastTransPacketBase)
+			LastTransPacketBase = before;
+		TransPacketBase.splice_after(PrevTransPacketBase, TransPacketBase, before);
+		NextTransPacketBase = selected;
+	}
+}
+
+
+// 分割ダウンロードの進捗
+//   受信中は「ローカルのファイル名.part」に書き込み、すべての範囲を受信してから本来の名前に変更する
+//   受信済みの範囲を「ローカルのファイル名.part.ffftp」に記録し、中断したダウンロードは残りの範囲のみ再開する
+class SegmentMap {
+	std::mutex mutex;
+	const fs::path local;
+	const fs::path temp;
+	const fs::path path;
+	const LONGLONG total;
+	const ULONGLONG time;
+	std::map<LONGLONG, LONGLONG> done;	// 受信済みの範囲（開始位置→終了位置）
+	bool finished = false;				// 本来の名前に変更したかどうか
+	void Add(LONGLONG start, LONGLONG last) {
+		start = std::max(start, 0LL);
+		last = std::min(last, total);
+		if (last <= start)
+			return;
+		auto it = done.upper_bound(start);
+		if (it != begin(done) && start <= std::prev(it)->second)
+			start = (--it)->first;
+		for (; it != end(done) && it->first <= last; it = done.erase(it))
+			last = std::max(last, it->second);
+		done.emplace(start, last);
+	}
+	bool IsDone() const {
+		return total == 0 || size(done) == 1 && begin(done)->first == 0 && begin(done)->second == total;
+	}
+public:
+	SegmentMap(fs::path const& local, LONGLONG total, FILETIME const& time) : local{ local }, temp{ fs::path{ local } += L".part" }, path{ fs::path{ temp } += L".ffftp" }, total{ total }, time{ ULONGLONG(time.dwHighDateTime) << 32 | time.dwLowDateTime } {}
+	fs::path const& Temporary() const {
+		return temp;
+	}
+	// 前回の記録を読み込む  ファイルのサイズと日時が変わっているか、受信中のファイルがなければ使わない
+	bool Load() {
+		std::lock_guard lock{ mutex };
+		if (std::error_code ec; !fs::exists(temp, ec))
+			return false;
+		std::ifstream is{ path, std::ios::binary };
+		LONGLONG size;
+		ULONGLONG value;
+		if (!(is >> size >> value) || size != total || value != time)
+			return false;
+		for (LONGLONG start, last; is >> start >> last;)
+			Add(start, last);
+		return true;
+	}
+	// 前回の記録を破棄する
+	void Discard() {
+		std::lock_guard lock{ mutex };
+		done.clear();
+		std::error_code ec;
+		fs::remove(path, ec);
+	}
+	// 受信済みの範囲を記録する  すべての範囲を受信したら本来の名前に変更し、記録を削除してtrueを返す
+	bool Complete(LONGLONG start, LONGLONG last) {
+		std::lock_guard lock{ mutex };
+		Add(start, last);
+		if (finished)
+			return false;
+		if (IsDone()) {
+			// 受信中に設定したスパースファイルの属性を戻し、日時を設定する
+			if (auto handle = CreateFileW(temp.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, 0); handle != INVALID_HANDLE_VALUE) {
+				FILE_SET_SPARSE_BUFFER sparse{ FALSE };
+				DWORD returned;
+				DeviceIoControl(handle, FSCTL_SET_SPARSE, &sparse, sizeof sparse, nullptr, 0, &returned, nullptr);
+				if (SaveTimeStamp == YES && time != 0) {
+					FILETIME const filetime{ DWORD(time), DWORD(time >> 32) };
+					SetFileTime(handle, &filetime, &filetime, &filetime);
+				}
+				CloseHandle(handle);
+			}
+			if (MoveFileExW(temp.c_str(), local.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+				std::error_code ec;
+				fs::remove(path, ec);
+				finished = true;
+				return true;
+			}
+			DoPrintf("Segmented download rename failed : %s", u8(local.native()).c_str());
+		}
+		if (std::ofstream os{ path, std::ios::binary }) {
+			os << total << ' ' << time << '\n';
+			for (auto [start, last] : done)
+				os << start << ' ' << last << '\n';
+		}
+		return false;
+	}
+	// すべての範囲を受信して本来の名前に変更したかどうか
+	bool Done() {
+		std::lock_guard lock{ mutex };
+		return finished;
+	}
+	// 未受信の範囲を返す  countより少なければ大きな範囲を半分ずつに分割する
+	std::vector<std::pair<LONGLONG, LONGLONG>> Missing(size_t count) {
+		std::lock_guard lock{ mutex };
+		std::vector<std::pair<LONGLONG, LONGLONG>> ranges;
+		LONGLONG pos = 0;
+		for (auto [start, last] : done) {
+			if (pos < start)
+				ranges.emplace_back(pos, start);
+			pos = last;
+		}
+		if (pos < total)
+			ranges.emplace_back(pos, total);
+		while (!empty(ranges) && size(ranges) < count) {
+			auto largest = std::max_element(begin(ranges), end(ranges), [](auto const& l, auto const& r) { return l.second - l.first < r.second - r.first; });
+			auto const half = (largest->second - largest->first) / 2;
+			if (half < SEGMENT_MIN_SIZE)
+				break;
+			auto const last = largest->second;
+			largest->second = largest->first + half;
+			ranges.emplace_back(largest->second, last);
+		}
+		std::sort(begin(ranges), end(ranges));
+		return ranges;
+	}
+};
+
+
+// 大きなファイルのダウンロードを範囲ごとに分割し、転送ファイルリストに各範囲のダウンロードとして並べる
+//   各範囲は他の転送スレッドがREST 開始位置からRETRし、終了位置まで受信したらデータコネクションを閉じる
+//   一時ファイルをあらかじめファイルのサイズまで拡張しておき、各範囲をその位置に書き込む
+//   hListAccMutexを取得した状態で呼ぶこと
+static void SplitDownload(std::forward_list<TRANSPACKET>::iterator Pos) {
+	if (SegmentThreshold <= 0 || Pos->Segment || strcmp(Pos->Cmd, "RETR ") != 0 || Pos->Type != TYPE_I || Pos->NoTransfer != NO || Pos->Mode == EXIST_IGNORE)
+		return;
+	if (Pos->Size < LONGLONG(SegmentThreshold) * 1024 * 1024 || AskMaxThreadCount() < 2)
+		return;
+	auto const local = fs::u8path(Pos->LocalFile);
+	auto segment = std::make_shared<SegmentMap>(local, Pos->Size, Pos->Time);
+	// 同じファイルの中断した分割ダウンロードが残っていれば続きから受信する
+	auto resume = segment->Load();
+	if (!resume) {
+		segment->Discard();
+		// 分割せずに途中まで受信したファイルは一時ファイルに移し、残りを分割する
+		if (Pos->Mode == EXIST_RESUME && 0 < Pos->ExistSize) {
+			if (Pos->Size <= Pos->ExistSize || !MoveFileExW(local.c_str(), segment->Temporary().c_str(), MOVEFILE_REPLACE_EXISTING))
+				return;
+			segment->Complete(0, Pos->ExistSize);
+			resume = true;
+		}
+	}
+
+	// 手前の領域がゼロで埋められるのを待たずに途中の位置へ書き込めるよう、スパースファイルとして拡張する
+	if (auto handle = CreateFileW(segment->Temporary().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, resume ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0); handle != INVALID_HANDLE_VALUE) {
+		DWORD returned;
+		DeviceIoControl(handle, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr);
+		auto const extended = SetFilePointerEx(handle, LARGE_INTEGER{ .QuadPart = Pos->Size }, nullptr, FILE_BEGIN) && SetEndOfFile(handle);
+		CloseHandle(handle);
+		if (!extended)
+			return;
+	} else
+		return;
+
+	auto const ranges = segment->Missing(AskMaxThreadCount());
+	if (empty(ranges)) {
+		/* すべての範囲を受信済み  前回名前を変更できなかった場合はここで変更する */
+		segment->Complete(0, 0);
+		Pos->Mode = EXIST_IGNORE;
+		return;
+	}
+	auto it = Pos;
+	for (size_t i = 0; i < size(ranges); i++) {
+		if (0 < i) {
+			auto const last = it == LastTransPacketBase;
+			it = TransPacketBase.insert_after(it, *Pos);
+			if (last)
+				LastTransPacketBase = it;
+			TransFiles++;
+		}
+		auto const [start, last] = ranges[i];
+		it->Segment = segment;
+		it->SegmentStart = start;
+		it->SegmentEnd = last;
+		it->ExistSize = start;
+		it->Mode = EXIST_RESUME;
+		DoPrintf("Segment %lld-%lld : %s", start, last, it->RemoteFile);
+	}
+	PrevTransPacketBase = Pos;
+	NextTransPacketBase = std::next(Pos);
+	WakeTransferThread();
+}
+
+
+// 待機中の転送スレッドが次に起きるまでの時間
+//   転送スレッド専用の接続を持っている場合は、使用されずにTransferIdleTime秒経って切断する時刻か、次にNOOPを送る時刻まで
+static DWORD IdleTimeout(SOCKET TrnSkt, int ThreadCount, DWORD LastUsed, DWORD LastNoop) {
+	if (TrnSkt == INVALID_SOCKET || AskReuseCmdSkt() == YES && ThreadCount == 0)
+		return INFINITE;
+	auto const now = timeGetTime();
+	auto const lifetime = static_cast<DWORD>(TransferIdleTime) * 1000;
+	auto timeout = lifetime - std::min(now - LastUsed, lifetime);
+	if (auto const interval = static_cast<DWORD>(AskNoopInterval()) * 1000; 0 < interval)
+		timeout = std::min(timeout, interval - std::min({ now - LastUsed, now - LastNoop, interval }));
+	return timeout;
+}
+
+
+// 転送スレッドの接続が使えるかNOOPで確認する
+static int ProbeTrnSkt(SOCKET TrnSkt, int ThreadCount) {
+	RemoveReceivedData(TrnSkt);
+	return command(TrnSkt, NULL, &Workers[ThreadCount]->Canceled, "NOOP") / 100 == FTP_COMPLETE ? FFFTP_SUCCESS : FFFTP_FAIL;
+}
+
+
+// ログインに失敗した転送スレッドが接続し直すまでの時間
+//   失敗が続くほど2秒から60秒まで倍に延ばし、同時に失敗した転送スレッドが一斉に接続し直さないよう少しずつずらす
+static DWORD LoginBackoff(int Failures, int ThreadCount) {
+	return std::min(2000UL << std::min(Failures - 1, 5), 60000UL) + ThreadCount * 250;
+}
+
+
 /*----- ファイル転送スレッドのメインループ ------------------------------------
 *
 *	Parameter
@@ -498,7 +905,6 @@ void InitTransCurDir(void)
 
 static unsigned __stdcall TransferThread(void *Dummy)
 {
-	HWND hWndTrans;
 	char Tmp[FMAX_PATH+1];
 	int CwdSts;
 	int GoExit;
@@ -509,13 +915,13 @@ static unsigned __stdcall TransferThread(void *Dummy)
 	int DelNotify;
 	int ThreadCount;
 	SOCKET TrnSkt;
-	RECT WndRect;
 	int i;
 	DWORD LastUsed;
+	DWORD LastNoop;
+	int LoginFailures;
 	int LastError;
 	int Sts;
 
-	hWndTrans = NULL;
 	Down = NO;
 	Up = NO;
 	GoExit = NO;
@@ -525,36 +931,38 @@ static unsigned __stdcall TransferThread(void *Dummy)
 	ThreadCount = PtrToInt(Dummy);
 	TrnSkt = INVALID_SOCKET;
 	LastError = NO;
+	LastUsed = timeGetTime();
+	LastNoop = LastUsed;
+	LoginFailures = 0;
 	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
 
-	while(!empty(TransPacketBase) ||
-		  (WaitForSingleObject(hRunMutex, 200) == WAIT_TIMEOUT))
+	// 転送ファイルリストの更新や終了の通知はWorkers[ThreadCount]->hWakeEventで受け取り、それまではメッセージを処理しながら待機する
+	while(fTransferThreadExit == FALSE)
 	{
-		if(fTransferThreadExit == TRUE)
-			break;
-
 		if(WaitForMainThread == YES)
 		{
-			BackgrndMessageProc();
-			Sleep(100);
+			/* メインスレッドが転送ファイルリストを更新し終えると起こされる */
+			WaitWithMessage(Workers[ThreadCount]->hWakeEvent, 100);
 			continue;
 		}
 
-//		WaitForSingleObject(hListAccMutex, INFINITE);
-		while(WaitForSingleObject(hListAccMutex, 0) == WAIT_TIMEOUT)
-		{
-			BackgrndMessageProc();
-			Sleep(1);
-		}
+		LockTransFileList();
 		ErrMsg.clear();
 
 //		Canceled = NO;
-		Canceled[ThreadCount] = NO;
+		// 全て中止の処理中は新たに取り出した転送も中止させる
+		if(ClearAll == NO)
+			Workers[ThreadCount]->Canceled = NO;
 
 		while (!empty(TransPacketBase) && strcmp(TransPacketBase.front().Cmd, "") == 0) {
+			if (PrevTransPacketBase == begin(TransPacketBase))
+				PrevTransPacketBase = TransPacketBase.before_begin();
 			TransPacketBase.pop_front();
-			if (empty(TransPacketBase))
+			if (empty(TransPacketBase)) {
+				LastTransPacketBase = TransPacketBase.before_begin();
 				GoExit = YES;
+				SetEvent(hEmptyEvent);
+			}
 		}
 		if(AskReuseCmdSkt() == YES && ThreadCount == 0)
 		{
@@ -566,12 +974,7 @@ static unsigned __stdcall TransferThread(void *Dummy)
 				PostMessageW(GetMainHwnd(), WM_RECONNECTSOCKET, 0, 0);
 				Sleep(100);
 				TrnSkt = INVALID_SOCKET;
-//				WaitForSingleObject(hListAccMutex, INFINITE);
-				while(WaitForSingleObject(hListAccMutex, 0) == WAIT_TIMEOUT)
-				{
-					BackgrndMessageProc();
-					Sleep(1);
-				}
+				LockTransFileList();
 			}
 		}
 		else
@@ -580,69 +983,75 @@ static unsigned __stdcall TransferThread(void *Dummy)
 			if(TrnSkt != INVALID_SOCKET && AskErrorReconnect() == YES && LastError == YES)
 			{
 				ReleaseMutex(hListAccMutex);
-				DoQUIT(TrnSkt, &Canceled[ThreadCount]);
+				DoQUIT(TrnSkt, &Workers[ThreadCount]->Canceled);
 				DoClose(TrnSkt);
 				TrnSkt = INVALID_SOCKET;
-//				WaitForSingleObject(hListAccMutex, INFINITE);
-				while(WaitForSingleObject(hListAccMutex, 0) == WAIT_TIMEOUT)
-				{
-					BackgrndMessageProc();
-					Sleep(1);
-				}
+				LockTransFileList();
 			}
-			if(!empty(TransPacketBase) && AskConnecting() == YES && ThreadCount < AskMaxThreadCount())
+			// 転送ファイルがある時のほか、接続した直後に先にログインしておく
+			if((!empty(TransPacketBase) || Workers[ThreadCount]->Prewarm == YES) && AskConnecting() == YES && ThreadCount < AskMaxThreadCount())
 			{
+				Workers[ThreadCount]->Prewarm = NO;
 				ReleaseMutex(hListAccMutex);
 				if(TrnSkt == INVALID_SOCKET)
-					ReConnectTrnSkt(&TrnSkt, &Canceled[ThreadCount]);
+					ReConnectTrnSkt(&TrnSkt, &Workers[ThreadCount]->Canceled);
 				else
-					CheckClosedAndReconnectTrnSkt(&TrnSkt, &Canceled[ThreadCount]);
+				{
+					CheckClosedAndReconnectTrnSkt(&TrnSkt, &Workers[ThreadCount]->Canceled);
+					// しばらく使用していない接続はホスト側で切断されている場合があるため、NOOPで確認してから使う
+					if(TrnSkt != INVALID_SOCKET && std::min(timeGetTime() - LastUsed, timeGetTime() - LastNoop) >= 10000 && ProbeTrnSkt(TrnSkt, ThreadCount) == FFFTP_FAIL)
+						ReConnectTrnSkt(&TrnSkt, &Workers[ThreadCount]->Canceled);
+				}
 				// 同時ログイン数制限対策
 				if(TrnSkt == INVALID_SOCKET)
 				{
 					// 同時ログイン数制限に引っかかった可能性あり
-					// 負荷を下げるために約10秒間待機
-					i = 1000;
-					while(i > 0)
-					{
-						BackgrndMessageProc();
-						Sleep(10);
-						i--;
-					}
+					// 負荷を下げるために失敗が続くほど長く待機
+					auto const Wait = LoginBackoff(++LoginFailures, ThreadCount);
+					DoPrintf("Transfer thread %d : login failed %d times, retry after %lu ms", ThreadCount, LoginFailures, Wait);
+					for(auto const until = GetTickCount64() + Wait; fTransferThreadExit == FALSE && GetTickCount64() < until;)
+						WaitWithMessage(Workers[ThreadCount]->hWakeEvent, (DWORD)(until - GetTickCount64()));
 				}
+				else
+					LoginFailures = 0;
 				LastUsed = timeGetTime();
-//				WaitForSingleObject(hListAccMutex, INFINITE);
-				while(WaitForSingleObject(hListAccMutex, 0) == WAIT_TIMEOUT)
-				{
-					BackgrndMessageProc();
-					Sleep(1);
-				}
+				LockTransFileList();
 			}
 			else
 			{
 				if(TrnSkt != INVALID_SOCKET)
 				{
 					// 同時ログイン数制限対策
-					// 60秒間使用されなければログアウト
-					if(timeGetTime() - LastUsed > 60000 || AskConnecting() == NO || ThreadCount >= AskMaxThreadCount())
+					// TransferIdleTime秒間使用されなければログアウト
+					if(timeGetTime() - LastUsed >= static_cast<DWORD>(TransferIdleTime) * 1000 || AskConnecting() == NO || ThreadCount >= AskMaxThreadCount())
 					{
 						ReleaseMutex(hListAccMutex);
-						DoQUIT(TrnSkt, &Canceled[ThreadCount]);
+						DoQUIT(TrnSkt, &Workers[ThreadCount]->Canceled);
 						DoClose(TrnSkt);
 						TrnSkt = INVALID_SOCKET;
-//						WaitForSingleObject(hListAccMutex, INFINITE);
-						while(WaitForSingleObject(hListAccMutex, 0) == WAIT_TIMEOUT)
+						LockTransFileList();
+					}
+					// 自動切断対策
+					// 待機中の接続もNOOPで維持し、応答がなければ切断する
+					else if(AskNoopInterval() > 0 && std::min(timeGetTime() - LastUsed, timeGetTime() - LastNoop) >= static_cast<DWORD>(AskNoopInterval()) * 1000)
+					{
+						ReleaseMutex(hListAccMutex);
+						if(ProbeTrnSkt(TrnSkt, ThreadCount) == FFFTP_FAIL)
 						{
-							BackgrndMessageProc();
-							Sleep(1);
+							DoClose(TrnSkt);
+							TrnSkt = INVALID_SOCKET;
 						}
+						LastNoop = timeGetTime();
+						LockTransFileList();
 					}
 				}
 			}
 		}
 		LastError = NO;
 		if (TrnSkt != INVALID_SOCKET && NextTransPacketBase != end(TransPacketBase)) {
+			ScheduleTransPacket();
 			auto Pos = NextTransPacketBase++;
+			PrevTransPacketBase = Pos;
 			// ディレクトリ操作は非同期で行わない
 //			ReleaseMutex(hListAccMutex);
 			if(hWndTrans == NULL)
@@ -658,12 +1067,12 @@ static unsigned __stdcall TransferThread(void *Dummy)
 				   (strncmp(Pos->Cmd, "L-", 2) == 0) ||
 				   (strncmp(Pos->Cmd, "R-", 2) == 0))
 				{
+					// 転送中ダイアログは作成したスレッドで破棄するまで他の転送スレッドも使用する
 					hWndTrans = CreateDialogW(GetFtpInst(), MAKEINTRESOURCEW(transfer_dlg), HWND_DESKTOP, (DLGPROC)TransDlgProc);
+					TransDlgThread = ThreadCount;
 					if(MoveToForeground == YES)
 						SetForegroundWindow(hWndTrans);
 					ShowWindow(hWndTrans, SW_SHOWNOACTIVATE);
-					GetWindowRect(hWndTrans, &WndRect);
-					SetWindowPos(hWndTrans, NULL, WndRect.left, WndRect.top + (WndRect.bottom - WndRect.top) * ThreadCount - (WndRect.bottom - WndRect.top) * (AskMaxThreadCount() - 1) / 2, 0, 0, SWP_NOSIZE | SWP_NOZORDER);
 				}
 			}
 //			TransPacketBase->hWndTrans = hWndTrans;
@@ -681,8 +1090,7 @@ static unsigned __stdcall TransferThread(void *Dummy)
 				}
 			}
 
-			if(hWndTrans != NULL)
-				SendMessageW(hWndTrans, WM_SET_PACKET, 0, (LPARAM)&*Pos);
+			Workers[ThreadCount]->Packet = &*Pos;
 
 			// 中断後に受信バッファに応答が残っていると次のコマンドの応答が正しく処理できない
 			RemoveReceivedData(TrnSkt);
@@ -696,8 +1104,10 @@ static unsigned __stdcall TransferThread(void *Dummy)
 				/* 不正なパスを検出 */
 				if(CheckPathViolation(*Pos) == NO)
 				{
+					// 大きなファイルは範囲ごとに分割して他の転送スレッドと並行して受信する
+					SplitDownload(Pos);
 					/* フルパスを使わないための処理 */
-					if(MakeNonFullPath(*Pos, CurDir[Pos->ThreadCount]) == FFFTP_SUCCESS)
+					if(MakeNonFullPath(*Pos, Workers[Pos->ThreadCount]->CurDir) == FFFTP_SUCCESS)
 					{
 //						if(strncmp(TransPacketBase->Cmd, "RETR-S", 6) == 0)
 						if(strncmp(Pos->Cmd, "RETR-S", 6) == 0)
@@ -706,8 +1116,7 @@ static unsigned __stdcall TransferThread(void *Dummy)
 //							DoSIZE(TransPacketBase->RemoteFile, &TransPacketBase->Size);
 //							DoMDTM(TransPacketBase->RemoteFile, &TransPacketBase->Time);
 //							strcpy(TransPacketBase->Cmd, "RETR ");
-							DoSIZE(TrnSkt, Pos->RemoteFile, &Pos->Size, &Canceled[Pos->ThreadCount]);
-							DoMDTM(TrnSkt, Pos->RemoteFile, &Pos->Time, &Canceled[Pos->ThreadCount]);
+							DoSIZEandMDTM(TrnSkt, Pos->RemoteFile, &Pos->Size, &Pos->Time, &Workers[Pos->ThreadCount]->Canceled);
 							strcpy(Pos->Cmd, "RETR ");
 						}
 
@@ -715,15 +1124,17 @@ static unsigned __stdcall TransferThread(void *Dummy)
 						// ミラーリング設定追加
 						if(Pos->NoTransfer == NO)
 						{
-							Sts = DoDownload(TrnSkt, *Pos, NO, &Canceled[Pos->ThreadCount]) / 100;
+							Sts = DoDownload(TrnSkt, *Pos, NO, &Workers[Pos->ThreadCount]->Canceled) / 100;
 							if(Sts != FTP_COMPLETE)
 								LastError = YES;
 							// ゾーンID設定追加
-							if(MarkAsInternet == YES && IsZoneIDLoaded() == YES)
+							// 分割ダウンロードではすべての範囲を受信して本来の名前に変更してから設定する
+							if(MarkAsInternet == YES && IsZoneIDLoaded() == YES && (!Pos->Segment || Pos->Segment->Done()))
 								MarkFileAsDownloadedFromInternet(Pos->LocalFile);
 						}
 
-						if (SaveTimeStamp == YES && (Pos->Time.dwLowDateTime != 0 || Pos->Time.dwHighDateTime != 0))
+						// 分割ダウンロードでは名前を変更する前にSegmentMapが日時を設定する
+						if (SaveTimeStamp == YES && (Pos->Time.dwLowDateTime != 0 || Pos->Time.dwHighDateTime != 0) && !Pos->Segment)
 							if (auto handle = CreateFileW(fs::u8path(Pos->LocalFile).c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, 0); handle != INVALID_HANDLE_VALUE) {
 								SetFileTime(handle, &Pos->Time, &Pos->Time, &Pos->Time);
 								CloseHandle(handle);
@@ -739,8 +1150,9 @@ static unsigned __stdcall TransferThread(void *Dummy)
 			{
 				// 一部TYPE、STOR(RETR)、PORT(PASV)を並列に処理できないホストがあるため
 //				ReleaseMutex(hListAccMutex);
+				ChangedRemotePaths.emplace_back(Pos->RemoteFile);
 				/* フルパスを使わないための処理 */
-				if(MakeNonFullPath(*Pos, CurDir[Pos->ThreadCount]) == FFFTP_SUCCESS)
+				if(MakeNonFullPath(*Pos, Workers[Pos->ThreadCount]->CurDir) == FFFTP_SUCCESS)
 				{
 					Up = YES;
 					// ミラーリング設定追加
@@ -756,7 +1168,7 @@ static unsigned __stdcall TransferThread(void *Dummy)
 					if((SaveTimeStamp == YES) &&
 					   ((Pos->Time.dwLowDateTime != 0) || (Pos->Time.dwHighDateTime != 0)))
 					{
-						DoMFMT(TrnSkt, Pos->RemoteFile, &Pos->Time, &Canceled[Pos->ThreadCount]);
+						DoMFMT(TrnSkt, Pos->RemoteFile, &Pos->Time, &Workers[Pos->ThreadCount]->Canceled);
 					}
 				}
 				// 一部TYPE、STOR(RETR)、PORT(PASV)を並列に処理できないホストがあるため
@@ -771,13 +1183,14 @@ static unsigned __stdcall TransferThread(void *Dummy)
 //				if(strlen(TransPacketBase->RemoteFile) > 0)
 				if(strlen(Pos->RemoteFile) > 0)
 				{
+					ChangedRemotePaths.emplace_back(Pos->RemoteFile);
 					/* フルパスを使わないための処理 */
 					CwdSts = FTP_COMPLETE;
 
 //					strcpy(Tmp, TransPacketBase->RemoteFile);
 					strcpy(Tmp, Pos->RemoteFile);
 //					if(ProcForNonFullpath(Tmp, CurDir, hWndTrans, 1) == FFFTP_FAIL)
-					if(ProcForNonFullpath(TrnSkt, Tmp, CurDir[Pos->ThreadCount], hWndTrans, &Canceled[Pos->ThreadCount]) == FFFTP_FAIL)
+					if(ProcForNonFullpath(TrnSkt, Tmp, Workers[Pos->ThreadCount]->CurDir, hWndTrans, &Workers[Pos->ThreadCount]->Canceled) == FFFTP_FAIL)
 					{
 						ClearAll = YES;
 						CwdSts = FTP_ERROR;
@@ -787,12 +1200,12 @@ static unsigned __stdcall TransferThread(void *Dummy)
 					{
 						Up = YES;
 //						CommandProcTrn(NULL, "MKD %s", Tmp);
-						CommandProcTrn(TrnSkt, NULL, &Canceled[Pos->ThreadCount], "MKD %s", Tmp);
+						CommandProcTrn(TrnSkt, NULL, &Workers[Pos->ThreadCount]->Canceled, "MKD %s", Tmp);
 						/* すでにフォルダがある場合もあるので、 */
 						/* ここではエラーチェックはしない */
 
 					if(FolderAttr)
-						CommandProcTrn(TrnSkt, NULL, &Canceled[Pos->ThreadCount], "%s %03d %s", AskHostChmodCmd().c_str(), FolderAttrNum, Tmp);
+						CommandProcTrn(TrnSkt, NULL, &Workers[Pos->ThreadCount]->Canceled, "%s %03d %s", AskHostChmodCmd().c_str(), FolderAttrNum, Tmp);
 					}
 				}
 //				else if(strlen(TransPacketBase->LocalFile) > 0)
@@ -809,15 +1222,16 @@ static unsigned __stdcall TransferThread(void *Dummy)
 			{
 				DispTransFileInfo(*Pos, IDS_MSGJPN078, FALSE, YES);
 
+				ChangedRemotePaths.emplace_back(Pos->RemoteFile);
 				/* フルパスを使わないための処理 */
-				if(MakeNonFullPath(*Pos, CurDir[Pos->ThreadCount]) == FFFTP_SUCCESS)
+				if(MakeNonFullPath(*Pos, Workers[Pos->ThreadCount]->CurDir) == FFFTP_SUCCESS)
 				{
 					Up = YES;
 //					CommandProcTrn(NULL, "%s%s", TransPacketBase->Cmd+2, TransPacketBase->RemoteFile);
-					CommandProcTrn(TrnSkt, NULL, &Canceled[Pos->ThreadCount], "%s%s", Pos->Cmd+2, Pos->RemoteFile);
+					CommandProcTrn(TrnSkt, NULL, &Workers[Pos->ThreadCount]->Canceled, "%s%s", Pos->Cmd+2, Pos->RemoteFile);
 
 					if(FolderAttr)
-						CommandProcTrn(TrnSkt, NULL, &Canceled[Pos->ThreadCount], "%s %03d %s", AskHostChmodCmd().c_str(), FolderAttrNum, Pos->RemoteFile);
+						CommandProcTrn(TrnSkt, NULL, &Workers[Pos->ThreadCount]->Canceled, "%s %03d %s", AskHostChmodCmd().c_str(), FolderAttrNum, Pos->RemoteFile);
 				}
 				ReleaseMutex(hListAccMutex);
 			}
@@ -830,12 +1244,13 @@ static unsigned __stdcall TransferThread(void *Dummy)
 				DelNotify = MirrorDelNotify(WIN_REMOTE, DelNotify, *Pos);
 				if((DelNotify == YES) || (DelNotify == YES_ALL))
 				{
+					ChangedRemotePaths.emplace_back(Pos->RemoteFile);
 					/* フルパスを使わないための処理 */
-					if(MakeNonFullPath(*Pos, CurDir[Pos->ThreadCount]) == FFFTP_SUCCESS)
+					if(MakeNonFullPath(*Pos, Workers[Pos->ThreadCount]->CurDir) == FFFTP_SUCCESS)
 					{
 						Up = YES;
 //						CommandProcTrn(NULL, "%s%s", TransPacketBase->Cmd+2, TransPacketBase->RemoteFile);
-						CommandProcTrn(TrnSkt, NULL, &Canceled[Pos->ThreadCount], "%s%s", Pos->Cmd+2, Pos->RemoteFile);
+						CommandProcTrn(TrnSkt, NULL, &Workers[Pos->ThreadCount]->Canceled, "%s%s", Pos->Cmd+2, Pos->RemoteFile);
 					}
 				}
 				ReleaseMutex(hListAccMutex);
@@ -849,12 +1264,13 @@ static unsigned __stdcall TransferThread(void *Dummy)
 				DelNotify = MirrorDelNotify(WIN_REMOTE, DelNotify, *Pos);
 				if((DelNotify == YES) || (DelNotify == YES_ALL))
 				{
+					ChangedRemotePaths.emplace_back(Pos->RemoteFile);
 					/* フルパスを使わないための処理 */
-					if(MakeNonFullPath(*Pos, CurDir[Pos->ThreadCount]) == FFFTP_SUCCESS)
+					if(MakeNonFullPath(*Pos, Workers[Pos->ThreadCount]->CurDir) == FFFTP_SUCCESS)
 					{
 						Up = YES;
 //						CommandProcTrn(NULL, "%s%s", TransPacketBase->Cmd+2, TransPacketBase->RemoteFile);
-						CommandProcTrn(TrnSkt, NULL, &Canceled[Pos->ThreadCount], "%s%s", Pos->Cmd+2, Pos->RemoteFile);
+						CommandProcTrn(TrnSkt, NULL, &Workers[Pos->ThreadCount]->Canceled, "%s%s", Pos->Cmd+2, Pos->RemoteFile);
 					}
 				}
 				ReleaseMutex(hListAccMutex);
@@ -905,10 +1321,10 @@ static unsigned __stdcall TransferThread(void *Dummy)
 				if(AskReuseCmdSkt() == NO || AskShareProh() == YES)
 				{
 //					if(strcmp(CurDir, TransPacketBase->RemoteFile) != 0)
-					if(strcmp(CurDir[Pos->ThreadCount], Pos->RemoteFile) != 0)
+					if(strcmp(Workers[Pos->ThreadCount]->CurDir, Pos->RemoteFile) != 0)
 					{
 //						if(CommandProcTrn(NULL, "CWD %s", TransPacketBase->RemoteFile)/100 != FTP_COMPLETE)
-						if(CommandProcTrn(TrnSkt, NULL, &Canceled[Pos->ThreadCount], "CWD %s", Pos->RemoteFile)/100 != FTP_COMPLETE)
+						if(CommandProcTrn(TrnSkt, NULL, &Workers[Pos->ThreadCount]->Canceled, "CWD %s", Pos->RemoteFile)/100 != FTP_COMPLETE)
 						{
 							DispCWDerror(hWndTrans);
 							ClearAll = YES;
@@ -916,7 +1332,7 @@ static unsigned __stdcall TransferThread(void *Dummy)
 					}
 				}
 //				strcpy(CurDir, TransPacketBase->RemoteFile);
-				strcpy(CurDir[Pos->ThreadCount], Pos->RemoteFile);
+				strcpy(Workers[Pos->ThreadCount]->CurDir, Pos->RemoteFile);
 				ReleaseMutex(hListAccMutex);
 			}
 			/* カレントディレクトリを戻す */
@@ -929,9 +1345,9 @@ static unsigned __stdcall TransferThread(void *Dummy)
 //					if(strcmp(CurDir, TransPacketBase->RemoteFile) != 0)
 //						CommandProcTrn(NULL, "CWD %s", TransPacketBase->RemoteFile);
 //					strcpy(CurDir, TransPacketBase->RemoteFile);
-					if(strcmp(CurDir[Pos->ThreadCount], Pos->RemoteFile) != 0)
-						CommandProcTrn(TrnSkt, NULL, &Canceled[Pos->ThreadCount], "CWD %s", Pos->RemoteFile);
-					strcpy(CurDir[Pos->ThreadCount], Pos->RemoteFile);
+					if(strcmp(Workers[Pos->ThreadCount]->CurDir, Pos->RemoteFile) != 0)
+						CommandProcTrn(TrnSkt, NULL, &Workers[Pos->ThreadCount]->Canceled, "CWD %s", Pos->RemoteFile);
+					strcpy(Workers[Pos->ThreadCount]->CurDir, Pos->RemoteFile);
 				}
 				ReleaseMutex(hListAccMutex);
 			}
@@ -956,17 +1372,13 @@ static unsigned __stdcall TransferThread(void *Dummy)
 
 			if(ForceAbort == NO)
 			{
-//				WaitForSingleObject(hListAccMutex, INFINITE);
-				while(WaitForSingleObject(hListAccMutex, 0) == WAIT_TIMEOUT)
-				{
-					BackgrndMessageProc();
-					Sleep(1);
-				}
+				LockTransFileList();
 				if(ClearAll == YES)
 //					EraseTransFileList();
 				{
-					for(i = 0; i < MAX_DATA_CONNECTION; i++)
-						Canceled[i] = YES;
+					for(i = 0; i < WorkerCount; i++)
+						Workers[i]->Canceled = YES;
+					Workers[ThreadCount]->Packet = nullptr;
 					if (Pos != end(TransPacketBase))
 						strcpy(Pos->Cmd, "");
 					Pos = end(TransPacketBase);
@@ -986,7 +1398,7 @@ static unsigned __stdcall TransferThread(void *Dummy)
 							TransFiles--;
 						// タスクバー進捗表示
 						if(TransferSizeLeft > 0)
-							TransferSizeLeft -= Pos->Size;
+							TransferSizeLeft -= Pos->Segment ? Pos->SegmentEnd - Pos->SegmentStart : Pos->Size;
 						if(TransferSizeLeft < 0)
 							TransferSizeLeft = 0;
 						if(TransFiles == 0)
@@ -995,6 +1407,10 @@ static unsigned __stdcall TransferThread(void *Dummy)
 					}
 				}
 //				ClearAll = NO;
+				// 他のスレッドが処理中の項目として参照しないよう、転送ファイルリストを保持したまま外す
+				Workers[ThreadCount]->Packet = nullptr;
+				if (Pos != end(TransPacketBase))
+					strcpy(Pos->Cmd, "");
 				ReleaseMutex(hListAccMutex);
 
 				if(BackgrndMessageProc() == YES)
@@ -1004,10 +1420,14 @@ static unsigned __stdcall TransferThread(void *Dummy)
 					ReleaseMutex(hListAccMutex);
 				}
 			}
-			if(hWndTrans != NULL)
-				SendMessageW(hWndTrans, WM_SET_PACKET, 0, 0);
-			if (Pos != end(TransPacketBase))
-				strcpy(Pos->Cmd, "");
+			else
+			{
+				LockTransFileList();
+				Workers[ThreadCount]->Packet = nullptr;
+				if (Pos != end(TransPacketBase))
+					strcpy(Pos->Cmd, "");
+				ReleaseMutex(hListAccMutex);
+			}
 			LastUsed = timeGetTime();
 		}
 //		else
@@ -1015,6 +1435,7 @@ static unsigned __stdcall TransferThread(void *Dummy)
 		{
 			ClearAll = NO;
 			DelNotify = NO;
+			FlushChangedRemotePaths();
 
 			if(GoExit == YES)
 			{
@@ -1032,18 +1453,10 @@ static unsigned __stdcall TransferThread(void *Dummy)
 				GoExit = NO;
 			}
 
-			ReleaseMutex(hListAccMutex);
 			if(KeepDlg == NO)
-			{
-				if(hWndTrans != NULL)
-				{
-					DestroyWindow(hWndTrans);
-					hWndTrans = NULL;
-				}
-			}
-			BackgrndMessageProc();
-//			Sleep(1);
-			Sleep(100);
+				CloseTransDlg(ThreadCount);
+			ReleaseMutex(hListAccMutex);
+			WaitWithMessage(Workers[ThreadCount]->hWakeEvent, IdleTimeout(TrnSkt, ThreadCount, LastUsed, LastNoop));
 
 			// 再転送対応
 			TransferErrorMode = AskTransferErrorMode();
@@ -1051,31 +1464,46 @@ static unsigned __stdcall TransferThread(void *Dummy)
 		}
 		else
 		{
+			CloseTransDlg(ThreadCount);
 			ReleaseMutex(hListAccMutex);
-			if(hWndTrans != NULL)
-			{
-				DestroyWindow(hWndTrans);
-				hWndTrans = NULL;
-			}
-			BackgrndMessageProc();
-			if(ThreadCount < AskMaxThreadCount())
-				Sleep(1);
-			else
-				Sleep(100);
+			// 接続に失敗した場合は待機せずに接続をやり直す
+			if(TrnSkt != INVALID_SOCKET || AskConnecting() == NO || ThreadCount >= AskMaxThreadCount())
+				WaitWithMessage(Workers[ThreadCount]->hWakeEvent, IdleTimeout(TrnSkt, ThreadCount, LastUsed, LastNoop));
 		}
 	}
 	if(AskReuseCmdSkt() == NO || ThreadCount > 0)
 	{
 		if(TrnSkt != INVALID_SOCKET)
 		{
-			SendData(TrnSkt, "QUIT\r\n", 6, 0, &Canceled[ThreadCount]);
+			SendData(TrnSkt, "QUIT\r\n", 6, 0, &Workers[ThreadCount]->Canceled);
 			DoClose(TrnSkt);
 		}
 	}
+	CloseTransDlg(ThreadCount);
 	return 0;
 }
 
 
+// 転送中ダイアログを閉じる
+//   ダイアログは作成したスレッドでのみ破棄できるため、他のスレッドからは作成したスレッドを起こして破棄させる
+//   他の転送スレッドが処理中の間は残す
+static void CloseTransDlg(int ThreadCount) {
+	if (hWndTrans == NULL)
+		return;
+	for (int i = 0; i < WorkerCount; i++)
+		if (Workers[i]->Packet != nullptr)
+			return;
+	if (TransDlgThread != ThreadCount) {
+		SetEvent(Workers[TransDlgThread]->hWakeEvent);
+		return;
+	}
+	DestroyWindow(hWndTrans);
+	hWndTrans = NULL;
+	TransDlgThread = -1;
+	TransDlgShown = -1;
+}
+
+
 /*----- フルパスを使わないファイルアクセスの準備 ------------------------------
 *
 *	Parameter
@@ -1093,7 +1521,7 @@ static unsigned __stdcall TransferThread(void *Dummy)
 *----------------------------------------------------------------------------*/
 
 static int MakeNonFullPath(TRANSPACKET& item, char* Cur) {
-	auto result = ProcForNonFullpath(item.ctrl_skt, item.RemoteFile, Cur, item.hWndTrans, &Canceled[item.ThreadCount]);
+	auto result = ProcForNonFullpath(item.ctrl_skt, item.RemoteFile, Cur, item.hWndTrans, &Workers[item.ThreadCount]->Canceled);
 	if (result == FFFTP_FAIL)
 		ClearAll = YES;
 	return result;
@@ -1131,14 +1559,18 @@ int DoDownload(SOCKET cSkt, TRANSPACKET& item, int DirList, int *CancelCheckWork
 		if(item.Type == TYPE_I)
 			item.KanjiCode = KANJI_NOCNV;
 
+		auto const sent = std::chrono::steady_clock::now();
 		iRetCode = command(item.ctrl_skt, Reply, CancelCheckWork, "TYPE %c", item.Type);
+		// 設定済みのため送らなかった場合は往復時間を計れない
+		if(strlen(Reply) > 0)
+			Workers[item.ThreadCount]->Tuning.Measure(std::chrono::steady_clock::now() - sent);
 		if(iRetCode/100 < FTP_RETRY)
 		{
 			if(item.hWndTrans != NULL)
 			{
 				// 同時接続対応
 //				AllTransSizeNow = 0;
-				AllTransSizeNow[item.ThreadCount] = 0;
+				Workers[item.ThreadCount]->AllTransSizeNow = 0;
 
 				if(DirList == NO)
 					DispTransFileInfo(item, IDS_MSGJPN086, TRUE, YES);
@@ -1378,6 +1810,120 @@ static int DownloadPassive(TRANSPACKET *Pkt, int *CancelCheckWork)
 }
 
 
+// 受信とファイルへの書き込みを並行して行う書き込みスレッド
+//   WRITE_BUFFERS個のバッファを環状に使い、すべて書き込み待ちになると受信側を待たせる
+//   スレッドを使わない場合や、バッファの合計がWRITE_RING_LIMITを超えるか確保できない場合は
+//   バッファ１つに受信し、Commitの中で書き込む
+class FileWriter {
+	std::ofstream& os;
+	const size_t capacity;	// バッファ１つの大きさ
+	size_t buffers = 1;		// 環状に使うバッファの数
+	std::unique_ptr<char, decltype(&_aligned_free)> storage{ nullptr, &_aligned_free };
+	std::array<size_t, WRITE_BUFFERS> lengths{};
+	size_t head = 0;		// 次に受信側が使うバッファ
+	size_t tail = 0;		// 次に書き込むバッファ
+	bool closed = false;
+	bool failed = false;
+	std::mutex mutex;
+	std::condition_variable filled;
+	std::condition_variable emptied;
+	std::future<void> writer;
+	void Run() {
+		for (std::unique_lock lock{ mutex };;) {
+			filled.wait(lock, [this] { return tail != head || closed; });
+			if (tail == head)
+				return;
+			auto const buffer = BufferAt(tail);
+			auto const length = lengths[tail % WRITE_BUFFERS];
+			auto const skip = failed;
+			lock.unlock();
+			auto const written = skip || os.write(buffer, length);
+			lock.lock();
+			if (!written)
+				failed = true;
+			tail++;
+			emptied.notify_one();
+		}
+	}
+	char* BufferAt(size_t index) const {
+		return storage.get() + index % buffers * capacity;
+	}
+public:
+	// threadedがfalseの場合は書き込みスレッドを使わない
+	FileWriter(std::ofstream& os, size_t capacity, bool threaded) : os{ os }, capacity{ capacity } {
+		if (threaded) {
+			if (auto const ring = capacity * WRITE_BUFFERS; WriteRingSize.fetch_add(ring) + ring <= WRITE_RING_LIMIT)
+				storage.reset(static_cast<char*>(_aligned_malloc(ring, 4096)));
+			if (storage) {
+				buffers = WRITE_BUFFERS;
+				writer = std::async(std::launch::async, &FileWriter::Run, this);
+				return;
+			}
+			WriteRingSize -= capacity * WRITE_BUFFERS;
+			DoPrintf("Write buffers unavailable, writing synchronously.");
+		}
+		storage.reset(static_cast<char*>(_aligned_malloc(capacity, 4096)));
+		failed = !storage;
+	}
+	FileWriter(FileWriter const&) = delete;
+	~FileWriter() {
+		Close();
+		if (buffers == WRITE_BUFFERS)
+			WriteRingSize -= capacity * WRITE_BUFFERS;
+	}
+	size_t Capacity() const {
+		return capacity;
+	}
+	// 受信に使う空きバッファ（Capacity()バイト）を返す  書き込みに失敗していればnullptrを返す
+	char* Acquire() {
+		if (!writer.valid())
+			return failed ? nullptr : storage.get();
+		std::unique_lock lock{ mutex };
+		emptied.wait(lock, [this] { return head - tail < WRITE_BUFFERS || failed; });
+		return failed ? nullptr : BufferAt(head);
+	}
+	// Acquireしたバッファの先頭lengthバイトを書き込む
+	void Commit(size_t length) {
+		if (!writer.valid()) {
+			if (!failed && !os.write(storage.get(), length))
+				failed = true;
+			return;
+		}
+		{
+			std::lock_guard lock{ mutex };
+			lengths[head % WRITE_BUFFERS] = length;
+			head++;
+		}
+		filled.notify_one();
+	}
+	// データを複製して書き込む
+	bool Write(std::string_view data) {
+		while (!empty(data)) {
+			auto const buffer = Acquire();
+			if (!buffer)
+				return false;
+			auto const length = std::min(size(data), capacity);
+			std::copy_n(data.data(), length, buffer);
+			Commit(length);
+			data.remove_prefix(length);
+		}
+		return true;
+	}
+	// 書き込み待ちのバッファをすべて書き込んでスレッドを終了する  すべて書き込めた場合はtrueを返す
+	bool Close() {
+		if (writer.valid()) {
+			{
+				std::lock_guard lock{ mutex };
+				closed = true;
+			}
+			filled.notify_one();
+			writer.get();
+		}
+		return !failed;
+	}
+};
+
+
 /*----- ダウンロードの実行 ----------------------------------------------------
 *
 *	Parameter
@@ -1395,11 +1941,12 @@ static int DownloadPassive(TRANSPACKET *Pkt, int *CancelCheckWork)
 *----------------------------------------------------------------------------*/
 
 static int DownloadFile(TRANSPACKET *Pkt, SOCKET dSkt, int CreateMode, int *CancelCheckWork) {
+	auto [sockbuf, appbuf] = Workers[Pkt->ThreadCount]->Tuning.Sizes();
 #ifdef DISABLE_TRANSFER_NETWORK_BUFFERS
 	int buf_size = 0;
 	setsockopt(dSkt, SOL_SOCKET, SO_RCVBUF, (char*)&buf_size, sizeof(buf_size));
 #elif defined(SET_BUFFER_SIZE)
-	for (int buf_size = SOCKBUF_SIZE; buf_size > 0; buf_size /= 2)
+	for (int buf_size = sockbuf; buf_size > 0; buf_size /= 2)
 		if (setsockopt(dSkt, SOL_SOCKET, SO_RCVBUF, (char*)&buf_size, sizeof(buf_size)) == 0)
 			break;
 #endif
@@ -1409,22 +1956,57 @@ static int DownloadFile(TRANSPACKET *Pkt, SOCKET dSkt, int CreateMode, int *Canc
 		if (Message<IDS_MSGJPN086>(IDS_REMOVE_READONLY, MB_YESNO) == IDYES)
 			SetFileAttributesW(fs::u8path(Pkt->LocalFile).c_str(), attr & ~FILE_ATTRIBUTE_READONLY);
 
+	// ファイル一覧を受信しながら解析する場合、LocalFileが空ならファイルには保存しない
+	auto const save = Pkt->List == NULL || Pkt->LocalFile[0] != NUL;
 	auto opened = false;
-	if (std::ofstream os{ fs::u8path(Pkt->LocalFile), std::ios::binary | (CreateMode == OPEN_ALWAYS ? std::ios::ate : std::ios::trunc) }) {
+	auto const from = Pkt->ExistSize;
+	// 分割ダウンロードでは拡張済みの一時ファイルの受信する範囲の位置に書き込む  再開する場合は末尾に追記する
+	auto const mode = Pkt->Segment ? std::ios::in | std::ios::out : CreateMode == OPEN_ALWAYS ? std::ios::app : std::ios::trunc;
+	// バイナリ転送では変換を行わず、受信バッファをストリームのバッファを介さずにそのままファイルに書き込む
+	auto const binary = Pkt->Type == TYPE_I && Pkt->List == NULL;
+	if (std::ofstream os; !save || (os.open(Pkt->Segment ? Pkt->Segment->Temporary() : fs::u8path(Pkt->LocalFile), std::ios::binary | mode), os)) {
 		opened = true;
+		// バッファの設定はストリームを操作する前に行う必要があるため、開いた直後に設定してから書き込む位置に移動する
+		if (binary)
+			os.rdbuf()->pubsetbuf(nullptr, 0);
+		if (Pkt->Segment)
+			os.seekp(Pkt->ExistSize);
 
 		if (Pkt->hWndTrans != NULL) {
-			TimeStart[Pkt->ThreadCount] = time(NULL);
-			SetTimer(Pkt->hWndTrans, TIMER_DISPLAY, DISPLAY_TIMING, NULL);
+			Workers[Pkt->ThreadCount]->TimeStart = time(NULL);
+			Workers[Pkt->ThreadCount]->Transferring = YES;
 		}
 
 		CodeConverter cc{ Pkt->KanjiCode, Pkt->KanjiCodeDesired, Pkt->KanaCnv != NO };
 
+		// ファイルへの書き込みは書き込みスレッドで受信と並行して行う
+		//   残りが書き込み待ちバッファに収まる小さなファイルはスレッドを使わずに書き込む
+		std::optional<FileWriter> writer;
+		if (save) {
+			auto const remaining = Pkt->Segment ? Pkt->SegmentEnd - Pkt->ExistSize : 0 < Pkt->Size ? Pkt->Size - Pkt->ExistSize : -1;
+			writer.emplace(os, appbuf, remaining < 0 || LONGLONG(appbuf) * WRITE_BUFFERS < remaining);
+		}
+
 		/*===== ファイルを受信するループ =====*/
 		int read = 0;
+		LONGLONG transferred = 0;
+		auto const start = std::chrono::steady_clock::now();
+		std::vector<char> buf(binary ? 0 : appbuf);
 		while (Pkt->Abort == ABORT_NONE && ForceAbort == NO) {
-			char buf[BUFSIZE];
-			if (int timeout; (read = do_recv(dSkt, buf, BUFSIZE, 0, &timeout, CancelCheckWork)) <= 0) {
+			// 分割ダウンロードでは範囲の終了位置までしか受信しない
+			auto length = appbuf;
+			if (Pkt->Segment) {
+				if (Pkt->SegmentEnd <= Pkt->ExistSize)
+					break;
+				length = (int)std::min<LONGLONG>(appbuf, Pkt->SegmentEnd - Pkt->ExistSize);
+			}
+			// バイナリ転送では書き込みスレッドの空きバッファに直接受信する
+			auto recvbuf = data(buf);
+			if (binary && !(recvbuf = writer->Acquire())) {
+				Pkt->Abort = ABORT_DISKFULL;
+				break;
+			}
+			if (int timeout; (read = do_recv(dSkt, recvbuf, length, 0, &timeout, CancelCheckWork)) <= 0) {
 				if (timeout == YES) {
 					SetErrorMsg(GetString(IDS_MSGJPN094));
 					SetTaskMsg(IDS_MSGJPN094);
@@ -1439,12 +2021,20 @@ static int DownloadFile(TRANSPACKET *Pkt, SOCKET dSkt, int CreateMode, int *Canc
 				break;
 			}
 
-			if (auto converted = cc.Convert({ buf, (size_t)read }); !os.write(data(converted), size(converted)))
-				Pkt->Abort = ABORT_DISKFULL;
+			if (binary)
+				writer->Commit(read);
+			else {
+				auto converted = cc.Convert({ data(buf), (size_t)read });
+				if (Pkt->List != NULL)
+					Pkt->List->Write(converted);
+				if (save && !writer->Write(converted))
+					Pkt->Abort = ABORT_DISKFULL;
+			}
 
 			Pkt->ExistSize += read;
+			transferred += read;
 			if (Pkt->hWndTrans != NULL)
-				AllTransSizeNow[Pkt->ThreadCount] += read;
+				Workers[Pkt->ThreadCount]->AllTransSizeNow += read;
 			else {
 				/* 転送ダイアログを出さない時の経過表示 */
 				DispDownloadSize(Pkt->ExistSize);
@@ -1454,11 +2044,20 @@ static int DownloadFile(TRANSPACKET *Pkt, SOCKET dSkt, int CreateMode, int *Canc
 				ForceAbort = YES;
 		}
 
+		// 分割ダウンロードで範囲の終了位置より前にデータコネクションが閉じられた
+		if (Pkt->Segment && Pkt->Abort == ABORT_NONE && ForceAbort == NO && Pkt->ExistSize < Pkt->SegmentEnd)
+			Pkt->Abort = ABORT_ERROR;
+
+		// 書き込み待ちのデータをすべて書き込む  書き込みに失敗していればディスクフルとする
+		if (writer && !writer->Close())
+			Pkt->Abort = ABORT_DISKFULL;
+		if (Pkt->Abort == ABORT_NONE)
+			Workers[Pkt->ThreadCount]->Tuning.Update(transferred, std::chrono::steady_clock::now() - start);
+
 		/* グラフ表示を更新 */
 		if (Pkt->hWndTrans != NULL) {
-			KillTimer(Pkt->hWndTrans, TIMER_DISPLAY);
-			DispTransferStatus(Pkt->hWndTrans, YES, Pkt);
-			TimeStart[Pkt->ThreadCount] = time(NULL) - TimeStart[Pkt->ThreadCount] + 1;
+			Workers[Pkt->ThreadCount]->Transferring = NO;
+			Workers[Pkt->ThreadCount]->TimeStart = time(NULL) - Workers[Pkt->ThreadCount]->TimeStart + 1;
 		} else {
 			/* 転送ダイアログを出さない時の経過表示を消す */
 			DispDownloadSize(-1);
@@ -1485,6 +2084,14 @@ static int DownloadFile(TRANSPACKET *Pkt, SOCKET dSkt, int CreateMode, int *Canc
 	}
 
 	auto [code, text] = ReadReplyMessage(Pkt->ctrl_skt, CancelCheckWork);
+	if (Pkt->Segment) {
+		// 範囲を受信し終えた時点でデータコネクションを閉じるため、書き込みを終えていれば転送中断の4xx応答（426、ProFTPDなどは451や450）も成功とみなす
+		if (Pkt->Abort == ABORT_NONE && Pkt->SegmentEnd <= Pkt->ExistSize && code / 100 == FTP_RETRY)
+			code = 226;
+		// 完了の応答を受けた範囲と、こちらから中断するまでに書き込めた範囲を受信済みとして記録する
+		if ((Pkt->Abort == ABORT_NONE ? code / 100 == FTP_COMPLETE : Pkt->Abort != ABORT_DISKFULL) && Pkt->Segment->Complete(from, Pkt->ExistSize))
+			DoPrintf("Segmented download completed : %s", Pkt->LocalFile);
+	}
 	if (Pkt->Abort == ABORT_DISKFULL) {
 		SetErrorMsg(GetString(IDS_MSGJPN096));
 		SetTaskMsg(IDS_MSGJPN096);
@@ -1531,14 +2138,14 @@ static void DispDownloadFinishMsg(TRANSPACKET *Pkt, int iRetCode)
 //			if((strncmp(Pkt->Cmd, "NLST", 4) == 0) || (strncmp(Pkt->Cmd, "LIST", 4) == 0))
 			if((strncmp(Pkt->Cmd, "NLST", 4) == 0) || (strncmp(Pkt->Cmd, "LIST", 4) == 0) || (strncmp(Pkt->Cmd, "MLSD", 4) == 0))
 				SetTaskMsg(IDS_MSGJPN097);
-			else if((Pkt->hWndTrans != NULL) && (TimeStart[Pkt->ThreadCount] != 0))
-				SetTaskMsg(IDS_MSGJPN099, TimeStart[Pkt->ThreadCount], Pkt->ExistSize/TimeStart[Pkt->ThreadCount]);
+			else if((Pkt->hWndTrans != NULL) && (Workers[Pkt->ThreadCount]->TimeStart != 0))
+				SetTaskMsg(IDS_MSGJPN099, Workers[Pkt->ThreadCount]->TimeStart, Pkt->ExistSize/Workers[Pkt->ThreadCount]->TimeStart);
 			else
 				SetTaskMsg(IDS_MSGJPN100);
 
 			if(Pkt->Abort != ABORT_USER)
 			{
-				if(Canceled[Pkt->ThreadCount] == NO && ClearAll == NO)
+				if(Workers[Pkt->ThreadCount]->Canceled == NO && ClearAll == NO)
 				{
 					if(strncmp(Pkt->Cmd, "RETR", 4) == 0 || strncmp(Pkt->Cmd, "STOR", 4) == 0)
 					{
@@ -1548,7 +2155,8 @@ static void DispDownloadFinishMsg(TRANSPACKET *Pkt, int iRetCode)
 							ClearAll = YES;
 						else
 						{
-							Pkt->Mode = TransferErrorMode;
+							// 分割ダウンロードの範囲は受信済みの位置から再開する
+							Pkt->Mode = Pkt->Segment && TransferErrorMode != EXIST_IGNORE ? EXIST_RESUME : TransferErrorMode;
 							AddTransFileList(Pkt);
 						}
 						// タスクバー進捗表示
@@ -1563,8 +2171,8 @@ static void DispDownloadFinishMsg(TRANSPACKET *Pkt, int iRetCode)
 //			if((strncmp(Pkt->Cmd, "NLST", 4) == 0) || (strncmp(Pkt->Cmd, "LIST", 4) == 0))
 			if((strncmp(Pkt->Cmd, "NLST", 4) == 0) || (strncmp(Pkt->Cmd, "LIST", 4) == 0) || (strncmp(Pkt->Cmd, "MLSD", 4) == 0))
 				SetTaskMsg(IDS_MSGJPN101, Pkt->ExistSize);
-			else if((Pkt->hWndTrans != NULL) && (TimeStart[Pkt->ThreadCount] != 0))
-				SetTaskMsg(IDS_MSGJPN102, (LONG)TimeStart[Pkt->ThreadCount], (LONG)(Pkt->ExistSize/TimeStart[Pkt->ThreadCount]));
+			else if((Pkt->hWndTrans != NULL) && (Workers[Pkt->ThreadCount]->TimeStart != 0))
+				SetTaskMsg(IDS_MSGJPN102, (LONG)Workers[Pkt->ThreadCount]->TimeStart, (LONG)(Pkt->ExistSize/Workers[Pkt->ThreadCount]->TimeStart));
 			else
 				SetTaskMsg(IDS_MSGJPN103, Pkt->ExistSize);
 		}
@@ -1651,6 +2259,11 @@ static int SetDownloadResume(TRANSPACKET *Pkt, int ProcMode, LONGLONG Size, int
 			if (Pkt->hWndTrans != NULL)
 				Pkt->ExistSize = Size;
 			*Mode = OPEN_ALWAYS;
+		} else if (Pkt->Segment) {
+			/* 分割ダウンロードは途中から受信できなければ続けられない */
+			SetErrorMsg(u8(Reply));
+			Pkt->Abort = ABORT_ERROR;
+			Com = NO;
 		} else {
 			Com = Dialog(GetFtpInst(), noresume_dlg, Pkt->hWndTrans, Data{});
 			if (Com != YES) {
@@ -1687,7 +2300,10 @@ static int DoUpload(SOCKET cSkt, TRANSPACKET& item)
 			if(item.Type == TYPE_I)
 				item.KanjiCode = KANJI_NOCNV;
 
-			iRetCode = command(item.ctrl_skt, Reply, &Canceled[item.ThreadCount], "TYPE %c", item.Type);
+			auto const sent = std::chrono::steady_clock::now();
+			iRetCode = command(item.ctrl_skt, Reply, &Workers[item.ThreadCount]->Canceled, "TYPE %c", item.Type);
+			if(strlen(Reply) > 0)
+				Workers[item.ThreadCount]->Tuning.Measure(std::chrono::steady_clock::now() - sent);
 			if(iRetCode/100 < FTP_RETRY)
 			{
 				if(item.Mode == EXIST_UNIQUE)
@@ -1711,7 +2327,7 @@ static int DoUpload(SOCKET cSkt, TRANSPACKET& item)
 
 			/* 属性変更 */
 			if((item.Attr != -1) && ((iRetCode/100) == FTP_COMPLETE))
-				command(item.ctrl_skt, Reply, &Canceled[item.ThreadCount], "%s %03X %s", AskHostChmodCmd().c_str(), item.Attr, item.RemoteFile);
+				command(item.ctrl_skt, Reply, &Workers[item.ThreadCount]->Canceled, "%s %03X %s", AskHostChmodCmd().c_str(), item.Attr, item.RemoteFile);
 		}
 		else
 		{
@@ -1756,7 +2372,7 @@ static int UploadNonPassive(TRANSPACKET *Pkt)
 
 	// 同時接続対応
 //	if((listen_socket = GetFTPListenSocket(Pkt->ctrl_skt, &Canceled)) != INVALID_SOCKET)
-	if((listen_socket = GetFTPListenSocket(Pkt->ctrl_skt, &Canceled[Pkt->ThreadCount])) != INVALID_SOCKET)
+	if((listen_socket = GetFTPListenSocket(Pkt->ctrl_skt, &Workers[Pkt->ThreadCount]->Canceled)) != INVALID_SOCKET)
 	{
 		SetUploadResume(Pkt, Pkt->Mode, Pkt->ExistSize, &Resume);
 		if(Resume == NO)
@@ -1776,7 +2392,7 @@ static int UploadNonPassive(TRANSPACKET *Pkt)
 
 		// 同時接続対応
 //		iRetCode = command(Pkt->ctrl_skt, Reply, &Canceled, "%s", Buf);
-		iRetCode = command(Pkt->ctrl_skt, Reply, &Canceled[Pkt->ThreadCount], "%s", Buf);
+		iRetCode = command(Pkt->ctrl_skt, Reply, &Workers[Pkt->ThreadCount]->Canceled, "%s", Buf);
 		if((iRetCode/100) == FTP_PRELIM)
 		{
 			// STOUの応答を処理
@@ -1784,7 +2400,7 @@ static int UploadNonPassive(TRANSPACKET *Pkt)
 			if(Pkt->Mode == EXIST_UNIQUE)
 				Pkt->Attr = -1;
 			if (AskHostFireWall() == YES && (FwallType == FWALL_SOCKS4 || FwallType == FWALL_SOCKS5_NOAUTH || FwallType == FWALL_SOCKS5_USER)) {
-				if (SocksReceiveReply(listen_socket, &Canceled[Pkt->ThreadCount]))
+				if (SocksReceiveReply(listen_socket, &Workers[Pkt->ThreadCount]->Canceled))
 					data_socket = listen_socket;
 				else
 					listen_socket = DoClose(listen_socket);
@@ -1821,7 +2437,7 @@ static int UploadNonPassive(TRANSPACKET *Pkt)
 //				iRetCode = UploadFile(Pkt, data_socket);
 				if(IsSSLAttached(Pkt->ctrl_skt))
 				{
-					if (AttachSSL(data_socket, Pkt->ctrl_skt, &Canceled[Pkt->ThreadCount], {}))
+					if (AttachSSL(data_socket, Pkt->ctrl_skt, &Workers[Pkt->ThreadCount]->Canceled, {}))
 						iRetCode = UploadFile(Pkt, data_socket);
 					else
 						iRetCode = 500;
@@ -1884,14 +2500,14 @@ static int UploadPassive(TRANSPACKET *Pkt)
 	// 同時接続対応
 //	iRetCode = command(Pkt->ctrl_skt, Buf, &Canceled, "PASV");
 	// IPv6対応
-//	iRetCode = command(Pkt->ctrl_skt, Buf, &Canceled[Pkt->ThreadCount], "PASV");
+//	iRetCode = command(Pkt->ctrl_skt, Buf, &Workers[Pkt->ThreadCount]->Canceled, "PASV");
 	switch(AskCurNetType())
 	{
 	case NTYPE_IPV4:
-		iRetCode = command(Pkt->ctrl_skt, Buf, &Canceled[Pkt->ThreadCount], "PASV");
+		iRetCode = command(Pkt->ctrl_skt, Buf, &Workers[Pkt->ThreadCount]->Canceled, "PASV");
 		break;
 	case NTYPE_IPV6:
-		iRetCode = command(Pkt->ctrl_skt, Buf, &Canceled[Pkt->ThreadCount], "EPSV");
+		iRetCode = command(Pkt->ctrl_skt, Buf, &Workers[Pkt->ThreadCount]->Canceled, "EPSV");
 		break;
 	}
 	if(iRetCode/100 == FTP_COMPLETE)
@@ -1900,7 +2516,7 @@ static int UploadPassive(TRANSPACKET *Pkt)
 //		if(GetAdrsAndPort(Buf, Adrs, &Port, 19) == FFFTP_SUCCESS)
 		if(GetAdrsAndPort(Pkt->ctrl_skt, Buf, Adrs, &Port, 39) == FFFTP_SUCCESS)
 		{
-			if((data_socket = connectsock(Adrs, Port, IDS_MSGJPN109, &Canceled[Pkt->ThreadCount])) != INVALID_SOCKET)
+			if((data_socket = connectsock(Adrs, Port, IDS_MSGJPN109, &Workers[Pkt->ThreadCount]->Canceled)) != INVALID_SOCKET)
 			{
 				// 変数が未初期化のバグ修正
 				Flg = 1;
@@ -1925,7 +2541,7 @@ static int UploadPassive(TRANSPACKET *Pkt)
 
 				// 同時接続対応
 //				iRetCode = command(Pkt->ctrl_skt, Reply, &Canceled, "%s", Buf);
-				iRetCode = command(Pkt->ctrl_skt, Reply, &Canceled[Pkt->ThreadCount], "%s", Buf);
+				iRetCode = command(Pkt->ctrl_skt, Reply, &Workers[Pkt->ThreadCount]->Canceled, "%s", Buf);
 				if(iRetCode/100 == FTP_PRELIM)
 				{
 					// STOUの応答を処理
@@ -1938,7 +2554,7 @@ static int UploadPassive(TRANSPACKET *Pkt)
 //					iRetCode = UploadFile(Pkt, data_socket);
 					if(IsSSLAttached(Pkt->ctrl_skt))
 					{
-						if (AttachSSL(data_socket, Pkt->ctrl_skt, &Canceled[Pkt->ThreadCount], {}))
+						if (AttachSSL(data_socket, Pkt->ctrl_skt, &Workers[Pkt->ThreadCount]->Canceled, {}))
 							iRetCode = UploadFile(Pkt, data_socket);
 						else
 							iRetCode = 500;
@@ -1979,6 +2595,99 @@ static int UploadPassive(TRANSPACKET *Pkt)
 }
 
 
+// アップロードするファイルの読み込みと変換を送信と並行して行う先読みスレッド
+//   変換済みのデータを最大capacity個まで用意しておく  capacityが0の場合は送信側で読み込む
+class FileReader {
+public:
+	struct Chunk {
+		std::string data;		// 送信するデータ
+		std::streamsize read;	// ファイルから読み込んだバイト数
+	};
+private:
+	std::ifstream& is;
+	CodeConverter cc;
+	NewlineConverter nc{ true };
+	const int type;
+	const size_t capacity;
+	std::vector<char> buf;
+	bool eof = false;
+	std::deque<Chunk> chunks;
+	bool stopped = false;
+	bool done = false;
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::condition_variable consumed;
+	std::future<void> reader;
+	std::optional<Chunk> Read() {
+		std::streamsize read;
+		if (eof || (read = is.read(data(buf), size(buf)).gcount()) == 0)
+			return {};
+		/* EOF除去 */
+		if (RmEOF == YES && type == TYPE_A)
+			if (auto pos = std::find(begin(buf), begin(buf) + read, '\x1A'); pos != begin(buf) + read) {
+				eof = true;
+				read = pos - begin(buf);
+			}
+		auto converted = cc.Convert({ data(buf), (std::string_view::size_type)read });
+		// CR-LF以外の改行コードを変換しないモードはここへ追加
+		if (type == TYPE_A)
+			converted = nc.Convert(converted);
+		return Chunk{ std::move(converted), read };
+	}
+	void Run() {
+		for (;;) {
+			{
+				std::unique_lock lock{ mutex };
+				consumed.wait(lock, [this] { return size(chunks) < capacity || stopped; });
+				if (stopped)
+					return;
+			}
+			auto chunk = Read();
+			{
+				std::lock_guard lock{ mutex };
+				if (chunk)
+					chunks.push_back(std::move(*chunk));
+				else
+					done = true;
+			}
+			ready.notify_one();
+			if (!chunk)
+				return;
+		}
+	}
+public:
+	FileReader(std::ifstream& is, TRANSPACKET const& item, size_t capacity, size_t chunk) : is{ is }, cc{ item.KanjiCodeDesired, item.KanjiCode, item.KanaCnv != NO }, type{ item.Type }, capacity{ capacity }, buf(chunk) {
+		if (0 < capacity)
+			reader = std::async(std::launch::async, &FileReader::Run, this);
+	}
+	FileReader(FileReader const&) = delete;
+	~FileReader() {
+		if (reader.valid()) {
+			{
+				std::lock_guard lock{ mutex };
+				stopped = true;
+			}
+			consumed.notify_one();
+			reader.wait();
+		}
+	}
+	// 次に送信するデータを返す  ファイルの終わりに達した場合はnulloptを返す
+	std::optional<Chunk> Next() {
+		if (!reader.valid())
+			return Read();
+		std::unique_lock lock{ mutex };
+		ready.wait(lock, [this] { return !empty(chunks) || done; });
+		if (empty(chunks))
+			return {};
+		auto chunk = std::move(chunks.front());
+		chunks.pop_front();
+		lock.unlock();
+		consumed.notify_one();
+		return chunk;
+	}
+};
+
+
 /*----- アップロードの実行 ----------------------------------------------------
 *
 *	Parameter
@@ -1994,11 +2703,12 @@ static int UploadPassive(TRANSPACKET *Pkt)
 *----------------------------------------------------------------------------*/
 
 static int UploadFile(TRANSPACKET *Pkt, SOCKET dSkt) {
+	auto [sockbuf, appbuf] = Workers[Pkt->ThreadCount]->Tuning.Sizes();
 #ifdef DISABLE_TRANSFER_NETWORK_BUFFERS
 	int buf_size = 0;
 	setsockopt(dSkt, SOL_SOCKET, SO_SNDBUF, (char*)&buf_size, sizeof(buf_size));
 #elif defined(SET_BUFFER_SIZE)
-	for (int buf_size = SOCKBUF_SIZE; buf_size > 0; buf_size /= 2)
+	for (int buf_size = sockbuf; buf_size > 0; buf_size /= 2)
 		if (setsockopt(dSkt, SOL_SOCKET, SO_SNDBUF, (char*)&buf_size, sizeof(buf_size)) == 0)
 			break;
 #endif
@@ -2009,41 +2719,40 @@ static int UploadFile(TRANSPACKET *Pkt, SOCKET dSkt) {
 			Pkt->Size = is.seekg(0, std::ios::end).tellg();
 			is.seekg(Pkt->ExistSize, std::ios::beg);
 
-			AllTransSizeNow[Pkt->ThreadCount] = 0;
-			TimeStart[Pkt->ThreadCount] = time(NULL);
-			SetTimer(Pkt->hWndTrans, TIMER_DISPLAY, DISPLAY_TIMING, NULL);
+			Workers[Pkt->ThreadCount]->AllTransSizeNow = 0;
+			Workers[Pkt->ThreadCount]->TimeStart = time(NULL);
+			Workers[Pkt->ThreadCount]->Transferring = YES;
 		}
 
-		CodeConverter cc{ Pkt->KanjiCodeDesired, Pkt->KanjiCode, Pkt->KanaCnv != NO };
+		// ファイルの読み込みと変換は送信と並行して先読みする
+		//   残りが先読みするバッファに収まる小さなファイルはスレッドを使わずに送信側で読み込む
+		auto readahead = (size_t)std::clamp(UploadReadAhead, 0, 64);
+		if (std::error_code ec; (LONGLONG)fs::file_size(fs::u8path(Pkt->LocalFile), ec) - Pkt->ExistSize <= LONGLONG(readahead * appbuf))
+			readahead = 0;
+		FileReader reader{ is, *Pkt, readahead, (size_t)appbuf };
 
 		/*===== ファイルを送信するループ =====*/
-		auto eof = false;
-		char buf[BUFSIZE];
-		for (std::streamsize read; Pkt->Abort == ABORT_NONE && ForceAbort == NO && !eof && (read = is.read(buf, std::size(buf)).gcount()) != 0;) {
-			/* EOF除去 */
-			if (RmEOF == YES && Pkt->Type == TYPE_A)
-				if (auto pos = std::find(buf, buf + read, '\x1A'); pos != buf + read) {
-					eof = true;
-					read = pos - buf;
-				}
-
-			auto converted = cc.Convert({ buf, (std::string_view::size_type)read });
-			if (TermCodeConvAndSend(dSkt, data(converted), size_as<DWORD>(converted), Pkt->Type, &Canceled[Pkt->ThreadCount]) == FFFTP_FAIL)
+		LONGLONG transferred = 0;
+		auto const start = std::chrono::steady_clock::now();
+		for (std::optional<FileReader::Chunk> chunk; Pkt->Abort == ABORT_NONE && ForceAbort == NO && (chunk = reader.Next());) {
+			if (SendData(dSkt, data(chunk->data), size_as<int>(chunk->data), 0, &Workers[Pkt->ThreadCount]->Canceled) == FFFTP_FAIL)
 				Pkt->Abort = ABORT_ERROR;
 
-			Pkt->ExistSize += read;
+			Pkt->ExistSize += chunk->read;
+			transferred += chunk->read;
 			if (Pkt->hWndTrans != NULL)
-				AllTransSizeNow[Pkt->ThreadCount] += read;
+				Workers[Pkt->ThreadCount]->AllTransSizeNow += chunk->read;
 
 			if (BackgrndMessageProc() == YES)
 				ForceAbort = YES;
 		}
+		if (Pkt->Abort == ABORT_NONE)
+			Workers[Pkt->ThreadCount]->Tuning.Update(transferred, std::chrono::steady_clock::now() - start);
 
 		/* グラフ表示を更新 */
 		if (Pkt->hWndTrans != NULL) {
-			KillTimer(Pkt->hWndTrans, TIMER_DISPLAY);
-			DispTransferStatus(Pkt->hWndTrans, YES, Pkt);
-			TimeStart[Pkt->ThreadCount] = time(NULL) - TimeStart[Pkt->ThreadCount] + 1;
+			Workers[Pkt->ThreadCount]->Transferring = NO;
+			Workers[Pkt->ThreadCount]->TimeStart = time(NULL) - Workers[Pkt->ThreadCount]->TimeStart + 1;
 		}
 	} else {
 		SetErrorMsg(strprintf(GetString(IDS_MSGJPN112).c_str(), u8(Pkt->LocalFile).c_str()));
@@ -2055,7 +2764,7 @@ static int UploadFile(TRANSPACKET *Pkt, SOCKET dSkt) {
 	if (shutdown(dSkt, 1) != 0)
 		ReportWSError(L"shutdown");
 
-	auto [code, text] = ReadReplyMessage(Pkt->ctrl_skt, &Canceled[Pkt->ThreadCount]);
+	auto [code, text] = ReadReplyMessage(Pkt->ctrl_skt, &Workers[Pkt->ThreadCount]->Canceled);
 	if (code / 100 >= FTP_RETRY)
 		SetErrorMsg(u8(text));
 	if (Pkt->Abort != ABORT_NONE)
@@ -2064,17 +2773,6 @@ static int UploadFile(TRANSPACKET *Pkt, SOCKET dSkt) {
 }
 
 
-// バッファの内容を改行コード変換して送信
-static int TermCodeConvAndSend(SOCKET Skt, char *Data, int Size, int Ascii, int *CancelCheckWork) {
-	// CR-LF以外の改行コードを変換しないモードはここへ追加
-	if (Ascii == TYPE_A) {
-		auto encoded = ToCRLF({ Data, (size_t)Size });
-		return SendData(Skt, data(encoded), size_as<int>(encoded), 0, CancelCheckWork);
-	}
-	return SendData(Skt, Data, Size, 0, CancelCheckWork);
-}
-
-
 /*----- アップロード終了／中止時のメッセージを表示 ----------------------------
 *
 *	Parameter
@@ -2093,8 +2791,8 @@ static void DispUploadFinishMsg(TRANSPACKET *Pkt, int iRetCode)
 	{
 		if((iRetCode/100) >= FTP_CONTINUE)
 		{
-			if((Pkt->hWndTrans != NULL) && (TimeStart[Pkt->ThreadCount] != 0))
-				SetTaskMsg(IDS_MSGJPN113, TimeStart[Pkt->ThreadCount], Pkt->ExistSize/TimeStart[Pkt->ThreadCount]);
+			if((Pkt->hWndTrans != NULL) && (Workers[Pkt->ThreadCount]->TimeStart != 0))
+				SetTaskMsg(IDS_MSGJPN113, Workers[Pkt->ThreadCount]->TimeStart, Pkt->ExistSize/Workers[Pkt->ThreadCount]->TimeStart);
 			else
 				SetTaskMsg(IDS_MSGJPN114);
 
@@ -2103,9 +2801,9 @@ static void DispUploadFinishMsg(TRANSPACKET *Pkt, int iRetCode)
 				// 全て中止を選択後にダイアログが表示されるバグ対策
 //				if(DispUpDownErrDialog(uperr_dlg, Pkt->hWndTrans, Pkt->LocalFile) == NO)
 				// 再転送対応
-//				if(Canceled[Pkt->ThreadCount] == NO && ClearAll == NO && DispUpDownErrDialog(uperr_dlg, Pkt->hWndTrans, Pkt->LocalFile) == NO)
+//				if(Workers[Pkt->ThreadCount]->Canceled == NO && ClearAll == NO && DispUpDownErrDialog(uperr_dlg, Pkt->hWndTrans, Pkt->LocalFile) == NO)
 //					ClearAll = YES;
-				if(Canceled[Pkt->ThreadCount] == NO && ClearAll == NO)
+				if(Workers[Pkt->ThreadCount]->Canceled == NO && ClearAll == NO)
 				{
 					if(strncmp(Pkt->Cmd, "RETR", 4) == 0 || strncmp(Pkt->Cmd, "STOR", 4) == 0)
 					{
@@ -2126,8 +2824,8 @@ static void DispUploadFinishMsg(TRANSPACKET *Pkt, int iRetCode)
 		}
 		else
 		{
-			if((Pkt->hWndTrans != NULL) && (TimeStart[Pkt->ThreadCount] != 0))
-				SetTaskMsg(IDS_MSGJPN115, (LONG)TimeStart[Pkt->ThreadCount], (LONG)(Pkt->ExistSize/TimeStart[Pkt->ThreadCount]));
+			if((Pkt->hWndTrans != NULL) && (Workers[Pkt->ThreadCount]->TimeStart != 0))
+				SetTaskMsg(IDS_MSGJPN115, (LONG)Workers[Pkt->ThreadCount]->TimeStart, (LONG)(Pkt->ExistSize/Workers[Pkt->ThreadCount]->TimeStart));
 			else
 				SetTaskMsg(IDS_MSGJPN116);
 		}
@@ -2205,6 +2903,7 @@ static LRESULT CALLBACK TransDlgProc(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM
 
 			hMenu = GetSystemMenu(hDlg, FALSE);
 			EnableMenuItem(hMenu, SC_CLOSE, MF_GRAYED);
+			SetTimer(hDlg, TIMER_DISPLAY, DISPLAY_TIMING, NULL);
 			break;
 
 		case WM_COMMAND :
@@ -2216,16 +2915,20 @@ static LRESULT CALLBACK TransDlgProc(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM
 
 				case TRANS_STOP_ALL :
 					ClearAll = YES;
-					for(i = 0; i < MAX_DATA_CONNECTION; i++)
-						Canceled[i] = YES;
+					for(i = 0; i < WorkerCount; i++)
+						Workers[i]->Canceled = YES;
 					/* ここに break はない */
 
 				case IDCANCEL :
-					if(!(Pkt = (TRANSPACKET*)GetWindowLongPtrW(hDlg, GWLP_USERDATA)))
-						break;
-					Pkt->Abort = ABORT_USER;
-//					Canceled = YES;
-					Canceled[Pkt->ThreadCount] = YES;
+					// ファイル名を表示している転送を中止する
+					LockTransFileList();
+					if(TransDlgShown != -1 && (Pkt = Workers[TransDlgShown]->Packet) != nullptr)
+					{
+						Pkt->Abort = ABORT_USER;
+//						Canceled = YES;
+						Workers[TransDlgShown]->Canceled = YES;
+					}
+					ReleaseMutex(hListAccMutex);
 					break;
 			}
 			break;
@@ -2236,24 +2939,17 @@ static LRESULT CALLBACK TransDlgProc(HWND hDlg, UINT Msg, WPARAM wParam, LPARAM
 				if(MoveToForeground == YES)
 					SetForegroundWindow(hDlg);
 				MoveToForeground = NO;
-				KillTimer(hDlg, TIMER_DISPLAY);
-				if(!(Pkt = (TRANSPACKET*)GetWindowLongPtrW(hDlg, GWLP_USERDATA)))
-					break;
-				DispTransferStatus(hDlg, NO, Pkt);
-				SetTimer(hDlg, TIMER_DISPLAY, DISPLAY_TIMING, NULL);
+				DispTransferStatus(hDlg);
 			}
 			break;
-
-		case WM_SET_PACKET :
-			SetWindowLongPtrW(hDlg, GWLP_USERDATA, (LONG_PTR)lParam);
-			break;
 	}
 	return(FALSE);
 }
 
 
 // 転送ステータスを表示
-static void DispTransferStatus(HWND hWnd, int End, TRANSPACKET* Pkt) {
+//   複数の接続で転送している場合は転送中のファイルの合計を表示する
+static void DispTransferStatus(HWND hWnd) {
 	if (!hWnd)
 		return;
 	{
@@ -2262,30 +2958,58 @@ static void DispTransferStatus(HWND hWnd, int End, TRANSPACKET* Pkt) {
 		title = boost::regex_replace(title, re, L'(' + std::to_wstring(AskTransferFileNum()) + L')');
 		SetText(hWnd, title);
 	}
+	// 各転送スレッドの転送ファイル情報は転送ファイルリストを保持して読み取る  使用中の場合は次回に表示する
+	if (WaitForSingleObject(hListAccMutex, 0) != WAIT_OBJECT_0)
+		return;
+	LONGLONG Size = 0;
+	LONGLONG ExistSize = 0;
+	LONGLONG Bps = 0;
+	int Active = 0;
+	bool UnknownSize = false;
+	auto const Cancelled = TransDlgShown != -1 && Workers[TransDlgShown]->Packet != nullptr && Workers[TransDlgShown]->Packet->Abort != ABORT_NONE;
+	for (int i = 0; i < WorkerCount; i++) {
+		auto const& worker = *Workers[i];
+		auto const Pkt = worker.Packet;
+		if (Pkt == nullptr || worker.Transferring == NO)
+			continue;
+		Active++;
+		// 分割ダウンロードは受信する範囲のみを数える
+		auto const start = Pkt->Segment ? Pkt->SegmentStart : 0;
+		if (Pkt->Segment)
+			Size += Pkt->SegmentEnd - start;
+		else if (0 < Pkt->Size)
+			Size += Pkt->Size;
+		else
+			UnknownSize = true;
+		ExistSize += Pkt->ExistSize - start;
+		if (auto const TotalLap = time(nullptr) - worker.TimeStart + 1; TotalLap != 0)
+			Bps += worker.AllTransSizeNow / TotalLap;
+	}
+	ReleaseMutex(hListAccMutex);
+	if (UnknownSize)
+		Size = 0;
 	{
 		std::wstring status;
-		if (Pkt->Abort != ABORT_NONE)
+		if (Cancelled)
 			status = GetString(IDS_CANCELLED);
-		else if (End != NO)
-			status = GetString(IDS_FINISHED);
+		else if (Active == 0)
+			return;
 		else {
 			std::wstringstream ss;
 			ss.imbue(std::locale{ "" });
 			ss << std::fixed << std::setprecision(1);
 
-			if (Pkt->Size <= 0)
-				ss << Pkt->ExistSize << L"B ";
-			else if (Pkt->Size < 1024)
-				ss << Pkt->ExistSize << L"B / " << Pkt->Size << L"B ";
-			else if (Pkt->Size < 1024 * 1024)
-				ss << Pkt->ExistSize / 1024. << L"KB / " << Pkt->Size / 1024. << L"KB ";
-			else if (Pkt->Size < 1024 * 1024 * 1024)
-				ss << Pkt->ExistSize / 1024 / 1024. << L"MB / " << Pkt->Size / 1024 / 1024. << L"MB ";
+			if (Size <= 0)
+				ss << ExistSize << L"B ";
+			else if (Size < 1024)
+				ss << ExistSize << L"B / " << Size << L"B ";
+			else if (Size < 1024 * 1024)
+				ss << ExistSize / 1024. << L"KB / " << Size / 1024. << L"KB ";
+			else if (Size < 1024 * 1024 * 1024)
+				ss << ExistSize / 1024 / 1024. << L"MB / " << Size / 1024 / 1024. << L"MB ";
 			else
-				ss << Pkt->ExistSize / 1024 / 1024 / 1024. << L"GB / " << Pkt->Size / 1024 / 1024 / 1024. << L"GB ";
+				ss << ExistSize / 1024 / 1024 / 1024. << L"GB / " << Size / 1024 / 1024 / 1024. << L"GB ";
 
-			auto TotalLap = time(nullptr) - TimeStart[Pkt->ThreadCount] + 1;
-			auto Bps = TotalLap != 0 ? AllTransSizeNow[Pkt->ThreadCount] / TotalLap : 0;
 			if (Bps < 1024)
 				ss << L"( " << Bps << L"B/s )";
 			else if (Bps < 1024 * 1024)
@@ -2295,7 +3019,7 @@ static void DispTransferStatus(HWND hWnd, int End, TRANSPACKET* Pkt) {
 			else
 				ss << L"( " << Bps / 1024 / 1024 / 1024. << L"GB/s )";
 
-			if (auto Transed = Pkt->Size - Pkt->ExistSize; 0 < Bps && 0 < Pkt->Size && 0 <= Transed)
+			if (auto Transed = Size - ExistSize; 0 < Bps && 0 < Size && 0 <= Transed)
 				ss << L"  " << Transed / Bps / 60 << L':' << std::setfill(L'0') << std::setw(2) << Transed / Bps % 60;
 			else
 				ss << L"  ??:??";
@@ -2305,7 +3029,7 @@ static void DispTransferStatus(HWND hWnd, int End, TRANSPACKET* Pkt) {
 		SetText(hWnd, TRANS_STATUS, status);
 	}
 	{
-		int percent = Pkt->Size <= 0 ? 0 : Pkt->Size < std::numeric_limits<decltype(Pkt->Size)>::max() / 100 ? (int)(Pkt->ExistSize * 100 / Pkt->Size) : (int)((Pkt->ExistSize / 1024) * 100 / (Pkt->Size / 1024));
+		int percent = Size <= 0 ? 0 : Size < std::numeric_limits<decltype(Size)>::max() / 100 ? (int)(ExistSize * 100 / Size) : (int)((ExistSize / 1024) * 100 / (Size / 1024));
 		SendDlgItemMessageW(hWnd, TRANS_TIME_BAR, PBM_SETPOS, percent, 0);
 	}
 }
@@ -2325,6 +3049,7 @@ static void DispTransferStatus(HWND hWnd, int End, TRANSPACKET* Pkt) {
 
 static void DispTransFileInfo(TRANSPACKET const& item, UINT titleId, int SkipButton, int Info) {
 	if (item.hWndTrans != NULL) {
+		TransDlgShown = item.ThreadCount;
 		EnableWindow(GetDlgItem(item.hWndTrans, IDCANCEL), SkipButton);
 
 		SetText(item.hWndTrans, strprintf(L"(%d)%s", AskTransferFileNum(), GetString(titleId).c_str()));
@@ -167,6 +167,14 @@ int ConnectAndSet = YES;
 int FnameCnv = FNAME_NOCNV;
 int TimeOut = 90;
 int RmEOF = NO;
+int UploadReadAhead = 4;
+int AutoTuneBuffer = YES;
+int SegmentThreshold = 0;
+int TransferSchedule = SCHEDULE_FIFO;
+int PipelineWindow = 0;
+int PrewarmConnections = 0;
+int TransferIdleTime = 60;
+int ListCache = YES;
 int RegType = REGTYPE_REG;
 int FwallPort = IPPORT_FTP;
 int FwallType = 1;
@@ -691,7 +699,7 @@ static LRESULT CALLBACK FtpWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARA
 						{
 							char Name[FMAX_PATH+1];
 							int Pos;
-							std::vector<FILELIST> Base;
+							FileList Base;
 							MakeSelectedFileList(WIN_LOCAL, NO, NO, Base, &CancelFlg);
 							GetHotSelected(WIN_LOCAL, Name);
 							Pos = (int)SendMessageW(GetLocalHwnd(), LVM_GETTOPINDEX, 0, 0);
@@ -1511,6 +1519,11 @@ static LRESULT CALLBACK FtpWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARA
 				PostMessageW(hWnd,  WM_COMMAND, MAKEWPARAM(REFRESH_REMOTE, 0), 0);
 			break;
 
+		case WM_REVALIDATE_REMOTE :
+			CancelFlg = NO;
+			RevalidateRemoteDir(&CancelFlg);
+			break;
+
 		// UPnP対応
 		case WM_ADDPORTMAPPING :
 			((ADDPORTMAPPINGDATA*)lParam)->r = AddPortMapping(((ADDPORTMAPPINGDATA*)lParam)->Adrs, ((ADDPORTMAPPINGDATA*)lParam)->Port, ((ADDPORTMAPPINGDATA*)lParam)->ExtAdrs);
@@ -0,0 +1,53 @@
+﻿#pragma once
+#include <bit>
+#include <string>
+#include <string_view>
+#include <emmintrin.h>
+
+// pos以降で最初のCRまたはLFの位置を返す  見つからない場合はsize(str)を返す
+inline size_t FindNewline(std::string_view str, size_t pos) {
+	for (auto const cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n'); pos + 16 <= size(str); pos += 16) {
+		auto const v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data(str) + pos));
+		if (auto const mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf))))
+			return pos + std::countr_zero(static_cast<unsigned>(mask));
+	}
+	for (; pos < size(str); pos++)
+		if (str[pos] == '\r' || str[pos] == '\n')
+			return pos;
+	return size(str);
+}
+
+// 改行コードを逐次変換する  crlf=trueならCRLFに、falseならLFに揃える
+//   改行コード（CRLF、CR、LF）のいずれも変換し、CRで終わったチャンクの次のチャンクがLFで始まる場合は、合わせて１つの改行とする
+class NewlineConverter {
+	const bool crlf;
+	bool cr = false;
+public:
+	NewlineConverter(bool crlf) : crlf{ crlf } {}
+	std::string Convert(std::string_view input) {
+		if (empty(input))
+			return {};
+		auto const newline = crlf ? std::string_view{ "\r\n" } : std::string_view{ "\n" };
+		std::string result;
+		result.reserve(size(input) + size(input) / 16);
+		size_t pos = cr && input[0] == '\n' ? 1 : 0;
+		cr = false;
+		for (;;) {
+			auto const found = FindNewline(input, pos);
+			result.append(input, pos, found - pos);
+			if (found == size(input))
+				break;
+			result += newline;
+			pos = found + 1;
+			if (input[found] == '\r') {
+				if (pos == size(input)) {
+					cr = true;
+					break;
+				}
+				if (input[pos] == '\n')
+					pos++;
+			}
+		}
+		return result;
+	}
+};
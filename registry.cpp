@@ -242,6 +242,14 @@ extern int FnameCnv;
 extern int ConnectAndSet;
 extern int TimeOut;
 extern int RmEOF;
+extern int UploadReadAhead;
+extern int AutoTuneBuffer;
+extern int SegmentThreshold;
+extern int TransferSchedule;
+extern int PipelineWindow;
+extern int PrewarmConnections;
+extern int TransferIdleTime;
+extern int ListCache;
 extern int RegType;
 extern std::wstring FwallHost;
 extern std::wstring FwallUser;
@@ -551,6 +559,14 @@ void SaveRegistry() {
 			hKey4->WriteString("Path"sv, DefaultLocalPath);
 			hKey4->WriteIntValueToReg("Time", SaveTimeStamp);
 			hKey4->WriteIntValueToReg("EOF", RmEOF);
+			hKey4->WriteIntValueToReg("ReadAhead", UploadReadAhead);
+			hKey4->WriteIntValueToReg("AutoBuf", AutoTuneBuffer);
+			hKey4->WriteIntValueToReg("Segment", SegmentThreshold);
+			hKey4->WriteIntValueToReg("Schedule", TransferSchedule);
+			hKey4->WriteIntValueToReg("Pipeline", PipelineWindow);
+			hKey4->WriteIntValueToReg("Prewarm", PrewarmConnections);
+			hKey4->WriteIntValueToReg("IdleTime", TransferIdleTime);
+			hKey4->WriteIntValueToReg("ListCache", ListCache);
 			hKey4->WriteIntValueToReg("Scolon", VaxSemicolon);
 
 			hKey4->WriteIntValueToReg("RecvEx", ExistMode);
@@ -777,6 +793,14 @@ bool LoadRegistry() {
 		hKey4->ReadString("Path"sv, DefaultLocalPath);
 		hKey4->ReadIntValueFromReg("Time", &SaveTimeStamp);
 		hKey4->ReadIntValueFromReg("EOF", &RmEOF);
+		hKey4->ReadIntValueFromReg("ReadAhead", &UploadReadAhead);
+		hKey4->ReadIntValueFromReg("AutoBuf", &AutoTuneBuffer);
+		hKey4->ReadIntValueFromReg("Segment", &SegmentThreshold);
+		hKey4->ReadIntValueFromReg("Schedule", &TransferSchedule);
+		hKey4->ReadIntValueFromReg("Pipeline", &PipelineWindow);
+		hKey4->ReadIntValueFromReg("Prewarm", &PrewarmConnections);
+		hKey4->ReadIntValueFromReg("IdleTime", &TransferIdleTime);
+		hKey4->ReadIntValueFromReg("ListCache", &ListCache);
 		hKey4->ReadIntValueFromReg("Scolon", &VaxSemicolon);
 
 		hKey4->ReadIntValueFromReg("RecvEx", &ExistMode);
@@ -35,13 +35,20 @@
 #define PWD_XPWD		0
 #define PWD_PWD			1
 
+#define PIPELINE_PROBE_TIMEOUT	5	/* 初めて続けて送ったコマンドの応答を待つ秒数 */
+
 /*===== プロトタイプ =====*/
 
 static int DoPWD(char *Buf);
 static std::tuple<int, std::string> ReadOneLine(SOCKET cSkt, int* CancelCheckWork);
-static int DoDirList(HWND hWnd, SOCKET cSkt, const char* AddOpt, const char* Path, int Num, int *CancelCheckWork);
+static int DoDirList(HWND hWnd, SOCKET cSkt, const char* AddOpt, const char* Path, int Num, int *CancelCheckWork, ListParser* List);
 static void ChangeSepaLocal2Remote(char *Fname);
 static void ChangeSepaRemote2Local(char *Fname);
+static void InvalidateRemotePath(const char* Path);
+static std::optional<std::tuple<std::string, std::string>> SessionCommand(std::string_view Cmd);
+static int CommandBatch(std::vector<std::string> const& Cmds);
+static LONGLONG SizeFromReply(int Sts, const char* Reply);
+static FILETIME TimeFromReply(int Sts, const char* Reply);
 #define CommandProcCmd(REPLY, CANCELCHECKWORK, ...) (AskTransferNow() == YES && (SktShareProh(), 0), command(AskCmdCtrlSkt(), REPLY, CANCELCHECKWORK, __VA_ARGS__))
 
 /*===== 外部参照 =====*/
@@ -51,6 +58,8 @@ extern TRANSPACKET MainTransPkt;
 /* 設定値 */
 extern int TimeOut;
 extern int SendQuit;
+extern int PipelineWindow;
+extern HOSTDATA CurHost;
 
 // 同時接続対応
 extern int CancelFlg;
@@ -281,6 +290,7 @@ int DoMKD(const char* Path)
 	// 同時接続対応
 //	Sts = CommandProcCmd(NULL, "MKD %s", Path);
 	Sts = CommandProcCmd(NULL, &CancelFlg, "MKD %s", Path);
+	InvalidateRemotePath(Path);
 
 	if(Sts/100 >= FTP_CONTINUE)
 		Sound::Error.Play();
@@ -312,6 +322,7 @@ int DoRMD(const char* Path)
 	// 同時接続対応
 //	Sts = CommandProcCmd(NULL, "RMD %s", Path);
 	Sts = CommandProcCmd(NULL, &CancelFlg, "RMD %s", Path);
+	InvalidateRemotePath(Path);
 
 	if(Sts/100 >= FTP_CONTINUE)
 		Sound::Error.Play();
@@ -343,6 +354,33 @@ int DoDELE(const char* Path)
 	// 同時接続対応
 //	Sts = CommandProcCmd(NULL, "DELE %s", Path);
 	Sts = CommandProcCmd(NULL, &CancelFlg, "DELE %s", Path);
+	InvalidateRemotePath(Path);
+
+	if(Sts/100 >= FTP_CONTINUE)
+		Sound::Error.Play();
+
+	// 自動切断対策
+	if(CancelFlg == NO && AskNoopInterval() > 0 && time(NULL) - LastDataConnectionTime >= AskNoopInterval())
+	{
+		NoopProc(YES);
+		LastDataConnectionTime = time(NULL);
+	}
+
+	return(Sts/100);
+}
+
+
+// 複数のファイルをまとめて削除する
+int DoDELE(std::vector<std::string> const& Paths)
+{
+	int Sts;
+	std::vector<std::string> Cmds;
+
+	for (auto const& Path : Paths)
+		Cmds.push_back("DELE "s + Path);
+	Sts = CommandBatch(Cmds);
+	for (auto const& Path : Paths)
+		InvalidateRemotePath(Path.c_str());
 
 	if(Sts/100 >= FTP_CONTINUE)
 		Sound::Error.Play();
@@ -379,6 +417,8 @@ int DoRENAME(const char *Src, const char *Dst)
 		// 同時接続対応
 //		Sts = command(AskCmdCtrlSkt(), NULL, &CheckCancelFlg, "RNTO %s", Dst);
 		Sts = command(AskCmdCtrlSkt(), NULL, &CancelFlg, "RNTO %s", Dst);
+	InvalidateRemotePath(Src);
+	InvalidateRemotePath(Dst);
 
 	if(Sts/100 >= FTP_CONTINUE)
 		Sound::Error.Play();
@@ -394,6 +434,20 @@ int DoRENAME(const char *Src, const char *Dst)
 }
 
 
+// 変更したパスのファイル一覧キャッシュを破棄する
+//   相対パスはカレントディレクトリからの絶対パスにする
+static void InvalidateRemotePath(const char* Path) {
+	if (Path[0] == '/')
+		InvalidateListCache(Path);
+	else if (auto dir = u8(AskRemoteCurDir()); dir.starts_with('/')) {
+		if (!dir.ends_with('/'))
+			dir += '/';
+		InvalidateListCache(dir + Path);
+	} else
+		InvalidateListCache(Path);
+}
+
+
 /*----- リモート側のファイルの属性変更 ----------------------------------------
 *
 *	Parameter
@@ -409,6 +463,33 @@ int DoCHMOD(const char *Path, const char *Mode)
 	int Sts;
 
 	Sts = CommandProcCmd(NULL, &CancelFlg, "%s %s %s", AskHostChmodCmd().c_str(), Mode, Path);
+	InvalidateRemotePath(Path);
+
+	if(Sts/100 >= FTP_CONTINUE)
+		Sound::Error.Play();
+
+	// 自動切断対策
+	if(CancelFlg == NO && AskNoopInterval() > 0 && time(NULL) - LastDataConnectionTime >= AskNoopInterval())
+	{
+		NoopProc(YES);
+		LastDataConnectionTime = time(NULL);
+	}
+
+	return(Sts/100);
+}
+
+
+// 複数のファイルの属性をまとめて変更する
+int DoCHMOD(std::vector<std::string> const& Paths, const char *Mode)
+{
+	int Sts;
+	std::vector<std::string> Cmds;
+
+	for (auto const& Path : Paths)
+		Cmds.push_back(AskHostChmodCmd() + ' ' + Mode + ' ' + Path);
+	Sts = CommandBatch(Cmds);
+	for (auto const& Path : Paths)
+		InvalidateRemotePath(Path.c_str());
 
 	if(Sts/100 >= FTP_CONTINUE)
 		Sound::Error.Play();
@@ -424,6 +505,17 @@ int DoCHMOD(const char *Path, const char *Mode)
 }
 
 
+// 制御コネクションで複数のコマンドを実行し、最も悪い応答コードを返す
+static int CommandBatch(std::vector<std::string> const& Cmds) {
+	if (AskTransferNow() == YES)
+		SktShareProh();
+	int Sts = 0;
+	for (auto const& [code, text] : CommandPipeline(AskCmdCtrlSkt(), Cmds, &CancelFlg))
+		Sts = std::max(Sts, code);
+	return Sts;
+}
+
+
 /*----- リモート側のファイルのサイズを取得（転送ソケット使用）-----------------
 *
 *	Parameter
@@ -445,15 +537,20 @@ int DoSIZE(SOCKET cSkt, const char* Path, LONGLONG *Size, int *CancelCheckWork)
 	// 同時接続対応
 //	Sts = CommandProcTrn(Tmp, "SIZE %s", Path);
 	Sts = CommandProcTrn(cSkt, Tmp, CancelCheckWork, "SIZE %s", Path);
-
-	*Size = -1;
-	if((Sts/100 == FTP_COMPLETE) && (strlen(Tmp) > 4) && IsDigit(Tmp[4]))
-		*Size = _atoi64(&Tmp[4]);
+	*Size = SizeFromReply(Sts, Tmp);
 
 	return(Sts/100);
 }
 
 
+static LONGLONG SizeFromReply(int Sts, const char* Reply)
+{
+	if((Sts/100 == FTP_COMPLETE) && (strlen(Reply) > 4) && IsDigit(Reply[4]))
+		return _atoi64(&Reply[4]);
+	return -1;
+}
+
+
 /*----- リモート側のファイルの日付を取得（転送ソケット使用）-------------------
 *
 *	Parameter
@@ -471,10 +568,6 @@ int DoMDTM(SOCKET cSkt, const char* Path, FILETIME *Time, int *CancelCheckWork)
 {
 	int Sts;
 	char Tmp[1024];
-	SYSTEMTIME sTime;
-
-	Time->dwLowDateTime = 0;
-	Time->dwHighDateTime = 0;
 
 	// 同時接続対応
 	// ホスト側の日時取得
@@ -482,20 +575,49 @@ int DoMDTM(SOCKET cSkt, const char* Path, FILETIME *Time, int *CancelCheckWork)
 	Sts = 500;
 	if(AskHostFeature() & FEATURE_MDTM)
 		Sts = CommandProcTrn(cSkt, Tmp, CancelCheckWork, "MDTM %s", Path);
+	*Time = TimeFromReply(Sts, Tmp);
+	return(Sts/100);
+}
+
+
+static FILETIME TimeFromReply(int Sts, const char* Reply)
+{
+	FILETIME Time{};
+	SYSTEMTIME sTime;
+
 	if(Sts/100 == FTP_COMPLETE)
 	{
 		sTime.wMilliseconds = 0;
-		if(sscanf(Tmp+4, "%04hu%02hu%02hu%02hu%02hu%02hu",
+		if(sscanf(Reply+4, "%04hu%02hu%02hu%02hu%02hu%02hu",
 			&sTime.wYear, &sTime.wMonth, &sTime.wDay,
 			&sTime.wHour, &sTime.wMinute, &sTime.wSecond) == 6)
 		{
-			SystemTimeToFileTime(&sTime, Time);
+			SystemTimeToFileTime(&sTime, &Time);
 			// 時刻はGMT
 //			SpecificLocalFileTime2FileTime(Time, AskHostTimeZone());
 
 		}
 	}
-	return(Sts/100);
+	return Time;
+}
+
+
+// サイズと日付をまとめて取得する
+//   PipelineWindowが2以上の場合はMDTMをSIZEの応答を待たずに送る
+void DoSIZEandMDTM(SOCKET cSkt, const char* Path, LONGLONG *Size, FILETIME *Time, int *CancelCheckWork)
+{
+	std::vector<std::string> Cmds{ "SIZE "s + Path };
+	if(AskHostFeature() & FEATURE_MDTM)
+		Cmds.push_back("MDTM "s + Path);
+	auto const results = CommandPipeline(cSkt, Cmds, CancelCheckWork);
+	auto const& [SizeSts, SizeReply] = results[0];
+	*Size = SizeFromReply(SizeSts, SizeReply.c_str());
+	*Time = FILETIME{};
+	if(size(results) > 1)
+	{
+		auto const& [TimeSts, TimeReply] = results[1];
+		*Time = TimeFromReply(TimeSts, TimeReply.c_str());
+	}
 }
 
 
@@ -591,13 +713,14 @@ int DoQUIT(SOCKET ctrl_skt, int *CancelCheckWork)
 *	Parameter
 *		char *AddOpt : 追加のオプション
 *		char *Path : パス名
-*		int Num : ファイル名番号
+*		int Num : ファイル名番号 (-1=キャッシュファイルに保存しない)
+*		ListParser *List : 受信しながら解析するファイル一覧 (NULL=しない)
 *
 *	Return Value
 *		int 応答コードの１桁目
 *----------------------------------------------------------------------------*/
 
-int DoDirListCmdSkt(const char* AddOpt, const char* Path, int Num, int *CancelCheckWork)
+int DoDirListCmdSkt(const char* AddOpt, const char* Path, int Num, int *CancelCheckWork, ListParser* List)
 {
 	int Sts;
 
@@ -607,7 +730,7 @@ int DoDirListCmdSkt(const char* AddOpt, const char* Path, int Num, int *CancelCh
 //	if((Sts = DoDirList(NULL, AskCmdCtrlSkt(), AddOpt, Path, Num)) == 429)
 //	{
 //		ReConnectCmdSkt();
-		Sts = DoDirList(NULL, AskCmdCtrlSkt(), AddOpt, Path, Num, CancelCheckWork);
+		Sts = DoDirList(NULL, AskCmdCtrlSkt(), AddOpt, Path, Num, CancelCheckWork, List);
 
 		if(Sts/100 >= FTP_CONTINUE)
 			Sound::Error.Play();
@@ -623,13 +746,14 @@ int DoDirListCmdSkt(const char* AddOpt, const char* Path, int Num, int *CancelCh
 *		SOCKET cSkt : コントロールソケット
 *		char *AddOpt : 追加のオプション
 *		char *Path : パス名 (""=カレントディレクトリ)
-*		int Num : ファイル名番号
+*		int Num : ファイル名番号 (-1=キャッシュファイルに保存しない)
+*		ListParser *List : 受信しながら解析するファイル一覧 (NULL=しない)
 *
 *	Return Value
 *		int 応答コード
 *----------------------------------------------------------------------------*/
 
-static int DoDirList(HWND hWnd, SOCKET cSkt, const char* AddOpt, const char* Path, int Num, int *CancelCheckWork)
+static int DoDirList(HWND hWnd, SOCKET cSkt, const char* AddOpt, const char* Path, int Num, int *CancelCheckWork, ListParser* List)
 {
 	int Sts;
 	if(AskListCmdMode() == NO)
@@ -666,7 +790,9 @@ static int DoDirList(HWND hWnd, SOCKET cSkt, const char* AddOpt, const char* Pat
 		strcat(MainTransPkt.Cmd, " ");
 
 	strcpy(MainTransPkt.RemoteFile, Path);
-	strcpy(MainTransPkt.LocalFile, MakeCacheFileName(Num).u8string().c_str());
+	// ファイル一覧を解析する場合キャッシュファイルへの保存は任意
+	assert(0 <= Num || List != NULL);
+	strcpy(MainTransPkt.LocalFile, 0 <= Num ? MakeCacheFileName(Num).u8string().c_str() : "");
 	MainTransPkt.Type = TYPE_A;
 	MainTransPkt.Size = -1;
 	/* ファイルリストの中の漢字のファイル名は、別途	*/
@@ -678,8 +804,10 @@ static int DoDirList(HWND hWnd, SOCKET cSkt, const char* AddOpt, const char* Pat
 	MainTransPkt.NoTransfer = NO;
 	MainTransPkt.ExistSize = 0;
 	MainTransPkt.hWndTrans = hWnd;
+	MainTransPkt.List = List;
 
 	Sts = DoDownload(cSkt, MainTransPkt, YES, CancelCheckWork);
+	MainTransPkt.List = NULL;
 	return(Sts);
 }
 
@@ -727,27 +855,149 @@ int command(SOCKET cSkt, char* Reply, int* CancelCheckWork, _In_z_ _Printf_forma
 	va_start(Args, fmt);
 	vsprintf(Cmd, fmt, Args);
 	va_end(Args);
+	if (Reply != NULL)
+		strcpy(Reply, "");
+	if (strncmp(Cmd, "PASS ", 5) != 0 && strncmp(Cmd, "USER ", 5) != 0 && strncmp(Cmd, "OPEN ", 5) != 0)
+		ChangeSepaLocal2Remote(Cmd);
+	// すでに有効になっている設定は送らずに、設定した時の応答コードを返す  この場合Replyは空になる
+	auto const session = SessionCommand(Cmd);
+	if (session)
+		if (auto const& [name, value] = *session; !empty(value))
+			if (auto const code = GetSessionState(cSkt, name, value); code != 0) {
+				DoPrintf("Skt=%zu : Skipped %s", cSkt, Cmd);
+				return code;
+			}
 	if (strncmp(Cmd, "PASS ", 5) == 0)
 		SetTaskMsg(">PASS [xxxxxx]");
-	else if (strncmp(Cmd, "USER ", 5) == 0 || strncmp(Cmd, "OPEN ", 5) == 0)
-		SetTaskMsg(">%s", Cmd);
-	else {
-		ChangeSepaLocal2Remote(Cmd);
+	else
 		SetTaskMsg(">%s", Cmd);
-	}
-	strncpy(Cmd, ConvertTo(Cmd, AskHostNameKanji(), AskHostNameKana()).c_str(), FMAX_PATH * 2);
-	strcat(Cmd, "\x0D\x0A");
-	if (Reply != NULL)
-		strcpy(Reply, "");
-	if (SendData(cSkt, Cmd, (int)strlen(Cmd), 0, CancelCheckWork) != FFFTP_SUCCESS)
+	auto const sent = ConvertTo(Cmd, AskHostNameKanji(), AskHostNameKana()) + "\x0D\x0A";
+	if (SendData(cSkt, data(sent), size_as<int>(sent), 0, CancelCheckWork) != FFFTP_SUCCESS)
 		return 429;
 	auto [code, text] = ReadReplyMessage(cSkt, CancelCheckWork);
 	if (Reply)
 		strncpy_s(Reply, 1024, text.c_str(), _TRUNCATE);
+	if (session) {
+		auto const& [name, value] = *session;
+		if (empty(name))
+			ClearSessionState(cSkt);
+		else
+			SetSessionState(cSkt, name, code / 100 == FTP_COMPLETE ? value : ""s, code);
+	}
 	return code;
 }
 
 
+// ホストがパイプライン送信に対応しているか (YES/NO/PIPELINE_UNKNOWN)
+//   メインスレッドと転送スレッドから読み書きするため、不可分に操作する  HOSTDATAを複製できるようメンバーはintのままとする
+static int AskPipeline() {
+	return std::atomic_ref{ CurHost.CurPipeline }.load();
+}
+
+static void SetPipeline(int Pipeline) {
+	std::atomic_ref{ CurHost.CurPipeline }.store(Pipeline);
+}
+
+
+// 互いに依存しない複数のコマンドを応答を待たずに続けて送り、送った順に応答を受け取る
+//   応答待ちのコマンドはPipelineWindow個まで  2未満の場合は１つずつ送る
+//   先に送ったコマンドの処理中に届いたコマンドを500や503で拒否するホストでは、拒否されたコマンドを送り直し、以降このホストでは１つずつ送る
+//   後のコマンドを黙って捨てるホストに備え、ホストで初めて続けて送った時はPIPELINE_PROBE_TIMEOUT秒で応答が届かなければ、以降は同様に１つずつ送る
+//   送信済みのコマンドは送り直すと応答との対応がずれるため、送り直さずに通常のタイムアウトで応答を待つ
+//   接続の状態を変えるコマンドは結果が後のコマンドに影響するため、含まれている場合も１つずつ送る
+std::vector<std::tuple<int, std::string>> CommandPipeline(SOCKET cSkt, std::vector<std::string> const& Cmds, int* CancelCheckWork) {
+	std::vector<std::tuple<int, std::string>> results(size(Cmds));
+	auto lockstep = [&](size_t index) {
+		char Reply[1024];
+		auto const code = command(cSkt, Reply, CancelCheckWork, "%s", Cmds[index].c_str());
+		results[index] = { code, Reply };
+	};
+	auto window = static_cast<size_t>(PipelineWindow);
+	if (window < 2 || cSkt == INVALID_SOCKET || AskPipeline() == NO || std::ranges::any_of(Cmds, [](auto const& Cmd) { return SessionCommand(Cmd).has_value(); })) {
+		for (size_t i = 0; i < size(Cmds); i++)
+			lockstep(i);
+		return results;
+	}
+	auto disconnected = [&](size_t index, int code) {
+		for (; index < size(Cmds); index++)
+			results[index] = { code, {} };
+		return results;
+	};
+	auto probing = AskPipeline() == PIPELINE_UNKNOWN;
+	auto const probe = std::chrono::seconds(TimeOut != 0 ? std::min(TimeOut, PIPELINE_PROBE_TIMEOUT) : PIPELINE_PROBE_TIMEOUT);
+	for (size_t sent = 0, received = 0; received < size(Cmds); received++) {
+		// 応答待ちが減った分を続けて送る
+		std::string buffer;
+		for (; sent < size(Cmds) && sent - received < window; sent++) {
+			char Cmd[FMAX_PATH * 2];
+			strncpy_s(Cmd, Cmds[sent].c_str(), _TRUNCATE);
+			ChangeSepaLocal2Remote(Cmd);
+			SetTaskMsg(">%s", Cmd);
+			buffer += ConvertTo(Cmd, AskHostNameKanji(), AskHostNameKana()) + "\x0D\x0A";
+		}
+		if (!empty(buffer) && SendData(cSkt, data(buffer), size_as<int>(buffer), 0, CancelCheckWork) != FFFTP_SUCCESS)
+			return disconnected(received, 429);
+		// 先頭のコマンドは応答を待たずに送ったものではないため、通常どおり待つ
+		if (probing && 0 < received && !WaitReceived(cSkt, probe, CancelCheckWork)) {
+			// 送信済みのコマンドの応答は通常のタイムアウトで待ち、届かなければ切断する  未送信のコマンドは応答を受け取ってから１つずつ送る
+			DoPrintf("Skt=%zu : No reply to pipelined commands, falling back to lockstep", cSkt);
+			SetPipeline(NO);
+			probing = false;
+			window = 1;
+		}
+		results[received] = ReadReplyMessage(cSkt, CancelCheckWork);
+		auto const code = std::get<0>(results[received]);
+		if (code == 421 || code == 429)
+			return disconnected(received, code);
+		if ((code == 500 || code == 503) && received + 1 < sent) {
+			// 送信済みの応答をすべて受け取ってから、拒否されたものと未送信のものを１つずつ送る
+			std::vector<size_t> retry{ received };
+			while (++received < sent) {
+				results[received] = ReadReplyMessage(cSkt, CancelCheckWork);
+				auto const next = std::get<0>(results[received]);
+				if (next == 421 || next == 429)
+					return disconnected(received, next);
+				if (next == 500 || next == 503)
+					retry.push_back(received);
+			}
+			DoPrintf("Skt=%zu : Pipelining rejected, falling back to lockstep", cSkt);
+			SetPipeline(NO);
+			for (; sent < size(Cmds); sent++)
+				retry.push_back(sent);
+			for (auto index : retry)
+				lockstep(index);
+			return results;
+		}
+	}
+	// 続けて送ったコマンドにすべて応答があれば、以降は応答を待つ時間を短くしない  他の転送スレッドが未対応と判断していれば上書きしない
+	if (probing && 1 < size(Cmds)) {
+		int expected = PIPELINE_UNKNOWN;
+		std::atomic_ref{ CurHost.CurPipeline }.compare_exchange_strong(expected, YES);
+	}
+	return results;
+}
+
+
+// 制御コネクションの状態を変えるコマンドの場合、状態の名前と値を返す
+//   値が空の場合は結果を予測できないため現在の状態を破棄し、名前も空の場合はすべての状態を破棄する
+//   CWDは相対パスでは繰り返すたびに移動するため、絶対パスの場合のみ記録する
+static std::optional<std::tuple<std::string, std::string>> SessionCommand(std::string_view Cmd) {
+	for (auto name : { "TYPE"sv, "PROT"sv, "PBSZ"sv, "OPTS UTF8"sv })
+		if (Cmd.starts_with(name) && size(name) < size(Cmd) && Cmd[size(name)] == ' ')
+			return std::tuple{ std::string{ name }, std::string{ Cmd.substr(size(name) + 1) } };
+	if (Cmd.starts_with("CWD "sv) || Cmd.starts_with("XCWD "sv)) {
+		auto const path = Cmd.substr(Cmd.find(' ') + 1);
+		return std::tuple{ "CWD"s, path.starts_with('/') ? std::string{ path } : ""s };
+	}
+	if (Cmd == "CDUP"sv || Cmd == "XCUP"sv)
+		return std::tuple{ "CWD"s, ""s };
+	// 中止や再ログインではサーバーの状態が初期化される場合がある
+	if (Cmd == "ABOR"sv || Cmd == "REIN"sv || Cmd.starts_with("USER "sv))
+		return std::tuple{ ""s, ""s };
+	return {};
+}
+
+
 // 応答メッセージを受け取る
 std::tuple<int, std::string> ReadReplyMessage(SOCKET cSkt, int* CancelCheckWork) {
 	int firstCode = 0;
@@ -765,6 +1015,8 @@ std::tuple<int, std::string> ReadReplyMessage(SOCKET cSkt, int* CancelCheckWork)
 			text += line;
 
 			if (code == 421 || code == 429) {
+				// 切断されるため、以降は設定済みの状態を使わない
+				ClearSessionState(cSkt);
 				firstCode = code;
 				break;
 			}
@@ -784,44 +1036,23 @@ static std::tuple<int, std::string> ReadOneLine(SOCKET cSkt, int* CancelCheckWor
 	if (cSkt == INVALID_SOCKET)
 		return { 0, {} };
 
-	int read;
 	std::string line;
-	for (char buffer[1024];;) {
-		int TimeOutErr;
-		/* LFまでを受信するために、最初はPEEKで受信 */
-		if ((read = do_recv(cSkt, buffer, size_as<int>(buffer), MSG_PEEK, &TimeOutErr, CancelCheckWork)) <= 0) {
-			if (TimeOutErr == YES) {
-				SetTaskMsg(IDS_MSGJPN242);
-				read = -2;
-			} else if (read == SOCKET_ERROR)
-				read = -1;
-			break;
-		}
-		/* LFを探して、あったらそこまでの長さをセット */
-		assert(std::find(buffer, buffer + read, '\0') == buffer + read);
-		if (auto lf = std::find(buffer, buffer + read, '\n'); lf != buffer + read)
-			read = (int)(lf - buffer + 1);
-		/* 本受信 */
-		if ((read = do_recv(cSkt, buffer, read, 0, &TimeOutErr, CancelCheckWork)) <= 0)
-			break;
-		line.append(buffer, buffer + read);
-		/* データがLFで終わっていたら１行終わり */
-		if (line.back() == '\n')
-			break;
-	}
-	if (read <= 0) {
-		if (read == -2 || AskTransferNow() == YES)
+	int TimeOutErr;
+	if (ReceiveLine(cSkt, line, &TimeOutErr, CancelCheckWork) <= 0) {
+		if (TimeOutErr == YES)
+			SetTaskMsg(IDS_MSGJPN242);
+		if (TimeOutErr == YES || AskTransferNow() == YES)
 			cSkt = DoClose(cSkt);
 		return { 429, {} };
 	}
+	assert(line.find('\0') == std::string::npos);
 
 	int replyCode = 0;
-	if (IsDigit(line[0]) && IsDigit(line[1]) && IsDigit(line[2]))
+	if (3 <= size(line) && IsDigit(line[0]) && IsDigit(line[1]) && IsDigit(line[2]))
 		std::from_chars(data(line), data(line) + 3, replyCode);
 
 	/* 末尾の CR,LF,スペースを取り除く */
-	static boost::regex re{ R"([\r\n ]+$)" };
-	line = boost::regex_replace(line, re, "");
+	line.erase(line.find_last_not_of("\r\n "sv) + 1);
 	return { replyCode, std::move(line) };
 }
 
@@ -44,12 +44,20 @@
 #define USE_THIS	1
 #define DBG_MSG		0
 
+// ソケットの待機を打ち切る間隔（ミリ秒）  メッセージ処理と中止の確認はこの間隔で行う
+#define SOCKET_WAIT_SLICE	10
+
+// 複数のアドレスに接続する際、次のアドレスへの接続を開始するまでの時間（ミリ秒） RFC 8305の推奨値
+#define CONNECT_ATTEMPT_DELAY	250
+
 
 struct AsyncSignal {
 	int Event = 0;
 	int Error = 0;
 	std::variant<sockaddr_storage, std::tuple<std::string, int>> Target;
 	int MapPort = 0;
+	std::map<std::string, std::tuple<std::string, int>> Session;	// 制御コネクションで有効になっている設定（コマンド→引数と応答コード）
+	std::string Received;	// 制御コネクションで受信済みの次の行以降のデータ
 };
 
 
@@ -59,6 +67,8 @@ static LRESULT CALLBACK SocketWndProc(HWND hWnd, UINT message, WPARAM wParam, LP
 static int AskAsyncDone(SOCKET s, int *Error, int Mask);
 static void RegisterAsyncTable(SOCKET s);
 static void UnregisterAsyncTable(SOCKET s);
+static void WaitSocket(SOCKET s, short events, std::optional<std::chrono::steady_clock::time_point> const& endTime);
+static int StartConnect(SOCKET s, const sockaddr* name, int namelen);
 
 
 /*===== 外部参照 =====*/
@@ -551,6 +561,34 @@ int GetAsyncTableDataMapPort(SOCKET s, int* Port) {
 }
 
 
+// 制御コネクションでnameがvalueに設定済みであれば、設定した時の応答コードを返す
+//   ソケットを閉じると設定は破棄されるため、再接続後は改めて設定される
+int GetSessionState(SOCKET s, std::string const& name, std::string const& value) {
+	std::lock_guard lock{ SignalMutex };
+	if (auto it = Signal.find(s); it != end(Signal))
+		if (auto state = it->second.Session.find(name); state != end(it->second.Session) && std::get<0>(state->second) == value)
+			return std::get<1>(state->second);
+	return 0;
+}
+
+// 制御コネクションの設定を記録する  valueが空の場合は不明な状態として破棄する
+void SetSessionState(SOCKET s, std::string const& name, std::string const& value, int code) {
+	std::lock_guard lock{ SignalMutex };
+	if (auto it = Signal.find(s); it != end(Signal)) {
+		if (empty(value))
+			it->second.Session.erase(name);
+		else
+			it->second.Session.insert_or_assign(name, std::tuple{ value, code });
+	}
+}
+
+void ClearSessionState(SOCKET s) {
+	std::lock_guard lock{ SignalMutex };
+	if (auto it = Signal.find(s); it != end(Signal))
+		it->second.Session.clear();
+}
+
+
 SOCKET do_socket(int af, int type, int protocol) {
 	auto s = socket(af, type, protocol);
 	if (s == INVALID_SOCKET) {
@@ -578,7 +616,8 @@ int do_closesocket(SOCKET s) {
 }
 
 
-int do_connect(SOCKET s, const sockaddr* name, int namelen, int* CancelCheckWork) {
+// 非同期で接続を開始する  接続済みは0、接続中はWSAEWOULDBLOCK、失敗はSOCKET_ERROR
+static int StartConnect(SOCKET s, const sockaddr* name, int namelen) {
 	if (WSAAsyncSelect(s, hWndSocket, WM_ASYNC_SOCKET, FD_CONNECT | FD_CLOSE | FD_ACCEPT) != 0) {
 		DoPrintf(L"connect: WSAAsyncSelect failed: 0x%08X", WSAGetLastError());
 		return SOCKET_ERROR;
@@ -586,9 +625,16 @@ int do_connect(SOCKET s, const sockaddr* name, int namelen, int* CancelCheckWork
 	if (connect(s, name, namelen) == 0)
 		return 0;
 	if (auto lastError = WSAGetLastError(); lastError != WSAEWOULDBLOCK) {
-		DoPrintf(L"connect: connect failed: 0x%08X", WSAGetLastError());
+		DoPrintf(L"connect: connect failed: 0x%08X", lastError);
 		return SOCKET_ERROR;
 	}
+	return WSAEWOULDBLOCK;
+}
+
+
+int do_connect(SOCKET s, const sockaddr* name, int namelen, int* CancelCheckWork) {
+	if (auto result = StartConnect(s, name, namelen); result != WSAEWOULDBLOCK)
+		return result;
 	while (*CancelCheckWork != YES) {
 		if (int error = 0; AskAsyncDone(s, &error, FD_CONNECT) == YES && error != WSAEWOULDBLOCK) {
 			if (error == 0)
@@ -604,6 +650,65 @@ int do_connect(SOCKET s, const sockaddr* name, int namelen, int* CancelCheckWork
 }
 
 
+// 複数のアドレスに時間をずらして接続を開始し、最初に接続できたソケットを返す（RFC 8305 Happy Eyeballs）
+//   接続中のアドレスがCONNECT_ATTEMPT_DELAYミリ秒応答しないか失敗した時点で次のアドレスへの接続を開始する
+//   応答しない経路があっても、そのアドレスのタイムアウトを待たずに他のアドレスで接続できる
+//   接続できたアドレスの位置をIndexに返す
+SOCKET do_connect_race(std::vector<sockaddr_storage> const& addresses, size_t* Index, int* CancelCheckWork) {
+	std::vector<std::tuple<SOCKET, size_t>> attempts;
+	size_t next = 0;
+	ULONGLONG started = 0;
+	auto result = INVALID_SOCKET;
+	while (*CancelCheckWork != YES) {
+		if (next < size(addresses) && (empty(attempts) || GetTickCount64() - started >= CONNECT_ATTEMPT_DELAY)) {
+			auto const& address = addresses[next];
+			if (auto s = do_socket(address.ss_family, SOCK_STREAM, IPPROTO_TCP); s != INVALID_SOCKET) {
+				auto const connected = StartConnect(s, reinterpret_cast<const sockaddr*>(&address), sizeof address);
+				if (connected == 0) {
+					result = s;
+					*Index = next;
+					break;
+				}
+				if (connected == WSAEWOULDBLOCK)
+					attempts.emplace_back(s, next);
+				else
+					do_closesocket(s);
+			}
+			if (1 < size(addresses))
+				DoPrintf(L"connect: attempt %zu/%zu", next + 1, size(addresses));
+			next++;
+			started = GetTickCount64();
+		}
+		for (auto it = begin(attempts); it != end(attempts);) {
+			auto const [s, index] = *it;
+			if (int error = 0; AskAsyncDone(s, &error, FD_CONNECT) == YES && error != WSAEWOULDBLOCK) {
+				if (error == 0) {
+					result = s;
+					*Index = index;
+					attempts.erase(it);
+					break;
+				}
+				DoPrintf(L"connect: select error: 0x%08X", error);
+				do_closesocket(s);
+				it = attempts.erase(it);
+				// 失敗した場合は待たずに次のアドレスへの接続を開始する
+				started = 0;
+			} else
+				++it;
+		}
+		if (result != INVALID_SOCKET || empty(attempts) && next == size(addresses))
+			break;
+		Sleep(1);
+		if (BackgrndMessageProc() == YES)
+			*CancelCheckWork = YES;
+	}
+	for (auto const& [s, index] : attempts)
+		if (s != result)
+			do_closesocket(s);
+	return result;
+}
+
+
 int do_listen(SOCKET s, int backlog) {
 	if (WSAAsyncSelect(s, hWndSocket, WM_ASYNC_SOCKET, FD_CLOSE | FD_ACCEPT) != 0) {
 		DoPrintf(L"listen: WSAAsyncSelect failed: 0x%08X", WSAGetLastError());
@@ -672,6 +777,18 @@ SOCKET do_accept(SOCKET s, struct sockaddr *addr, int *addrlen)
 }
 
 
+// ソケットが読み込み・書き込み可能になるか、期限に達するまで待機する
+//   メッセージ処理と中止の確認のため、最長でもSOCKET_WAIT_SLICEミリ秒で戻る
+static void WaitSocket(SOCKET s, short events, std::optional<std::chrono::steady_clock::time_point> const& endTime) {
+	auto timeout = SOCKET_WAIT_SLICE;
+	if (endTime)
+		timeout = (int)std::clamp<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(*endTime - std::chrono::steady_clock::now()).count(), 0, timeout);
+	WSAPOLLFD fd{ s, events };
+	if (WSAPoll(&fd, 1, timeout) == SOCKET_ERROR)
+		Sleep(1);
+}
+
+
 int do_recv(SOCKET s, char *buf, int len, int flags, int *TimeOutErr, int *CancelCheckWork) {
 	if (*CancelCheckWork != NO)
 		return SOCKET_ERROR;
@@ -682,7 +799,7 @@ int do_recv(SOCKET s, char *buf, int len, int flags, int *TimeOutErr, int *Cance
 			return read;
 		if (auto lastError = WSAGetLastError(); lastError != WSAEWOULDBLOCK)
 			return SOCKET_ERROR;
-		Sleep(1);
+		WaitSocket(s, POLLRDNORM, endTime);
 		if (BackgrndMessageProc() == YES)
 			return SOCKET_ERROR;
 		if (endTime && *endTime < std::chrono::steady_clock::now()) {
@@ -697,6 +814,61 @@ int do_recv(SOCKET s, char *buf, int len, int flags, int *TimeOutErr, int *Cance
 }
 
 
+// 制御コネクションからLFまでの１行を受信する
+//   まとめて受信して次の行以降はソケットごとに保持し、次回はそこから取り出すため、１行ごとに受信を繰り返さない
+//   SSLの場合もFTPS_recvで復号したデータを同じように扱う
+int ReceiveLine(SOCKET s, std::string& line, int* TimeOutErr, int* CancelCheckWork) {
+	std::string buffer;
+	{
+		std::lock_guard lock{ SignalMutex };
+		if (auto it = Signal.find(s); it != end(Signal))
+			buffer = std::move(it->second.Received);
+	}
+	int result;
+	*TimeOutErr = NO;
+	for (size_t searched = 0;;) {
+		if (auto const lf = buffer.find('\n', searched); lf != std::string::npos) {
+			line.assign(buffer, 0, lf + 1);
+			buffer.erase(0, lf + 1);
+			result = size_as<int>(line);
+			break;
+		}
+		searched = size(buffer);
+		char chunk[4096];
+		if ((result = do_recv(s, chunk, size_as<int>(chunk), 0, TimeOutErr, CancelCheckWork)) <= 0)
+			break;
+		buffer.append(chunk, result);
+	}
+	std::lock_guard lock{ SignalMutex };
+	if (auto it = Signal.find(s); it != end(Signal))
+		it->second.Received = std::move(buffer);
+	return result;
+}
+
+
+// 制御コネクションでtimeoutまでに次の応答を受信し始めたかどうかを返す
+//   受信済みで取り出していないデータがあればすぐにtrueを返す  中止された場合もtrueを返し、受信する側で処理させる
+bool WaitReceived(SOCKET s, std::chrono::milliseconds timeout, int* CancelCheckWork) {
+	{
+		std::lock_guard lock{ SignalMutex };
+		if (auto it = Signal.find(s); it != end(Signal) && !empty(it->second.Received))
+			return true;
+	}
+	if (auto context = getContext(s); context && !empty(context->readPlain))
+		return true;
+	auto const endTime = std::chrono::steady_clock::now() + timeout;
+	for (;;) {
+		if (WSAPOLLFD fd{ s, POLLRDNORM }; WSAPoll(&fd, 1, 0) != 0)
+			return true;
+		if (*CancelCheckWork != NO || BackgrndMessageProc() == YES)
+			return true;
+		if (endTime <= std::chrono::steady_clock::now())
+			return false;
+		WaitSocket(s, POLLRDNORM, endTime);
+	}
+}
+
+
 int SendData(SOCKET s, const char* buf, int len, int flags, int* CancelCheckWork) {
 	if (s == INVALID_SOCKET)
 		return FFFTP_FAIL;
@@ -728,8 +900,8 @@ int SendData(SOCKET s, const char* buf, int len, int flags, int* CancelCheckWork
 		} else if (auto lastError = WSAGetLastError(); lastError != WSAEWOULDBLOCK) {
 			DoPrintf(L"send: send failed: 0x%08X", lastError);
 			return FFFTP_FAIL;
-		}
-		Sleep(1);
+		} else
+			WaitSocket(s, POLLWRNORM, endTime);
 		if (BackgrndMessageProc() == YES || *CancelCheckWork == YES)
 			return FFFTP_FAIL;
 		if (endTime && *endTime < std::chrono::steady_clock::now()) {
@@ -748,6 +920,11 @@ void RemoveReceivedData(SOCKET s)
 	char buf[1024];
 	int len;
 //	int Error;
+	{
+		std::lock_guard lock{ SignalMutex };
+		if (auto it = Signal.find(s); it != end(Signal))
+			it->second.Received.clear();
+	}
 	while((len = FTPS_recv(s, buf, sizeof(buf), MSG_PEEK)) > 0)
 	{
 //		AskAsyncDone(s, &Error, FD_READ);
@@ -1,3 +1,5 @@
+#include <bit>
+#include <chrono>
 #include <fstream>
 #include <regex>
 #include <string>
@@ -5,6 +7,7 @@
 #include <tuple>
 #include <boost/regex.hpp>
 #include "../filelist.h"
+#include "../newline.h"
 #include "CppUnitTest.h"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
@@ -66,5 +69,219 @@ public:
 			}
 		}
 	}
+
+	TEST_METHOD(FileListScanner) {
+		auto compile = [](auto const& p) {
+			auto [pattern, icase] = p;
+			return icase ? boost::regex{ data(pattern), data(pattern) + size(pattern), boost::regex::icase } : boost::regex{ data(pattern), data(pattern) + size(pattern) };
+		};
+		auto const mlsd = compile(filelistparser::mlsd);
+		auto const unix = compile(filelistparser::unix);
+		auto check = [](std::string const& input, boost::regex const& re, auto const& scanned) {
+			auto message = ToString("<<" + input + ">>");
+			boost::smatch m;
+			Assert::AreEqual(boost::regex_search(input, m, re), scanned.has_value(), message.c_str());
+			if (scanned)
+				for (size_t i = 1; i < size(*scanned); i++)
+					Assert::AreEqual(m[i].matched ? m[i].str() : ""s, std::string{ (*scanned)[i] }, message.c_str());
+		};
+
+		std::ifstream is{ "filelist.txt" };
+		Assert::IsFalse(is.fail(), L"Open failed.");
+		for (std::string line; getline(is, line);) {
+			for (auto const& input : { line, line.size() < 2 || line[1] != '\t' ? ""s : line.substr(2) }) {
+				if (!filelistscanner::supported(input))
+					continue;
+				check(input, mlsd, filelistscanner::mlsd(input));
+				check(input, unix, filelistscanner::unix(input));
+			}
+		}
+	}
+
+	TEST_METHOD(FileListDialect) {
+		// 複数の形式に一致する行は判別済みの形式に関わらず最も優先する形式とする
+		for (unsigned mask = 0; mask < 1u << 6; mask++)
+			for (int detected = -1; detected < 6; detected++) {
+				auto const expected = mask == 0 ? -1 : std::countr_zero(mask);
+				auto last = -1;
+				auto const actual = filelistdialect::select(6, detected, [mask, &last](int i) { return (mask >> i & 1) != 0 && (last = i, true); });
+				Assert::AreEqual(expected, actual, ToString("mask: " + std::to_string(mask) + ", detected: " + std::to_string(detected)).c_str());
+				// 選んだ形式の一致結果を解析に使えるよう、最後に一致したtestの形式を返す
+				Assert::AreEqual(expected, last, ToString("mask: " + std::to_string(mask) + ", detected: " + std::to_string(detected)).c_str());
+			}
+
+		// filelist.cppのdialectsと同じ順
+		auto compile = [](char ch, auto const& p) {
+			auto [pattern, icase] = p;
+			return std::tuple{ ch, icase ? boost::regex{ data(pattern), data(pattern) + size(pattern), boost::regex::icase } : boost::regex{ data(pattern), data(pattern) + size(pattern) } };
+		};
+		std::tuple<char, boost::regex> const dialects[] = {
+			compile('m', filelistparser::mlsd),
+			compile('u', filelistparser::unix),
+			compile('l', filelistparser::linux),
+			compile('d', filelistparser::dos),
+			compile('M', filelistparser::melcom80),
+			compile('a', filelistparser::agilent),
+			compile('A', filelistparser::as400),
+			compile('n', filelistparser::m1800),
+			compile('g', filelistparser::gp6000),
+			compile('c', filelistparser::chameleon),
+			compile('2', filelistparser::os2),
+			compile('7', filelistparser::os7),
+			compile('9', filelistparser::os9),
+			compile('b', filelistparser::allied),
+			compile('i', filelistparser::ibm),
+			compile('s', filelistparser::shibasoku),
+			compile('S', filelistparser::stratus),
+			compile('v', filelistparser::vms),
+			compile('I', filelistparser::irmx),
+			compile('t', filelistparser::tandem),
+		};
+		auto const count = static_cast<int>(std::size(dialects));
+		// filelist.cppのEarlierDialects()と同じく、"^ *"で始まる形式は空白の直後の１文字で重なりを調べる
+		auto const earlier = filelistdialect::overlaps(count, [&dialects](int i, char ch) {
+			auto const& re = std::get<1>(dialects[i]);
+			return !re.str().starts_with("^ *"sv) || boost::regex_search(&ch, &ch + 1, re, boost::match_partial | boost::match_continuous);
+		});
+		// mlsdは行の途中から一致しうるため、常に試す
+		for (int i = 1; i < count; i++)
+			Assert::IsTrue((earlier[i] & 1) != 0);
+
+		// 全形式を交互に並べた一覧をどの形式と判別しても順に試した場合と同じ結果になる
+		std::ifstream is{ "filelist.txt" };
+		Assert::IsFalse(is.fail(), L"Open failed.");
+		std::vector<std::string> lines;
+		for (std::string line; getline(is, line);)
+			lines.push_back(line.size() < 2 || line[1] != '\t' ? line : line.substr(2));
+		for (size_t i = 0; i < size(lines); i++)
+			std::swap(lines[i], lines[i * 7 % size(lines)]);
+		// ファイル名によって複数の形式に一致する行
+		lines.push_back("-rw-r--r--   1 root     root           10 Jan  1  2020 x;a=b c");
+		lines.push_back("-rw-r--r--   1 root     root           10 2020-01-01 12:00 Jan  1  2020 x");
+		for (auto const& line : lines) {
+			auto test = [&line, &dialects](int i) { return boost::regex_search(line, std::get<1>(dialects[i])); };
+			auto expected = -1;
+			for (int i = 0; i < count && expected < 0; i++)
+				if (test(i))
+					expected = i;
+			for (int detected = -1; detected < count; detected++) {
+				Assert::AreEqual(expected, filelistdialect::select(count, detected, test), ToString("detected: "s + (detected < 0 ? '-' : std::get<0>(dialects[detected])) + ", <<" + line + ">>").c_str());
+				Assert::AreEqual(expected, filelistdialect::select(count, detected, test, 0 <= detected ? earlier[detected] : 0), ToString("earlier, detected: "s + (detected < 0 ? '-' : std::get<0>(dialects[detected])) + ", <<" + line + ">>").c_str());
+			}
+		}
+	}
+
+	TEST_METHOD(NewlineConversion) {
+		// CRとLFがチャンクの境界で分かれても１つの改行とし、SIMDで探す16バイト単位の範囲をまたぐ改行も変換する
+		auto const input = "a\r\nb\rc\nd\r\r\ne\n\r"s + std::string(40, 'x') + "\r\n"s + std::string(15, 'y') + "\r"s;
+		for (auto const crlf : { true, false }) {
+			auto const newline = crlf ? "\r\n"s : "\n"s;
+			auto const expected = "a" + newline + "b" + newline + "c" + newline + "d" + newline + newline + "e" + newline + newline + std::string(40, 'x') + newline + std::string(15, 'y') + newline;
+			for (size_t split = 0; split <= size(input); split++) {
+				NewlineConverter nc{ crlf };
+				auto actual = nc.Convert(std::string_view{ input }.substr(0, split));
+				actual += nc.Convert(std::string_view{ input }.substr(split));
+				Assert::AreEqual(expected, actual, ToString((crlf ? "CRLF, split: "s : "LF, split: "s) + std::to_string(split)).c_str());
+			}
+			NewlineConverter nc{ crlf };
+			std::string actual;
+			for (auto const ch : input)
+				actual += nc.Convert({ &ch, 1 });
+			Assert::AreEqual(expected, actual, ToString(crlf ? "CRLF, 1 byte"s : "LF, 1 byte"s).c_str());
+		}
+	}
+
+	TEST_METHOD(FileListArena) {
+		constexpr size_t count = 1'000'000;
+		std::string_view const owners[] = { "root"sv, "ftp"sv, "www-data"sv, "nobody"sv };
+		filelistarena arena;
+		std::vector<const char*> files, interned;
+		files.reserve(count);
+		interned.reserve(count);
+		auto name = [](size_t i) {
+			char buffer[64];
+			auto length = snprintf(buffer, std::size(buffer), "dir%02zu/sub%03zu/file%07zu.txt", i % 97, i % 991, i);
+			return std::string(buffer, length);
+		};
+		auto const start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < count; i++) {
+			files.push_back(arena.store(name(i)));
+			interned.push_back(arena.intern(owners[i % std::size(owners)]));
+		}
+		auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+		for (size_t i = 0; i < count; i++) {
+			Assert::AreEqual(name(i).c_str(), files[i]);
+			Assert::IsTrue(interned[i] == interned[i % std::size(owners)]);
+		}
+		Assert::AreEqual(std::size(owners), arena.interned.size());
+		constexpr size_t legacy = (1024 + 1) + (40 + 1);
+		auto message = "arena: "s + std::to_string(arena.allocated) + " bytes (" + std::to_string(arena.allocated / count) + " bytes/entry), legacy: " + std::to_string(legacy * count) + " bytes, " + std::to_string(elapsed.count()) + " ms\n";
+		Logger::WriteMessage(message.c_str());
+		Assert::IsTrue(arena.allocated < count * 64);
+	}
+
+	TEST_METHOD(FileListIndex) {
+		constexpr size_t count = 100'000;
+		auto name = [](size_t i, size_t variant) {
+			static char const* const formats[] = { "dir%02zu/file%06zu.txt", "Dir%02zu/File%06zu.txt", "DIR%02zu/FILE%06zu.TXT" };
+			char buffer[64];
+			auto length = snprintf(buffer, std::size(buffer), formats[variant % std::size(formats)], i % 97, i);
+			return std::string(buffer, length);
+		};
+		filelistarena arena;
+		filelistindex index;
+		std::vector<std::string_view> local, remote;
+		auto add = [&](std::string const& file) {
+			local.emplace_back(arena.store(file));
+			index.add(local.back(), size(local) - 1);
+		};
+		for (size_t i = 0; i < count; i++) {
+			add(name(i, i));
+			if (i % 7 == 0)
+				add(name(i, i + 1));
+		}
+		for (size_t i = 0; i < count; i++)
+			remote.emplace_back(arena.store(name(i + count / 2, i / 2)));
+
+		auto const names = [&local](size_t i) { return local[i]; };
+		auto search = [&](std::string_view file, int mode) {
+			switch (mode) {
+			case 1:
+				return index.find(file);
+			case 0:
+				return index.findfolded(file, size(local), names);
+			default:
+				return index.find(filelistindex::lower(file));
+			}
+		};
+		auto const start = std::chrono::steady_clock::now();
+		size_t found[3] = {};
+		for (auto const file : remote)
+			for (int mode = 0; mode < 3; mode++)
+				if (search(file, mode) != filelistindex::npos)
+					found[mode]++;
+		auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+		auto message = "100k x 100k: "s + std::to_string(elapsed.count()) + " ms, ignore: " + std::to_string(found[0]) + ", strict: " + std::to_string(found[1]) + ", lowermatch: " + std::to_string(found[2]) + "\n";
+		Logger::WriteMessage(message.c_str());
+
+		auto linear = [&local](std::string_view file, int mode) {
+			for (size_t i = 0; i < size(local); i++)
+				if (mode == 1) {
+					if (strcmp(file.data(), local[i].data()) == 0)
+						return i;
+				} else if (_stricmp(file.data(), local[i].data()) == 0) {
+					if (mode == 0)
+						return i;
+					std::string tmp{ local[i] };
+					_strlwr(data(tmp));
+					if (tmp == local[i])
+						return i;
+				}
+			return filelistindex::npos;
+		};
+		for (size_t i = 0; i < size(remote); i += 97)
+			for (int mode = 0; mode < 3; mode++)
+				Assert::AreEqual(linear(remote[i], mode), search(remote[i], mode), ToString(std::string{ remote[i] }).c_str());
+	}
 };
 }
@@ -0,0 +1,509 @@
+﻿// 分割ダウンロードの動作確認用のローカルFTPサーバ
+//   ループバックで待ち受け、指定サイズの１つのファイルだけを公開する最小限のFTPサーバ
+//   ファイルの内容は位置から決まるパターンで、--verifyでダウンロードしたファイルの内容を検査できる
+//   接続ごとにスレッドで処理し、受け取ったコマンドを接続番号付きで表示するので、
+//   複数の転送コネクションからREST 開始位置＋RETRで範囲ごとに受信していることを確認できる
+//   --dropを指定するとRETRごとに指定量を送ったところでデータコネクションを切断するので、
+//   中断した分割ダウンロードが残りの範囲だけを再開することを確認できる
+//   --abort451を指定すると途中で終えた転送に426ではなく451で応答する（ProFTPDなど）ので、
+//   ファイルの途中で終わる範囲を受信し終えたクライアントが451応答でもその範囲を完了とすることを確認できる
+//   --latencyを指定すると応答を指定時間遅らせて送るので、遠いサーバを模擬できる
+//   応答は別スレッドから送るので、応答を待たずに続けて届いたコマンドも遅延１回分で応答する
+//   --lockstepを指定すると、応答を送り終える前に届いたコマンドを503で拒否するサーバを模擬する（--latencyと併用する）
+//   --loginsを指定すると同時接続数を超えた接続を421で切断するので、転送スレッドがログインをやり直す間隔を確認できる
+//   --pipelineを指定するとサーバを起動してクライアントとして接続し、SIZEを指定回数、１つずつ送った場合と
+//   応答を待たずに--window個まで続けて送った場合（remote.cppのCommandPipeline）の時間を比較する
+//   --ipv6を指定すると[::1]で待ち受ける  --blackholeを指定するともう一方のファミリーのループバックの同じポートへの接続に応答しないので、
+//   localhostに接続してアドレスを並行に試す接続（socket.cppのdo_connect_race）が応答しないファミリーを待たずに接続することを確認できる
+//   （待ち受けキューを埋めておくので、キューが埋まった接続要求を捨てるOSでは応答せず、拒否するOSでは即座に失敗する）
+//   パッシブモード（PASV/EPSV）のみ対応  IPv6ではEPSVのみ
+//     cl /std:c++latest /O2 /EHsc ftpstub.cpp
+//   使い方
+//     ftpstub [--port N] [--size MB] [--name NAME] [--rate MB/s] [--drop MB] [--abort451] [--latency ms] [--lockstep] [--logins N] [--ipv6] [--blackhole]
+//     ftpstub --verify FILE [--size MB]
+//     ftpstub --pipeline N [--window N] [--latency ms] [--lockstep] [--port N]
+#define NOMINMAX
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <winsock2.h>
+#include <WS2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+using namespace std::literals;
+
+static uint64_t fileSize = 256 * 1048576ull;
+static std::string fileName = "large.bin";
+static double rate = 0;			// データコネクション１本あたりの送信速度の上限（バイト/秒） 0=無制限
+static uint64_t drop = 0;		// RETRごとにこの量を送ったら切断する 0=切断しない
+static bool abort451 = false;	// 途中で終えた転送に451で応答する
+static std::chrono::milliseconds latency{ 0 };	// 応答を遅らせる時間
+static bool lockstep = false;	// 応答を送り終える前に届いたコマンドを拒否する
+static bool quiet = false;		// コマンドと応答を表示しない
+static std::atomic<int> sessions = 0;
+static std::atomic<int> active = 0;
+static int logins = 0;			// 同時接続数の上限 0=無制限
+static int family = AF_INET;	// 待ち受けるファミリー
+static std::mutex console;
+
+// 位置posのバイト  8バイトごとに異なる値になるパターン
+static char pattern(uint64_t pos) {
+	auto x = (pos / 8 + 1) * 0x9E3779B97F4A7C15ull;
+	x = (x ^ x >> 30) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ x >> 27) * 0x94D049BB133111EBull;
+	x ^= x >> 31;
+	return static_cast<char>(x >> pos % 8 * 8);
+}
+
+static void fill(char* buffer, uint64_t pos, size_t length) {
+	for (size_t i = 0; i < length; i++)
+		buffer[i] = pattern(pos + i);
+}
+
+template<class... Args>
+static void log(int id, const char* format, Args... args) {
+	if (quiet)
+		return;
+	std::lock_guard lock{ console };
+	printf("[%d] ", id);
+	printf(format, args...);
+	putchar('\n');
+	fflush(stdout);
+}
+
+static bool sendall(SOCKET s, std::string_view data) {
+	for (; !data.empty();)
+		if (auto result = send(s, data.data(), static_cast<int>(data.size()), 0); 0 < result)
+			data.remove_prefix(result);
+		else
+			return false;
+	return true;
+}
+
+// 制御コネクション  応答は受け取った時刻からlatency後に別スレッドから送る
+struct Control {
+	int id;
+	SOCKET s;
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> pending;
+	bool closing = false;
+	std::chrono::steady_clock::time_point received;
+	std::thread sender;
+	Control(int id, SOCKET s) : id{ id }, s{ s }, sender{ [this] { run(); } } {}
+	~Control() {
+		{
+			std::lock_guard lock{ mutex };
+			closing = true;
+		}
+		changed.notify_one();
+		sender.join();
+	}
+	void run() {
+		std::unique_lock lock{ mutex };
+		for (;;) {
+			changed.wait(lock, [this] { return closing || !empty(pending); });
+			if (empty(pending))
+				break;
+			auto const due = pending.front().first;
+			lock.unlock();
+			std::this_thread::sleep_until(due);
+			// 送り終えるまでは次のコマンドを受け付けていない状態にする
+			lock.lock();
+			sendall(s, pending.front().second);
+			pending.pop_front();
+			changed.notify_all();
+		}
+	}
+	// 送っていない応答があるかどうか
+	bool busy() {
+		std::lock_guard lock{ mutex };
+		return !empty(pending);
+	}
+	// 送っていない応答をすべて送り終えるまで待つ
+	void flush() {
+		std::unique_lock lock{ mutex };
+		changed.wait(lock, [this] { return empty(pending); });
+	}
+};
+
+static void reply(Control& control, std::string const& message) {
+	log(control.id, "< %s", message.c_str());
+	{
+		std::lock_guard lock{ control.mutex };
+		control.pending.emplace_back(control.received + latency, message + "\r\n");
+	}
+	control.changed.notify_all();
+}
+
+// ループバックのアドレス  ポートの位置はIPv4とIPv6で同じ
+static std::pair<sockaddr_storage, int> loopback(int af, int port) {
+	sockaddr_storage addr{};
+	addr.ss_family = static_cast<decltype(addr.ss_family)>(af);
+	if (af == AF_INET)
+		reinterpret_cast<sockaddr_in&>(addr).sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	else
+		reinterpret_cast<sockaddr_in6&>(addr).sin6_addr.s6_addr[15] = 1;
+	reinterpret_cast<sockaddr_in&>(addr).sin_port = htons(static_cast<u_short>(port));
+	return { addr, af == AF_INET ? static_cast<int>(sizeof(sockaddr_in)) : static_cast<int>(sizeof(sockaddr_in6)) };
+}
+
+// データコネクションの待ち受けを開始する
+static SOCKET listendata(SOCKET control, int& port) {
+	sockaddr_storage addr{};
+	int addrlen = sizeof addr;
+	getsockname(control, reinterpret_cast<sockaddr*>(&addr), &addrlen);
+	reinterpret_cast<sockaddr_in&>(addr).sin_port = 0;
+	auto listener = socket(addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+	if (bind(listener, reinterpret_cast<sockaddr*>(&addr), addrlen) != 0 || listen(listener, 1) != 0 || getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addrlen) != 0) {
+		closesocket(listener);
+		return INVALID_SOCKET;
+	}
+	port = ntohs(reinterpret_cast<sockaddr_in&>(addr).sin_port);
+	return listener;
+}
+
+// posから送信し、送った量を返す  クライアントがデータコネクションを閉じた場合もそこまでの量を返す
+static uint64_t senddata(SOCKET s, uint64_t pos, uint64_t length) {
+	std::vector<char> buffer(64 * 1024);
+	auto const start = std::chrono::steady_clock::now();
+	uint64_t sent = 0;
+	while (sent < length) {
+		auto const chunk = static_cast<size_t>(std::min<uint64_t>(size(buffer), length - sent));
+		fill(data(buffer), pos + sent, chunk);
+		if (!sendall(s, { buffer.data(), chunk }))
+			break;
+		sent += chunk;
+		if (0 < rate)
+			std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(sent / rate)));
+	}
+	return sent;
+}
+
+static void session(SOCKET s) {
+	auto const id = ++sessions;
+	Control control{ id, s };
+	SOCKET listener = INVALID_SOCKET;
+	uint64_t rest = 0;
+	control.received = std::chrono::steady_clock::now();
+	if (0 < logins && logins < ++active) {
+		reply(control, "421 too many connections");
+		control.flush();
+		closesocket(s);
+		--active;
+		log(id, "refused");
+		return;
+	}
+	reply(control, "220 ftpstub ready");
+	std::string line;
+	for (char ch; recv(s, &ch, 1, 0) == 1;) {
+		if (ch != '\n') {
+			if (ch != '\r')
+				line += ch;
+			continue;
+		}
+		log(id, "> %s", line.c_str());
+		control.received = std::chrono::steady_clock::now();
+		if (lockstep && control.busy()) {
+			line.clear();
+			reply(control, "503 previous command still in progress");
+			continue;
+		}
+		auto const space = line.find(' ');
+		auto command = line.substr(0, space);
+		auto const argument = space == std::string::npos ? ""s : line.substr(space + 1);
+		std::transform(begin(command), end(command), begin(command), [](char c) { return static_cast<char>(toupper(c)); });
+		line.clear();
+		if (command == "USER")
+			reply(control, "331 password required");
+		else if (command == "PASS")
+			reply(control, "230 logged in");
+		else if (command == "SYST")
+			reply(control, "215 UNIX Type: L8");
+		else if (command == "FEAT")
+			reply(control, "211-Features:\r\n SIZE\r\n MDTM\r\n MFMT\r\n REST STREAM\r\n EPSV\r\n211 End");
+		else if (command == "PWD" || command == "XPWD")
+			reply(control, "257 \"/\" is the current directory");
+		else if (command == "CWD" || command == "CDUP")
+			reply(control, "250 directory changed");
+		else if (command == "TYPE" || command == "MODE" || command == "STRU" || command == "OPTS" || command == "NOOP")
+			reply(control, "200 ok");
+		else if (command == "SIZE")
+			reply(control, "213 " + std::to_string(fileSize));
+		else if (command == "MDTM")
+			reply(control, "213 20260101000000");
+		else if (command == "MFMT")
+			reply(control, "213 Modify=" + argument);
+		else if (command == "DELE")
+			reply(control, "250 deleted");
+		else if (command == "SITE")
+			reply(control, "200 ok");
+		else if (command == "REST") {
+			rest = std::strtoull(argument.c_str(), nullptr, 10);
+			reply(control, "350 restarting at " + std::to_string(rest));
+		} else if (command == "PASV" || command == "EPSV") {
+			if (listener != INVALID_SOCKET)
+				closesocket(listener);
+			int port;
+			if (command == "PASV" && family == AF_INET6)
+				reply(control, "425 use EPSV");
+			else if ((listener = listendata(s, port)) == INVALID_SOCKET)
+				reply(control, "425 cannot open data connection");
+			else if (command == "EPSV")
+				reply(control, "229 Entering Extended Passive Mode (|||" + std::to_string(port) + "|)");
+			else
+				reply(control, "227 Entering Passive Mode (127,0,0,1," + std::to_string(port / 256) + "," + std::to_string(port % 256) + ")");
+		} else if (command == "LIST" || command == "NLST" || command == "MLSD" || command == "RETR") {
+			if (listener == INVALID_SOCKET) {
+				reply(control, "425 use PASV first");
+				continue;
+			}
+			auto const retr = command == "RETR";
+			if (retr && argument.substr(argument.rfind('/') + 1) != fileName) {
+				reply(control, "550 no such file");
+				continue;
+			}
+			reply(control, "150 opening data connection");
+			control.flush();
+			auto connection = accept(listener, nullptr, nullptr);
+			closesocket(listener);
+			listener = INVALID_SOCKET;
+			if (!retr) {
+				char listing[256];
+				if (command == "MLSD")
+					snprintf(listing, sizeof listing, "type=file;size=%llu;modify=20260101000000; %s\r\n", static_cast<unsigned long long>(fileSize), fileName.c_str());
+				else if (command == "NLST")
+					snprintf(listing, sizeof listing, "%s\r\n", fileName.c_str());
+				else
+					snprintf(listing, sizeof listing, "-rw-r--r--   1 ftp      ftp      %llu Jan  1  2026 %s\r\n", static_cast<unsigned long long>(fileSize), fileName.c_str());
+				sendall(connection, listing);
+				closesocket(connection);
+				reply(control, "226 transfer complete");
+				continue;
+			}
+			auto const pos = std::min(rest, fileSize);
+			rest = 0;
+			auto length = fileSize - pos;
+			if (0 < drop)
+				length = std::min(length, drop);
+			auto const start = std::chrono::steady_clock::now();
+			auto const sent = senddata(connection, pos, length);
+			auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			shutdown(connection, SD_SEND);
+			closesocket(connection);
+			log(id, "sent %llu-%llu (%.1f MB/s)", static_cast<unsigned long long>(pos), static_cast<unsigned long long>(pos + sent), sent / std::max(elapsed, 1e-6) / 1048576);
+			reply(control, pos + sent == fileSize ? "226 transfer complete" : abort451 ? "451 transfer aborted: local error in processing" : "426 connection closed; transfer aborted");
+		} else if (command == "ABOR")
+			reply(control, "226 abort successful");
+		else if (command == "QUIT") {
+			reply(control, "221 goodbye");
+			break;
+		} else
+			reply(control, "502 command not implemented");
+	}
+	if (listener != INVALID_SOCKET)
+		closesocket(listener);
+	control.flush();
+	closesocket(s);
+	--active;
+	log(id, "closed");
+}
+
+// ダウンロードしたファイルがパターンと一致するか検査する
+static int verify(const char* path) {
+	std::ifstream is{ path, std::ios::binary };
+	if (!is) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return 2;
+	}
+	std::vector<char> buffer(1048576), expected(size(buffer));
+	uint64_t pos = 0;
+	while (auto read = static_cast<size_t>(is.read(data(buffer), size(buffer)).gcount())) {
+		fill(data(expected), pos, read);
+		if (auto mismatch = std::mismatch(begin(buffer), begin(buffer) + read, begin(expected)); mismatch.first != begin(buffer) + read) {
+			printf("mismatch at %llu\n", static_cast<unsigned long long>(pos + (mismatch.first - begin(buffer))));
+			return 1;
+		}
+		pos += read;
+	}
+	if (pos != fileSize) {
+		printf("size %llu, expected %llu\n", static_cast<unsigned long long>(pos), static_cast<unsigned long long>(fileSize));
+		return 1;
+	}
+	printf("ok %llu bytes\n", static_cast<unsigned long long>(pos));
+	return 0;
+}
+
+// ループバックで待ち受ける
+static SOCKET listenon(int af, int port, int backlog = SOMAXCONN) {
+	auto listener = socket(af, SOCK_STREAM, IPPROTO_TCP);
+	auto const [addr, addrlen] = loopback(af, port);
+	if (bind(listener, reinterpret_cast<const sockaddr*>(&addr), addrlen) != 0 || listen(listener, backlog) != 0) {
+		closesocket(listener);
+		fprintf(stderr, "cannot listen on port %d\n", port);
+		return INVALID_SOCKET;
+	}
+	return listener;
+}
+
+// もう一方のファミリーのループバックで待ち受けたまま受け付けず、待ち受けキューを接続要求で埋める
+//   以降の接続要求には応答しない  ソケットは終了まで閉じない
+static bool blackhole(int port) {
+	auto const af = family == AF_INET ? AF_INET6 : AF_INET;
+	if (listenon(af, port, 1) == INVALID_SOCKET)
+		return false;
+	auto const [addr, addrlen] = loopback(af, port);
+	for (int i = 0; i < 8; i++) {
+		auto s = socket(af, SOCK_STREAM, IPPROTO_TCP);
+		u_long nonblocking = 1;
+		ioctlsocket(s, FIONBIO, &nonblocking);
+		connect(s, reinterpret_cast<const sockaddr*>(&addr), addrlen);
+	}
+	printf("not answering on %s:%d\n", af == AF_INET ? "127.0.0.1" : "[::1]", port);
+	return true;
+}
+
+static void serve(SOCKET listener) {
+	for (SOCKET s; (s = accept(listener, nullptr, nullptr)) != INVALID_SOCKET;)
+		std::thread{ session, s }.detach();
+	closesocket(listener);
+}
+
+// 応答を１つ受け取り応答コードを返す  複数行の応答は最後の行まで読む  切断された場合は0
+static int readreply(SOCKET s, std::string& buffer) {
+	for (int code = 0;;) {
+		auto const pos = buffer.find("\r\n"sv);
+		if (pos == std::string::npos) {
+			char chunk[4096];
+			auto const read = recv(s, chunk, sizeof chunk, 0);
+			if (read <= 0)
+				return 0;
+			buffer.append(chunk, read);
+			continue;
+		}
+		auto const line = buffer.substr(0, pos);
+		buffer.erase(0, pos + 2);
+		if (3 <= size(line) && std::all_of(begin(line), begin(line) + 3, [](char c) { return '0' <= c && c <= '9'; })) {
+			auto const current = std::atoi(line.substr(0, 3).c_str());
+			if (code == 0)
+				code = current;
+			if (current == code && (size(line) == 3 || line[3] != '-'))
+				return code;
+		}
+	}
+}
+
+// SIZEをcount回、応答待ちをwindow個までにして送り、かかった時間と失敗した数を表示する
+static bool measure(SOCKET s, std::string& buffer, int count, int window) {
+	auto const start = std::chrono::steady_clock::now();
+	int failed = 0;
+	for (int sent = 0, received = 0; received < count; received++) {
+		std::string commands;
+		for (; sent < count && sent - received < window; sent++)
+			commands += "SIZE " + fileName + "\r\n";
+		if (!empty(commands) && !sendall(s, commands))
+			return false;
+		auto const code = readreply(s, buffer);
+		if (code == 0)
+			return false;
+		if (code / 100 != 2)
+			failed++;
+	}
+	auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("window %-4d %8.3fs %8.2f ms/command, %d failed\n", window, elapsed, elapsed * 1000 / count, failed);
+	return true;
+}
+
+// サーバを起動して接続し、１つずつ送った場合と続けて送った場合を比較する
+static int bench(int port, int count, int window) {
+	quiet = true;
+	auto listener = listenon(family, port);
+	if (listener == INVALID_SOCKET)
+		return 2;
+	std::thread{ serve, listener }.detach();
+	auto s = socket(family, SOCK_STREAM, IPPROTO_TCP);
+	auto const [addr, addrlen] = loopback(family, port);
+	std::string buffer;
+	if (connect(s, reinterpret_cast<const sockaddr*>(&addr), addrlen) != 0 || readreply(s, buffer) != 220) {
+		fprintf(stderr, "cannot connect to port %d\n", port);
+		return 2;
+	}
+	for (auto command : { "USER anonymous\r\n"sv, "PASS guest\r\n"sv })
+		if (!sendall(s, command) || readreply(s, buffer) == 0)
+			return 2;
+	printf("%d SIZE commands, latency %lld ms%s\n", count, static_cast<long long>(latency.count()), lockstep ? ", lockstep server" : "");
+	if (!measure(s, buffer, count, 1) || !measure(s, buffer, count, window))
+		return 1;
+	sendall(s, "QUIT\r\n"sv);
+	readreply(s, buffer);
+	closesocket(s);
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	int port = 2121;
+	const char* target = nullptr;
+	int pipeline = 0;
+	int window = 16;
+	bool hole = false;
+	for (int i = 1; i < argc; i++)
+		if (argv[i] == "--port"sv && i + 1 < argc)
+			port = std::atoi(argv[++i]);
+		else if (argv[i] == "--size"sv && i + 1 < argc)
+			fileSize = std::strtoull(argv[++i], nullptr, 10) * 1048576;
+		else if (argv[i] == "--name"sv && i + 1 < argc)
+			fileName = argv[++i];
+		else if (argv[i] == "--rate"sv && i + 1 < argc)
+			rate = std::strtod(argv[++i], nullptr) * 1048576;
+		else if (argv[i] == "--drop"sv && i + 1 < argc)
+			drop = std::strtoull(argv[++i], nullptr, 10) * 1048576;
+		else if (argv[i] == "--verify"sv && i + 1 < argc)
+			target = argv[++i];
+		else if (argv[i] == "--latency"sv && i + 1 < argc)
+			latency = std::chrono::milliseconds{ std::atoi(argv[++i]) };
+		else if (argv[i] == "--abort451"sv)
+			abort451 = true;
+		else if (argv[i] == "--lockstep"sv)
+			lockstep = true;
+		else if (argv[i] == "--logins"sv && i + 1 < argc)
+			logins = std::atoi(argv[++i]);
+		else if (argv[i] == "--ipv6"sv)
+			family = AF_INET6;
+		else if (argv[i] == "--blackhole"sv)
+			hole = true;
+		else if (argv[i] == "--pipeline"sv && i + 1 < argc)
+			pipeline = std::max(std::atoi(argv[++i]), 1);
+		else if (argv[i] == "--window"sv && i + 1 < argc)
+			window = std::max(std::atoi(argv[++i]), 1);
+		else {
+			fprintf(stderr, "usage: ftpstub [--port N] [--size MB] [--name NAME] [--rate MB/s] [--drop MB] [--abort451] [--latency ms] [--lockstep] [--logins N] [--ipv6] [--blackhole]\n       ftpstub --verify FILE [--size MB]\n       ftpstub --pipeline N [--window N] [--latency ms] [--lockstep] [--port N]\n");
+			return 2;
+		}
+	if (target)
+		return verify(target);
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return 2;
+	if (0 < pipeline) {
+		auto const result = bench(port, pipeline, window);
+		WSACleanup();
+		return result;
+	}
+	auto listener = listenon(family, port);
+	if (listener == INVALID_SOCKET || hole && !blackhole(port))
+		return 2;
+	printf("listening on %s:%d, %s %llu bytes\n", family == AF_INET ? "127.0.0.1" : "[::1]", port, fileName.c_str(), static_cast<unsigned long long>(fileSize));
+	serve(listener);
+	WSACleanup();
+	return 0;
+}
@@ -6,7 +6,9 @@
 #include <set>
 #include <string>
 #include <string_view>
+#include <vector>
 #include <cassert>
+#include <cstdio>
 using namespace std::literals;
 
 static auto hex(std::ssub_match const& sm) {
@@ -111,6 +113,26 @@ static auto regex(std::set<int> const& codes) {
 	return join(std::vector<std::string>{} << u1 << u2 << u3 << u4);
 }
 
+// code point ranges for nfcTable and nfdTable in codecnv.cpp
+static auto table(std::set<int> const& codes) {
+	std::vector<std::pair<int, int>> ranges;
+	for (auto code : codes)
+		if (!empty(ranges) && ranges.back().second + 1 == code)
+			ranges.back().second = code;
+		else
+			ranges.emplace_back(code, code);
+	std::string table;
+	char buffer[32];
+	for (size_t i = 0; i < size(ranges); i++) {
+		snprintf(buffer, std::size(buffer), "{ 0x%04X, 0x%04X },", ranges[i].first, ranges[i].second);
+		table += i % 6 == 0 ? "\t"s : " "s;
+		table += buffer;
+		if (i % 6 == 5 || i + 1 == size(ranges))
+			table += '\n';
+	}
+	return table;
+}
+
 int main() {
 	std::set<int> nfc, nfd;
 	{
@@ -128,4 +150,6 @@ int main() {
 	}
 	std::cout << "NFC:"sv << std::endl << regex(nfc) << std::endl;
 	std::cout << "NFD:"sv << std::endl << regex(nfd) << std::endl;
+	std::cout << "NFC table:"sv << std::endl << table(nfc);
+	std::cout << "NFD table:"sv << std::endl << table(nfd);
 }
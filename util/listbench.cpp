@@ -0,0 +1,343 @@
+﻿// ファイル一覧の解析処理のベンチマークと回帰テスト
+//   filelist.hのみを使用するため、Windows以外でもビルドできる
+//     g++ -std=c++20 -O2 listbench.cpp -lboost_regex
+//     cl /std:c++latest /O2 /EHsc /I<boost> listbench.cpp
+//   使い方
+//     listbench [--lines N] [--runs N] [--corpus FILE] [--baseline FILE] [--save FILE] [--tolerance PERCENT]
+//   生成した行に加え、--corpus (既定は../filelist.txt) の全形式の行を繰り返して計測する
+//   速度は同じ行を同じ形式の正規表現だけで解析した速度との比で表し、計測する環境に依存しないようにする
+//   cascadeは全形式を先頭から試す場合、detectedは判別済みの形式から試す場合 (filelist.cppのParse()と同じ手順)
+//   --baselineを指定すると、保存済みの結果より速度比が許容範囲を超えて低下した項目や
+//   １行あたりのメモリ確保回数が増えた項目を報告し、終了コード1を返す
+#if !defined(_MSC_VER)
+#define _sprintf_p snprintf
+#endif
+#undef unix
+#undef linux
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+#include <boost/regex.hpp>
+#include "../filelist.h"
+using namespace std::literals;
+
+static std::atomic<size_t> allocations = 0;
+
+void* operator new(size_t size) {
+	allocations++;
+	if (auto p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+static auto compile(auto const& p) {
+	auto [pattern, icase] = p;
+	return icase ? boost::regex{ data(pattern), data(pattern) + size(pattern), boost::regex::icase } : boost::regex{ data(pattern), data(pattern) + size(pattern) };
+}
+
+// filelist.cppのdialectsと同じ順序　文字はfilelist.txtで各形式を表す記号
+static const std::vector<std::tuple<std::string_view, char, boost::regex>> dialects = {
+	{ "mlsd"sv,      'm', compile(filelistparser::mlsd)      },
+	{ "unix"sv,      'u', compile(filelistparser::unix)      },
+	{ "linux"sv,     'l', compile(filelistparser::linux)     },
+	{ "dos"sv,       'd', compile(filelistparser::dos)       },
+	{ "melcom80"sv,  'M', compile(filelistparser::melcom80)  },
+	{ "agilent"sv,   'a', compile(filelistparser::agilent)   },
+	{ "as400"sv,     'A', compile(filelistparser::as400)     },
+	{ "m1800"sv,     'n', compile(filelistparser::m1800)     },
+	{ "gp6000"sv,    'g', compile(filelistparser::gp6000)    },
+	{ "chameleon"sv, 'c', compile(filelistparser::chameleon) },
+	{ "os2"sv,       '2', compile(filelistparser::os2)       },
+	{ "os7"sv,       '7', compile(filelistparser::os7)       },
+	{ "os9"sv,       '9', compile(filelistparser::os9)       },
+	{ "allied"sv,    'b', compile(filelistparser::allied)    },
+	{ "ibm"sv,       'i', compile(filelistparser::ibm)       },
+	{ "shibasoku"sv, 's', compile(filelistparser::shibasoku) },
+	{ "stratus"sv,   'S', compile(filelistparser::stratus)   },
+	{ "vms"sv,       'v', compile(filelistparser::vms)       },
+	{ "irmx"sv,      'I', compile(filelistparser::irmx)      },
+	{ "tandem"sv,    't', compile(filelistparser::tandem)    },
+};
+
+static boost::regex const& pattern(std::string_view name) {
+	for (auto const& [n, ch, re] : dialects)
+		if (n == name)
+			return re;
+	std::abort();
+}
+
+// 先頭から順に全形式を試す
+static int cascade(std::string const& line) {
+	boost::smatch m;
+	for (int i = 0; i < (int)size(dialects); i++)
+		if (boost::regex_search(line, m, std::get<2>(dialects[i])))
+			return i;
+	return -1;
+}
+
+// filelist.cppのEarlierDialects()と同じく、形式ごとに同じ行に一致しうるより優先する形式を求める
+static const auto earlier = filelistdialect::overlaps((int)size(dialects), [](int i, char ch) {
+	auto const& re = std::get<2>(dialects[i]);
+	return !re.str().starts_with("^ *"sv) || boost::regex_search(&ch, &ch + 1, re, boost::match_partial | boost::match_continuous);
+});
+
+// filelist.cppのParse()と同じく、判別済みの形式から試して重なりうる形式だけを確かめる
+//   mlsd、unixはスキャナで調べ、それ以外は一致した結果を解析に使うため保持する
+static int detect(std::string const& line, int detected) {
+	boost::smatch m, found;
+	auto test = [&line, &m, &found](int i) {
+		if (auto const name = std::get<0>(dialects[i]); (name == "mlsd"sv || name == "unix"sv) && filelistscanner::supported(line))
+			return name == "mlsd"sv ? filelistscanner::mlsd(line).has_value() : filelistscanner::unix(line).has_value();
+		if (boost::regex_search(line, found, std::get<2>(dialects[i]))) {
+			m.swap(found);
+			return true;
+		}
+		return false;
+	};
+	return filelistdialect::select((int)size(dialects), detected, test, 0 <= detected ? earlier[detected] : 0);
+}
+
+static int index(std::string_view name) {
+	for (int i = 0; i < (int)size(dialects); i++)
+		if (std::get<0>(dialects[i]) == name)
+			return i;
+	std::abort();
+}
+
+// 擬似乱数 (環境によらず同じ結果にする)
+struct xorshift {
+	uint64_t state = 88172645463325252ull;
+	unsigned operator()(unsigned n) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return static_cast<unsigned>(state % n);
+	}
+};
+
+static const char* const months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+static const char* const MONTHS[] = { "JAN", "FEB", "MAR", "APR", "MAY", "JUN", "JUL", "AUG", "SEP", "OCT", "NOV", "DEC" };
+
+static std::vector<std::string> generate(std::string_view dialect, size_t count) {
+	xorshift rnd;
+	std::vector<std::string> lines;
+	lines.reserve(count);
+	char buffer[256];
+	for (size_t i = 0; i < count; i++) {
+		int len = 0;
+		if (dialect == "unix"sv) {
+			auto const type = rnd(10);
+			auto const perm = type == 0 ? "drwxr-xr-x" : type == 1 ? "lrwxrwxrwx" : "-rw-r--r--";
+			auto const size = rnd(100) == 0 ? 4096ull * rnd(1 << 20) : rnd(1 << 20);
+			auto const date = rnd(2) ? std::to_string(rnd(24)) + ":" + std::to_string(10 + rnd(50)) : std::to_string(1990 + rnd(35));
+			len = snprintf(buffer, std::size(buffer), "%s %3u user%02u   group%u %10llu %s %2u %5s %s%07zu%s", perm, 1 + rnd(20), rnd(100), rnd(10), size, months[rnd(12)], 1 + rnd(28), date.c_str(),
+				type == 0 ? "dir" : "file", i, type == 0 ? "" : type == 1 ? ".lnk -> target" : ".txt");
+		} else if (dialect == "dos"sv) {
+			auto const dir = rnd(10) == 0;
+			auto const size = dir ? "<DIR>"s : std::to_string(rnd(1 << 30));
+			len = snprintf(buffer, std::size(buffer), "%02u-%02u-%02u  %02u:%02u%s %14s %s%07zu%s", 1 + rnd(12), 1 + rnd(28), rnd(100), 1 + rnd(12), rnd(60), rnd(2) ? "AM" : "PM", size.c_str(),
+				dir ? "Folder " : "File ", i, dir ? "" : ".txt");
+		} else if (dialect == "vms"sv) {
+			auto const dir = rnd(10) == 0;
+			len = snprintf(buffer, std::size(buffer), "%s%07zu.%s;%u %*u/%u %2u-%s-%u %02u:%02u:%02u [USER%u] (RWED,RWED,RE,)", dir ? "DIR" : "FILE", i, dir ? "DIR" : "TXT", 1 + rnd(9), 8, rnd(100000), 1 + rnd(100000),
+				1 + rnd(28), MONTHS[rnd(12)], 1990 + rnd(35), rnd(24), rnd(60), rnd(60), rnd(10));
+		} else if (dialect == "mlsd"sv) {
+			auto const dir = rnd(10) == 0;
+			len = snprintf(buffer, std::size(buffer), "type=%s;size=%u;modify=%04u%02u%02u%02u%02u%02u;perm=%s;UNIX.mode=0%o; %s%07zu%s", dir ? "dir" : "file", rnd(1 << 30), 1990 + rnd(35), 1 + rnd(12), 1 + rnd(28), rnd(24), rnd(60), rnd(60),
+				dir ? "flcdmpe" : "adfrw", dir ? 0755u : 0644u, dir ? "dir" : "file", i, dir ? "" : ".txt");
+		}
+		lines.emplace_back(buffer, len);
+	}
+	return lines;
+}
+
+// filelist.txtから形式ごとの行を読み込み、countに達するまで繰り返す
+//   どの形式にも一致しない行 (記号@) は計測できないため除く
+static std::map<std::string_view, std::vector<std::string>> load(const char* file, size_t count) {
+	std::map<std::string_view, std::vector<std::string>> samples;
+	std::ifstream is{ file };
+	if (!is) {
+		std::cerr << "cannot open "sv << file << std::endl;
+		std::exit(2);
+	}
+	for (std::string line; getline(is, line);)
+		if (2 < size(line) && line[1] == '\t')
+			for (auto const& [name, ch, re] : dialects)
+				if (ch == line[0])
+					samples[name].push_back(line.substr(2));
+	for (auto& [name, lines] : samples)
+		for (size_t i = 0, n = size(lines); size(lines) < count; i = (i + 1) % n)
+			lines.push_back(lines[i]);
+	return samples;
+}
+
+struct result {
+	double rate;			// 行/秒
+	double allocations;		// 行あたりのメモリ確保回数
+	double ratio = 1;		// 同じ行を正規表現で解析した速度との比
+};
+
+// 速い処理でも時間を測れるように、0.2秒以上経つまで全行の解析を繰り返す
+static result measure(std::vector<std::string> const& lines, std::function<bool(std::string const&)> const& parse) {
+	size_t parsed = 0;
+	double elapsed = 0;
+	auto const before = allocations.load();
+	auto const start = std::chrono::steady_clock::now();
+	do {
+		size_t matched = 0;
+		for (auto const& line : lines)
+			matched += parse(line);
+		if (matched != size(lines)) {
+			std::cerr << "unmatched lines: "sv << size(lines) - matched << std::endl;
+			std::exit(2);
+		}
+		parsed += size(lines);
+		elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	} while (elapsed < 0.2);
+	return { parsed / elapsed, double(allocations.load() - before) / parsed };
+}
+
+// 回帰テスト  全行について、期待する形式に一致し、スキャナと正規表現の結果が同じであること
+static bool verify(std::string_view dialect, std::vector<std::string> const& lines) {
+	auto const& re = pattern(dialect);
+	for (auto const& line : lines) {
+		boost::smatch m;
+		if (!boost::regex_search(line, m, re)) {
+			std::cerr << dialect << ": not matched: "sv << line << std::endl;
+			return false;
+		}
+		if ((dialect == "unix"sv || dialect == "mlsd"sv) && filelistscanner::supported(line)) {
+			auto compare = [&](auto const& scanned) {
+				if (!scanned)
+					return false;
+				for (size_t i = 1; i < size(*scanned); i++)
+					if ((m[i].matched ? m[i].str() : ""s) != (*scanned)[i])
+						return false;
+				return true;
+			};
+			if (!(dialect == "unix"sv ? compare(filelistscanner::unix(line)) : compare(filelistscanner::mlsd(line)))) {
+				std::cerr << dialect << ": scanner differs: "sv << line << std::endl;
+				return false;
+			}
+		}
+		if (auto const i = cascade(line); dialect != "vms"sv && std::get<0>(dialects[i]) != dialect) {
+			std::cerr << dialect << ": detected as "sv << std::get<0>(dialects[i]) << ": "sv << line << std::endl;
+			return false;
+		} else if (detect(line, index(dialect)) != i) {
+			std::cerr << dialect << ": select differs from cascade: "sv << line << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	size_t count = 1'000'000;
+	int runs = 5;
+	const char* corpus = "../filelist.txt";
+	const char* baseline = nullptr;
+	const char* save = nullptr;
+	double tolerance = 40;
+	for (int i = 1; i < argc; i++)
+		if (argv[i] == "--lines"sv && i + 1 < argc)
+			count = std::strtoull(argv[++i], nullptr, 10);
+		else if (argv[i] == "--runs"sv && i + 1 < argc)
+			runs = std::max(1, std::atoi(argv[++i]));
+		else if (argv[i] == "--corpus"sv && i + 1 < argc)
+			corpus = argv[++i];
+		else if (argv[i] == "--baseline"sv && i + 1 < argc)
+			baseline = argv[++i];
+		else if (argv[i] == "--save"sv && i + 1 < argc)
+			save = argv[++i];
+		else if (argv[i] == "--tolerance"sv && i + 1 < argc)
+			tolerance = std::strtod(argv[++i], nullptr);
+		else {
+			std::cerr << "usage: listbench [--lines N] [--runs N] [--corpus FILE] [--baseline FILE] [--save FILE] [--tolerance PERCENT]"sv << std::endl;
+			return 2;
+		}
+
+	std::map<std::string, result> results;
+	auto ok = true;
+	// 同じ形式の正規表現だけで解析した速度を基準に、全形式を順に試す場合とスキャナの速度比を求める
+	//   負荷の変動の影響を減らすため、各回で全方式を続けて計測し、回ごとの速度比の中央値を採る
+	auto bench = [&](std::string const& prefix, std::string_view dialect, std::vector<std::string> const& lines) {
+		if (!verify(dialect, lines)) {
+			ok = false;
+			return;
+		}
+		auto const& re = pattern(dialect);
+		std::vector<std::pair<std::string, std::function<bool(std::string const&)>>> methods{
+			{ ".regex", [&re](std::string const& line) { boost::smatch m; return boost::regex_search(line, m, re); } },
+			{ ".cascade", [](std::string const& line) { return 0 <= cascade(line); } },
+			{ ".detected", [detected = index(dialect)](std::string const& line) { return 0 <= detect(line, detected); } },
+		};
+		if (dialect == "unix"sv)
+			methods.emplace_back(".scanner", [](std::string const& line) { return filelistscanner::unix(line).has_value(); });
+		else if (dialect == "mlsd"sv)
+			methods.emplace_back(".scanner", [](std::string const& line) { return filelistscanner::mlsd(line).has_value(); });
+		std::vector<std::vector<result>> measured(size(methods));
+		for (int run = 0; run < runs; run++)
+			for (size_t i = 0; i < size(methods); i++)
+				measured[i].push_back(measure(lines, methods[i].second));
+		for (size_t i = 0; i < size(methods); i++) {
+			std::vector<double> ratios;
+			auto& r = results[prefix + methods[i].first] = measured[i][0];
+			for (int run = 0; run < runs; run++) {
+				r.rate = std::max(r.rate, measured[i][run].rate);
+				ratios.push_back(measured[i][run].rate / measured[0][run].rate);
+			}
+			std::nth_element(begin(ratios), begin(ratios) + size(ratios) / 2, end(ratios));
+			r.ratio = ratios[size(ratios) / 2];
+		}
+	};
+	for (auto dialect : { "unix"sv, "dos"sv, "vms"sv, "mlsd"sv })
+		bench(std::string{ dialect }, dialect, generate(dialect, count));
+	for (auto const& [dialect, lines] : load(corpus, std::max<size_t>(count / 10, 1)))
+		bench("corpus." + std::string{ dialect }, dialect, lines);
+
+	printf("%-24s %14s %10s %12s\n", "benchmark", "lines/s", "ratio", "allocs/line");
+	for (auto const& [name, r] : results)
+		printf("%-24s %14.0f %10.3f %12.2f\n", name.c_str(), r.rate, r.ratio, r.allocations);
+
+	if (baseline) {
+		std::ifstream is{ baseline };
+		if (!is) {
+			std::cerr << "cannot open "sv << baseline << std::endl;
+			return 2;
+		}
+		std::string name;
+		for (result base; is >> name >> base.ratio >> base.allocations;)
+			if (auto it = results.find(name); it == end(results)) {
+				printf("MISSING    %s\n", name.c_str());
+				ok = false;
+			} else if (auto const& r = it->second; r.ratio < base.ratio * (1 - tolerance / 100)) {
+				printf("REGRESSION %s: %.3f x regex (baseline %.3f)\n", name.c_str(), r.ratio, base.ratio);
+				ok = false;
+			} else if (base.allocations + 0.01 < r.allocations) {
+				printf("REGRESSION %s: %.2f allocs/line (baseline %.2f)\n", name.c_str(), r.allocations, base.allocations);
+				ok = false;
+			}
+	}
+	if (save) {
+		std::ofstream os{ save };
+		for (auto const& [name, r] : results)
+			os << name << ' ' << r.ratio << ' ' << r.allocations << '\n';
+	}
+	return ok ? 0 : 1;
+}
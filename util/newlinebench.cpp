@@ -0,0 +1,104 @@
+﻿// 改行コード変換のベンチマーク
+//   newline.hのNewlineConverterと、置き換える前のboost::regex_replaceによるToCRLFとを比較する
+//   NewlineConverterはnewline.hを直接使用するため、Windows以外でもビルドできる
+//     g++ -std=c++20 -O2 newlinebench.cpp -lboost_regex
+//     cl /std:c++latest /O2 /EHsc /I<boost> newlinebench.cpp
+//   使い方
+//     newlinebench [--size MB] [--chunk KB]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string_view>
+#include <boost/regex.hpp>
+#include "../newline.h"
+using namespace std::literals;
+
+// 置き換える前の実装
+static std::string ToCRLF(std::string_view source) {
+	static boost::regex re{ R"(\r\n|[\r\n])" };
+	std::string result;
+	boost::regex_replace(back_inserter(result), begin(source), end(source), re, "\r\n");
+	return result;
+}
+
+// 平均80文字程度の行からなるテキストを作る  改行コードはCRLF、LF、CRが混在する
+static std::string generate(size_t bytes) {
+	std::mt19937 rnd{ 1 };
+	std::string text;
+	text.reserve(bytes + 128);
+	while (size(text) < bytes) {
+		for (auto n = rnd() % 160; 0 < n; n--)
+			text += static_cast<char>(' ' + rnd() % 95);
+		switch (rnd() % 4) {
+		case 0:
+			text += "\r\n"sv;
+			break;
+		case 1:
+			text += '\r';
+			break;
+		default:
+			text += '\n';
+			break;
+		}
+	}
+	text.resize(bytes);
+	return text;
+}
+
+template<class Func>
+static double measure(std::string_view text, size_t chunk, Func&& func) {
+	size_t output = 0;
+	auto const start = std::chrono::steady_clock::now();
+	for (size_t pos = 0; pos < size(text); pos += chunk)
+		output += size(func(text.substr(pos, chunk)));
+	auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (output == 0)
+		std::exit(2);
+	return size(text) / elapsed / 1e9;
+}
+
+// 回帰テスト  任意の位置でチャンクを分割しても、全体を一度に変換した結果と一致すること
+static bool verify(std::string const& text) {
+	std::mt19937 rnd{ 2 };
+	for (auto crlf : { true, false }) {
+		auto expected = ToCRLF(text);
+		if (!crlf)
+			expected = boost::regex_replace(expected, boost::regex{ "\r\n" }, "\n");
+		NewlineConverter nc{ crlf };
+		std::string actual;
+		for (size_t pos = 0; pos < size(text);) {
+			auto const length = std::min<size_t>(1 + rnd() % 300, size(text) - pos);
+			actual += nc.Convert(std::string_view{ text }.substr(pos, length));
+			pos += length;
+		}
+		if (actual != expected) {
+			printf("mismatch (%s)\n", crlf ? "CRLF" : "LF");
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	size_t megabytes = 256;
+	size_t chunk = 64;
+	for (int i = 1; i < argc; i++)
+		if (argv[i] == "--size"sv && i + 1 < argc)
+			megabytes = std::strtoull(argv[++i], nullptr, 10);
+		else if (argv[i] == "--chunk"sv && i + 1 < argc)
+			chunk = std::strtoull(argv[++i], nullptr, 10);
+		else {
+			fprintf(stderr, "usage: newlinebench [--size MB] [--chunk KB]\n");
+			return 2;
+		}
+	if (!verify(generate(4 * 1048576)) || !verify("\r\r\n\n\r"s))
+		return 1;
+	auto const text = generate(megabytes * 1048576);
+	printf("%-10s %8.3f GB/s\n", "regex", measure(text, chunk * 1024, ToCRLF));
+	NewlineConverter crlf{ true }, lf{ false };
+	printf("%-10s %8.3f GB/s\n", "to CRLF", measure(text, chunk * 1024, [&crlf](std::string_view str) { return crlf.Convert(str); }));
+	printf("%-10s %8.3f GB/s\n", "to LF", measure(text, chunk * 1024, [&lf](std::string_view str) { return lf.Convert(str); }));
+	return 0;
+}
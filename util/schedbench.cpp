@@ -0,0 +1,163 @@
+﻿// 転送の順序（getput.cppのScheduleTransPacket）ごとの、全ファイルの転送が終わるまでの時間の比較
+//   転送ファイルリストを複数の接続で処理する様子を模擬する
+//   各接続は空くたびにgetput.cppと同じ方法で次のファイルを選び、１ファイルごとのコマンドの往復時間と
+//   接続あたりの転送速度からかかる時間を求める
+//   ファイル転送以外の処理（MKDなど）は順序を入れ替えない区切りとして扱う
+//   転送ファイルリストはデバッグウインドウの"TransList Cmd="の行を保存したログから読み込む
+//   ログを指定しない場合は典型的な転送ファイルリストを生成して比較する
+//     cl /std:c++latest /O2 /EHsc schedbench.cpp
+//   使い方
+//     schedbench [--threads N] [--rate MB/s] [--overhead ms] [--window N] [LOG...]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std::literals;
+
+enum class Policy { Fifo, Largest, Mixed };
+
+struct Item {
+	bool transfer;		// ファイル転送（RETR/STOR/STOU）かどうか
+	long long size;
+};
+
+static int threads = 4;
+static double rate = 10.0 * 1048576;
+static double overhead = 0.05;
+static int window = 256;
+
+// getput.cppのScheduleTransPacketと同じ方法で次に処理する項目を選ぶ
+static size_t select(std::vector<Item> const& queue, size_t next, Policy policy, bool& alternate) {
+	if (policy == Policy::Fifo || threads < 2 || !queue[next].transfer)
+		return next;
+	auto const largest = policy != Policy::Mixed || !(alternate = !alternate);
+	auto selected = next;
+	auto it = next + 1;
+	for (int count = 1; count < window && it < size(queue) && queue[it].transfer; ++count, ++it)
+		if (largest ? queue[selected].size < queue[it].size : queue[it].size < queue[selected].size)
+			selected = it;
+	return selected;
+}
+
+// すべての項目を処理し終えるまでの時間
+static double simulate(std::vector<Item> queue, Policy policy) {
+	std::priority_queue<double, std::vector<double>, std::greater<>> free;
+	for (int i = 0; i < threads; i++)
+		free.push(0);
+	auto alternate = false;
+	double makespan = 0;
+	for (size_t next = 0; next < size(queue); next++) {
+		auto const now = free.top();
+		free.pop();
+		std::swap(queue[next], queue[select(queue, next, policy, alternate)]);
+		auto const end = now + overhead + (queue[next].transfer ? queue[next].size / rate : 0);
+		makespan = std::max(makespan, end);
+		free.push(end);
+	}
+	return makespan;
+}
+
+// 下限  全体の転送量を全接続で分け合う時間と、最大のファイル１つの時間の大きい方
+static double lowerbound(std::vector<Item> const& queue) {
+	double total = 0, largest = 0;
+	for (auto const& item : queue) {
+		auto const time = overhead + (item.transfer ? item.size / rate : 0);
+		total += time;
+		largest = std::max(largest, time);
+	}
+	return std::max(total / threads, largest);
+}
+
+// デバッグウインドウのログから転送ファイルリストを読み込む
+//   TransList Cmd=RETR : remote : local : size
+static std::vector<Item> load(const char* path) {
+	std::vector<Item> queue;
+	std::ifstream is{ path };
+	for (std::string line; std::getline(is, line);) {
+		auto const pos = line.find("TransList Cmd="sv);
+		if (pos == std::string::npos)
+			continue;
+		auto const cmd = std::string_view{ line }.substr(pos + 14);
+		if (cmd.starts_with("RETR"sv) || cmd.starts_with("STOR"sv) || cmd.starts_with("STOU"sv)) {
+			auto const sep = line.rfind(" : "sv);
+			queue.push_back({ true, sep == std::string::npos ? 0 : std::atoll(line.c_str() + sep + 3) });
+		} else if (!cmd.starts_with("SETCUR"sv) && !cmd.starts_with("BACKCUR"sv) && !cmd.starts_with("NULL"sv))
+			queue.push_back({ false, 0 });
+	}
+	return queue;
+}
+
+static std::vector<std::pair<std::string, std::vector<Item>>> generate() {
+	std::mt19937_64 random{ 1 };
+	std::vector<std::pair<std::string, std::vector<Item>>> queues;
+	constexpr long long MB = 1048576;
+
+	// 先頭に大きなファイルが１つあり、その後に小さいファイルが続く
+	std::vector<Item> front{ { true, 20 * 1024 * MB } };
+	for (int i = 0; i < 500; i++)
+		front.push_back({ true, std::uniform_int_distribution<long long>{ 100 * 1024, 10 * MB }(random) });
+	queues.emplace_back("large at front", front);
+
+	// 小さいファイルの最後に大きなファイルがいくつかある
+	std::vector<Item> tail;
+	for (int i = 0; i < 500; i++)
+		tail.push_back({ true, std::uniform_int_distribution<long long>{ 100 * 1024, 10 * MB }(random) });
+	for (int i = 0; i < 3; i++)
+		tail.push_back({ true, 4 * 1024 * MB });
+	queues.emplace_back("large at end", tail);
+
+	// フォルダごとに作成してからファイルを転送する  ファイルのサイズは対数正規分布
+	std::vector<Item> folders;
+	std::lognormal_distribution<double> lognormal{ std::log(2.0 * MB), 2.0 };
+	for (int dir = 0; dir < 20; dir++) {
+		folders.push_back({ false, 0 });
+		for (int i = 0; i < 100; i++)
+			folders.push_back({ true, static_cast<long long>(lognormal(random)) });
+	}
+	queues.emplace_back("folders", folders);
+
+	// 同じくらいのサイズのファイルが多数
+	std::vector<Item> uniform;
+	for (int i = 0; i < 2000; i++)
+		uniform.push_back({ true, std::uniform_int_distribution<long long>{ 2 * MB, 8 * MB }(random) });
+	queues.emplace_back("uniform", uniform);
+	return queues;
+}
+
+int main(int argc, char* argv[]) {
+	std::vector<std::pair<std::string, std::vector<Item>>> queues;
+	for (int i = 1; i < argc; i++)
+		if (argv[i] == "--threads"sv && i + 1 < argc)
+			threads = std::max(std::atoi(argv[++i]), 1);
+		else if (argv[i] == "--rate"sv && i + 1 < argc)
+			rate = std::strtod(argv[++i], nullptr) * 1048576;
+		else if (argv[i] == "--overhead"sv && i + 1 < argc)
+			overhead = std::strtod(argv[++i], nullptr) / 1000;
+		else if (argv[i] == "--window"sv && i + 1 < argc)
+			window = std::max(std::atoi(argv[++i]), 1);
+		else if (argv[i][0] != '-')
+			queues.emplace_back(argv[i], load(argv[i]));
+		else {
+			fprintf(stderr, "usage: schedbench [--threads N] [--rate MB/s] [--overhead ms] [--window N] [LOG...]\n");
+			return 2;
+		}
+	if (empty(queues))
+		queues = generate();
+	printf("%d connections, %.1f MB/s each, %.0f ms per file, window %d\n", threads, rate / 1048576, overhead * 1000, window);
+	printf("%-20s %6s %10s %10s %10s %10s\n", "queue", "items", "bound", "fifo", "largest", "mixed");
+	for (auto const& [name, queue] : queues) {
+		auto const bound = lowerbound(queue);
+		printf("%-20s %6zu %9.1fs", name.c_str(), size(queue), bound);
+		for (auto policy : { Policy::Fifo, Policy::Largest, Policy::Mixed })
+			printf(" %9.1fs", simulate(queue, policy));
+		putchar('\n');
+	}
+	return 0;
+}
@@ -0,0 +1,207 @@
+﻿// ループバック接続でのソケット待機方法・ダウンロードの書き込み方法ごとの転送速度の比較
+//   socket.cppのdo_recv/SendDataと同様にノンブロッキングソケットで送受信し、
+//   WSAEWOULDBLOCKの際の待機をSleep(1)によるポーリングとWSAPollによる待機とで比較する
+//   またgetput.cppのDownloadFileと同様に受信したデータをファイルに書き込み、
+//   変換経路（チャンクごとにstd::stringへ複製）とバイナリ経路（受信バッファを直接書き込み）とで
+//   転送１バイトあたりの複製バイト数を比較する
+//   さらに書き込みを指定の速度に制限した低速なディスクを模して、受信と書き込みを交互に行う場合と
+//   書き込みスレッドで並行して行う場合（getput.cppのFileWriterと同様）とを比較する
+//     cl /std:c++latest /O2 /EHsc socketbench.cpp
+//   使い方
+//     socketbench [--size MB] [--buffer KB] [--disk MB/s]
+#define NOMINMAX
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <winsock2.h>
+#include <WS2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+using namespace std::literals;
+
+enum class Wait { Sleep, Poll };
+enum class Sink { None, Convert, Binary, Slow, Pipelined };
+
+static size_t copied = 0;
+static double diskRate = 100.0 * 1048576;
+
+// 書き込み速度を制限した低速なディスク
+static void slowwrite(size_t length) {
+	std::this_thread::sleep_for(std::chrono::duration<double>(length / diskRate));
+}
+
+// 受信と並行して低速なディスクに書き込む  queueが満杯になると受信側を待たせる
+class Pipeline {
+	std::deque<size_t> queue;
+	bool closed = false;
+	std::mutex mutex;
+	std::condition_variable filled, emptied;
+	std::thread writer{ [this] {
+		for (std::unique_lock lock{ mutex };;) {
+			filled.wait(lock, [this] { return !queue.empty() || closed; });
+			if (queue.empty())
+				return;
+			auto const length = queue.front();
+			lock.unlock();
+			slowwrite(length);
+			lock.lock();
+			queue.pop_front();
+			emptied.notify_one();
+		}
+	} };
+public:
+	void push(size_t length) {
+		std::unique_lock lock{ mutex };
+		emptied.wait(lock, [this] { return queue.size() < 16; });
+		queue.push_back(length);
+		filled.notify_one();
+	}
+	~Pipeline() {
+		{
+			std::lock_guard lock{ mutex };
+			closed = true;
+		}
+		filled.notify_one();
+		writer.join();
+	}
+};
+
+static void wait(SOCKET s, short events, Wait mode) {
+	if (mode == Wait::Sleep)
+		Sleep(1);
+	else {
+		WSAPOLLFD fd{ s, events };
+		WSAPoll(&fd, 1, 10);
+	}
+}
+
+static void nonblocking(SOCKET s) {
+	u_long on = 1;
+	ioctlsocket(s, FIONBIO, &on);
+}
+
+static void sender(SOCKET s, size_t total, size_t buffer, Wait mode) {
+	std::vector<char> data(buffer, 'x');
+	for (size_t sent = 0; sent < total;) {
+		auto const len = static_cast<int>(std::min(buffer, total - sent));
+		for (std::string_view rest{ data.data(), static_cast<size_t>(len) }; !rest.empty();)
+			if (auto result = send(s, rest.data(), static_cast<int>(rest.size()), 0); 0 < result)
+				rest.remove_prefix(result);
+			else if (WSAGetLastError() == WSAEWOULDBLOCK)
+				wait(s, POLLWRNORM, mode);
+			else
+				return;
+		sent += len;
+	}
+	shutdown(s, SD_SEND);
+}
+
+static size_t receiver(SOCKET s, size_t buffer, Wait mode, Sink sink) {
+	std::ofstream os;
+	std::optional<Pipeline> pipeline;
+	if (sink == Sink::Pipelined)
+		pipeline.emplace();
+	if (sink == Sink::Convert || sink == Sink::Binary) {
+		os.open(std::filesystem::temp_directory_path() / L"socketbench.tmp", std::ios::binary | std::ios::trunc);
+		if (sink == Sink::Binary)
+			os.rdbuf()->pubsetbuf(nullptr, 0);
+	}
+	std::vector<char> data(buffer);
+	size_t received = 0;
+	for (;;)
+		if (auto result = recv(s, data.data(), static_cast<int>(buffer), 0); 0 < result) {
+			received += result;
+			if (sink == Sink::Convert) {
+				std::string converted{ data.data(), static_cast<size_t>(result) };
+				copied += converted.size();
+				os.write(converted.data(), converted.size());
+			} else if (sink == Sink::Binary)
+				os.write(data.data(), result);
+			else if (sink == Sink::Slow)
+				slowwrite(result);
+			else if (sink == Sink::Pipelined)
+				pipeline->push(result);
+		} else if (result == 0 || WSAGetLastError() != WSAEWOULDBLOCK)
+			return received;
+		else
+			wait(s, POLLRDNORM, mode);
+}
+
+static double cputime() {
+	FILETIME creation, exit, kernel, user;
+	GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+	auto const ticks = (ULARGE_INTEGER{ kernel.dwLowDateTime, kernel.dwHighDateTime }.QuadPart + ULARGE_INTEGER{ user.dwLowDateTime, user.dwHighDateTime }.QuadPart);
+	return ticks / 1e7;
+}
+
+static bool run(const char* name, Wait mode, Sink sink, size_t total, size_t buffer) {
+	auto listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	sockaddr_in addr{ AF_INET };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int addrlen = sizeof addr;
+	if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 || listen(listener, 1) != 0 || getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addrlen) != 0)
+		return false;
+	auto client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (connect(client, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0)
+		return false;
+	auto server = accept(listener, nullptr, nullptr);
+	closesocket(listener);
+	nonblocking(client);
+	nonblocking(server);
+
+	copied = 0;
+	auto const cpu = cputime();
+	auto const start = std::chrono::steady_clock::now();
+	std::thread thread{ sender, server, total, buffer, mode };
+	auto const received = receiver(client, buffer, mode, sink);
+	thread.join();
+	auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	auto const used = cputime() - cpu;
+	closesocket(server);
+	closesocket(client);
+	if (received != total) {
+		printf("%-8s received %zu of %zu bytes\n", name, received, total);
+		return false;
+	}
+	printf("%-8s %10.1f MB/s %8.2f s %8.2f s CPU %6.2f copied/byte\n", name, total / elapsed / 1048576, elapsed, used, double(copied) / total);
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	size_t total = 1024;
+	size_t buffer = 64;
+	for (int i = 1; i < argc; i++)
+		if (argv[i] == "--size"sv && i + 1 < argc)
+			total = std::strtoull(argv[++i], nullptr, 10);
+		else if (argv[i] == "--buffer"sv && i + 1 < argc)
+			buffer = std::strtoull(argv[++i], nullptr, 10);
+		else if (argv[i] == "--disk"sv && i + 1 < argc)
+			diskRate = std::strtod(argv[++i], nullptr) * 1048576;
+		else {
+			fprintf(stderr, "usage: socketbench [--size MB] [--buffer KB] [--disk MB/s]\n");
+			return 2;
+		}
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return 2;
+	auto const ok = run("sleep", Wait::Sleep, Sink::None, total * 1048576, buffer * 1024)
+		&& run("poll", Wait::Poll, Sink::None, total * 1048576, buffer * 1024)
+		&& run("convert", Wait::Poll, Sink::Convert, total * 1048576, buffer * 1024)
+		&& run("binary", Wait::Poll, Sink::Binary, total * 1048576, buffer * 1024)
+		&& run("slow", Wait::Poll, Sink::Slow, total * 1048576, buffer * 1024)
+		&& run("pipeline", Wait::Poll, Sink::Pipelined, total * 1048576, buffer * 1024);
+	std::error_code ec;
+	std::filesystem::remove(std::filesystem::temp_directory_path() / L"socketbench.tmp", ec);
+	WSACleanup();
+	return ok ? 0 : 1;
+}